@@ -0,0 +1,229 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "BulkDataIndex.h"
+
+#include "Dicom.h"
+#include "RawDicomParser.h"
+
+#include <Core/OrthancException.h>
+
+#include <json/reader.h>
+#include <json/writer.h>
+#include <stdio.h>
+#include <boost/lexical_cast.hpp>
+
+namespace OrthancPlugins
+{
+  class BulkDataIndex::Visitor : public RawDicomParser::IVisitor
+  {
+  private:
+    Content&  content_;
+
+  public:
+    explicit Visitor(Content& content) :
+      content_(content)
+    {
+    }
+
+    virtual void VisitElement(const std::vector<gdcm::Tag>& tags,
+                              const std::vector<unsigned int>& items,
+                              const std::string& vr,
+                              size_t offset,
+                              size_t length)
+    {
+      if (IsBulkData(vr))
+      {
+        Range range;
+        range.offset_ = offset;
+        range.length_ = length;
+        content_[FormatPath(tags, items)] = range;
+      }
+    }
+  };
+
+
+  bool BulkDataIndex::Build(const void* dicom,
+                            size_t size,
+                            const std::string& attachmentMD5,
+                            const gdcm::Dict& dictionary)
+  {
+    if (attachmentMD5.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    content_.clear();
+    attachmentMD5_ = attachmentMD5;
+    fileSize_ = size;
+
+    RawDicomParser parser(dicom, size);
+    Visitor visitor(content_);
+
+    if (parser.Apply(visitor, dictionary))
+    {
+      return true;
+    }
+    else
+    {
+      content_.clear();
+      return false;
+    }
+  }
+
+
+  bool BulkDataIndex::Lookup(uint64_t& offset,
+                             uint64_t& length,
+                             const std::vector<gdcm::Tag>& tags,
+                             const std::vector<unsigned int>& items) const
+  {
+    Content::const_iterator found = content_.find(FormatPath(tags, items));
+
+    if (found == content_.end())
+    {
+      return false;
+    }
+    else
+    {
+      offset = found->second.offset_;
+      length = found->second.length_;
+      return true;
+    }
+  }
+
+
+  void BulkDataIndex::Serialize(std::string& target) const
+  {
+    Json::Value elements = Json::objectValue;
+
+    for (Content::const_iterator it = content_.begin(); it != content_.end(); ++it)
+    {
+      Json::Value range = Json::arrayValue;
+      range.append(boost::lexical_cast<std::string>(it->second.offset_));
+      range.append(boost::lexical_cast<std::string>(it->second.length_));
+      elements[it->first] = range;
+    }
+
+    Json::Value json = Json::objectValue;
+    json["AttachmentMD5"] = attachmentMD5_;
+    json["FileSize"] = boost::lexical_cast<std::string>(fileSize_);
+    json["Elements"] = elements;
+
+    Json::FastWriter writer;
+    target = writer.write(json);
+  }
+
+
+  bool BulkDataIndex::Unserialize(const std::string& source)
+  {
+    content_.clear();
+    attachmentMD5_.clear();
+    fileSize_ = 0;
+
+    Json::Value json;
+    Json::Reader reader;
+
+    if (!reader.parse(source, json) ||
+        json.type() != Json::objectValue ||
+        !json.isMember("AttachmentMD5") ||
+        !json.isMember("FileSize") ||
+        !json.isMember("Elements") ||
+        json["AttachmentMD5"].type() != Json::stringValue ||
+        json["AttachmentMD5"].asString().empty() ||
+        json["FileSize"].type() != Json::stringValue ||
+        json["Elements"].type() != Json::objectValue)
+    {
+      return false;
+    }
+
+    try
+    {
+      // The 64-bit integers are stored as strings, as they are not
+      // supported by all the versions of JsonCpp
+      fileSize_ = boost::lexical_cast<uint64_t>(json["FileSize"].asString());
+
+      const Json::Value& elements = json["Elements"];
+      Json::Value::Members members = elements.getMemberNames();
+
+      for (size_t i = 0; i < members.size(); i++)
+      {
+        const Json::Value& item = elements[members[i]];
+        if (item.type() != Json::arrayValue ||
+            item.size() != 2 ||
+            item[0].type() != Json::stringValue ||
+            item[1].type() != Json::stringValue)
+        {
+          content_.clear();
+          return false;
+        }
+
+        Range range;
+        range.offset_ = boost::lexical_cast<uint64_t>(item[0].asString());
+        range.length_ = boost::lexical_cast<uint64_t>(item[1].asString());
+
+        if (range.offset_ > fileSize_ ||
+            range.length_ > fileSize_ - range.offset_)
+        {
+          content_.clear();
+          return false;
+        }
+
+        content_[members[i]] = range;
+      }
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      content_.clear();
+      return false;
+    }
+
+    attachmentMD5_ = json["AttachmentMD5"].asString();
+    return true;
+  }
+
+
+  std::string BulkDataIndex::FormatPath(const std::vector<gdcm::Tag>& tags,
+                                        const std::vector<unsigned int>& items)
+  {
+    if (tags.empty() ||
+        items.size() + 1 != tags.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    std::string path;
+
+    for (size_t i = 0; i < tags.size(); i++)
+    {
+      char tag[16];
+      sprintf(tag, "%04x%04x", tags[i].GetGroup(), tags[i].GetElement());
+
+      if (i != 0)
+      {
+        path += "/" + boost::lexical_cast<std::string>(items[i - 1]) + "/";
+      }
+
+      path += tag;
+    }
+
+    return path;
+  }
+}
@@ -0,0 +1,111 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <gdcmDict.h>
+#include <gdcmTag.h>
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+
+namespace OrthancPlugins
+{
+  /**
+   * Index mapping the path of each bulk data element of a DICOM file
+   * (as in its BulkDataURI, e.g. "00540016/1/00181074") to the
+   * position of its value in the file. The index is only of use if
+   * ranges of the attachments can be read: The plugin SDK 1.1.0 has
+   * no such primitive, and "RetrieveBulkData()" rather locates the
+   * value in the downloaded file with "RawDicomParser::LookupValue()".
+   * The index is bound to the MD5 of the attachment, as a file of the
+   * same size might be re-uploaded for the same instance.
+   **/
+  class BulkDataIndex : public boost::noncopyable
+  {
+  private:
+    struct Range
+    {
+      uint64_t  offset_;
+      uint64_t  length_;
+    };
+
+    typedef std::map<std::string, Range>  Content;
+
+    class Visitor;
+
+    std::string  attachmentMD5_;
+    uint64_t     fileSize_;
+    Content      content_;
+
+  public:
+    BulkDataIndex() :
+      fileSize_(0)
+    {
+    }
+
+    // Returns "false" if the file cannot be indexed (cf. "RawDicomParser").
+    // The MD5 is the one reported by Orthanc for the attachment, which
+    // requires the "StoreMD5ForAttachments" option to be enabled.
+    bool Build(const void* dicom,
+               size_t size,
+               const std::string& attachmentMD5,
+               const gdcm::Dict& dictionary);
+
+    const std::string& GetAttachmentMD5() const
+    {
+      return attachmentMD5_;
+    }
+
+    uint64_t GetFileSize() const
+    {
+      return fileSize_;
+    }
+
+    // Tells whether the index describes the current version of the
+    // attachment
+    bool IsValid(const std::string& attachmentMD5) const
+    {
+      return (!attachmentMD5_.empty() &&
+              attachmentMD5_ == attachmentMD5);
+    }
+
+    size_t GetSize() const
+    {
+      return content_.size();
+    }
+
+    bool Lookup(uint64_t& offset /* out */,
+                uint64_t& length /* out */,
+                const std::vector<gdcm::Tag>& tags,
+                const std::vector<unsigned int>& items) const;
+
+    void Serialize(std::string& target) const;
+
+    bool Unserialize(const std::string& source);
+
+    static std::string FormatPath(const std::vector<gdcm::Tag>& tags,
+                                  const std::vector<unsigned int>& items);
+  };
+}
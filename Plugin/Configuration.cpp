@@ -28,6 +28,7 @@
 
 #include "Plugin.h"
 #include "DicomWebServers.h"
+#include "MultipartStreamReader.h"
 
 #include <Core/Toolbox.h>
 
@@ -85,117 +86,99 @@ namespace OrthancPlugins
   }
 
 
-  static const boost::regex MULTIPART_HEADERS_ENDING("(.*?\r\n)\r\n(.*)");
-  static const boost::regex MULTIPART_HEADERS_LINE(".*?\r\n");
-
-  static void ParseMultipartHeaders(bool& hasLength /* out */,
-                                    size_t& length /* out */,
-                                    std::string& contentType /* out */,
-                                    OrthancPluginContext* context,
-                                    const char* startHeaders,
-                                    const char* endHeaders)
+  ByteRangeStatus ParseByteRange(uint64_t& start,
+                                 uint64_t& end,
+                                 const std::string& range,
+                                 uint64_t size)
   {
-    hasLength = false;
-    contentType = "application/octet-stream";
+    static const boost::regex pattern("\\s*(bytes\\s*=\\s*)?([0-9]*)\\s*-\\s*([0-9]*)\\s*");
 
-    // Loop over the HTTP headers of this multipart item
-    boost::cregex_token_iterator it(startHeaders, endHeaders, MULTIPART_HEADERS_LINE, 0);
-    boost::cregex_token_iterator iteratorEnd;
+    boost::cmatch what;
+    if (!boost::regex_match(range.c_str(), what, pattern) ||
+        (what.length(2) == 0 && what.length(3) == 0))
+    {
+      return ByteRangeStatus_Invalid;  // Syntax error, or list of ranges
+    }
 
-    for (; it != iteratorEnd; ++it)
+    try
     {
-      const std::string line(*it);
-      size_t colon = line.find(':');
-      size_t eol = line.find('\r');
-
-      if (colon != std::string::npos &&
-          eol != std::string::npos &&
-          colon < eol &&
-          eol + 2 == line.length())
+      if (what.length(2) == 0)
       {
-        std::string key = Orthanc::Toolbox::StripSpaces(line.substr(0, colon));
-        Orthanc::Toolbox::ToLowerCase(key);
-
-        const std::string value = Orthanc::Toolbox::StripSpaces(line.substr(colon + 1, eol - colon - 1));
-
-        if (key == "content-length")
+        // Suffix range: The last bytes of the resource
+        uint64_t suffix = boost::lexical_cast<uint64_t>(what.str(3));
+        if (suffix == 0 ||
+            size == 0)
         {
-          try
-          {
-            int tmp = boost::lexical_cast<int>(value);
-            if (tmp >= 0)
-            {
-              hasLength = true;
-              length = tmp;
-            }
-          }
-          catch (boost::bad_lexical_cast&)
-          {
-            OrthancPluginLogWarning(context, "Unable to parse the Content-Length of a multipart item");
-          }
+          return ByteRangeStatus_Unsatisfiable;
         }
-        else if (key == "content-type")
+
+        start = (suffix >= size ? 0 : size - suffix);
+        end = size;
+        return ByteRangeStatus_Satisfiable;
+      }
+
+      start = boost::lexical_cast<uint64_t>(what.str(2));
+
+      if (what.length(3) == 0)
+      {
+        end = size;
+      }
+      else
+      {
+        uint64_t last = boost::lexical_cast<uint64_t>(what.str(3));
+        if (last < start)
         {
-          contentType = value;
+          return ByteRangeStatus_Invalid;
         }
+
+        // The last byte is inclusive, and may exceed the size
+        end = (last >= size ? size : last + 1);
       }
+
+      return (start < size ? ByteRangeStatus_Satisfiable : ByteRangeStatus_Unsatisfiable);
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      return ByteRangeStatus_Invalid;  // Overflow
     }
   }
 
 
-  static const char* ParseMultipartItem(std::vector<MultipartItem>& result,
-                                        OrthancPluginContext* context,
-                                        const char* start,
-                                        const char* end,
-                                        const boost::regex& nextSeparator)
+  namespace
   {
-    // Just before "start", it is guaranteed that "--[BOUNDARY]\r\n" is present
-
-    boost::cmatch what;
-    if (!boost::regex_match(start, end, what, MULTIPART_HEADERS_ENDING, boost::match_perl))
+    // Collects the parts of a multipart body, that point inside the body
+    class MultipartItemsCollector : public MultipartStreamReader::IHandler
     {
-      // Cannot find the HTTP headers of this multipart item
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
-    }
-
-    // Some aliases for more clarity
-    assert(what[1].first == start);
-    const char* startHeaders = what[1].first;
-    const char* endHeaders = what[1].second;
-    const char* startBody = what[2].first;
+    private:
+      std::vector<MultipartItem>&  items_;
 
-    bool hasLength;
-    size_t length;
-    std::string contentType;
-    ParseMultipartHeaders(hasLength, length, contentType, context, startHeaders, endHeaders);
-
-    boost::cmatch separator;
-
-    if (hasLength)
-    {
-      if (!boost::regex_match(startBody + length, end, separator, nextSeparator, boost::match_perl) ||
-          startBody + length != separator[1].first)
+    public:
+      explicit MultipartItemsCollector(std::vector<MultipartItem>& items) :
+        items_(items)
       {
-        // Cannot find the separator after skipping the "Content-Length" bytes
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
       }
-    }
-    else
-    {
-      if (!boost::regex_match(startBody, end, separator, nextSeparator, boost::match_perl))
+
+      virtual void HandlePart(const MultipartStreamReader::HttpHeaders& headers,
+                              const void* part,
+                              size_t size)
       {
-        // No more occurrence of the boundary separator
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
-      }
-    }
+        MultipartItem item;
+        item.data_ = reinterpret_cast<const char*>(part);
+        item.size_ = size;
 
-    MultipartItem item;
-    item.data_ = startBody;
-    item.size_ = separator[1].first - startBody;
-    item.contentType_ = contentType;
-    result.push_back(item);
+        MultipartStreamReader::HttpHeaders::const_iterator contentType = headers.find("content-type");
+        if (contentType == headers.end())
+        {
+          item.contentType_ = "application/octet-stream";
+        }
+        else
+        {
+          item.contentType_ = contentType->second;
+        }
 
-    return separator[1].second;  // Return the end of the separator
+        items_.push_back(item);
+      }
+    };
   }
 
 
@@ -210,39 +193,8 @@ namespace OrthancPlugins
 
     result.clear();
 
-    // Look for the first boundary separator in the body (note the "?"
-    // to request non-greedy search)
-    const boost::regex firstSeparator1("--" + boundary + "(--|\r\n).*");
-    const boost::regex firstSeparator2(".*?\r\n--" + boundary + "(--|\r\n).*");
-
-    // Look for the next boundary separator in the body (note the "?"
-    // to request non-greedy search)
-    const boost::regex nextSeparator(".*?(\r\n--" + boundary + ").*");
-
-    const char* end = body + bodySize;
-
-    boost::cmatch what;
-    if (boost::regex_match(body, end, what, firstSeparator1, boost::match_perl | boost::match_single_line) ||
-        boost::regex_match(body, end, what, firstSeparator2, boost::match_perl | boost::match_single_line))
-    {
-      const char* current = what[1].first;
-
-      while (current != NULL &&
-             current + 2 < end)
-      {
-        if (current[0] != '\r' ||
-            current[1] != '\n')
-        {
-          // We reached a separator with a trailing "--", which
-          // means that reading the multipart body is done
-          break;
-        }
-        else
-        {
-          current = ParseMultipartItem(result, context, current + 2, end, nextSeparator);
-        }
-      }
-    }
+    MultipartItemsCollector collector(result);
+    MultipartStreamReader::ParseBody(collector, body, static_cast<size_t>(bodySize), boundary);
   }
 
 
@@ -34,6 +34,17 @@
 #  define HAS_SEND_MULTIPART_ITEM_2   1
 #endif
 
+// The chunked HTTP client was introduced in the plugin SDK 1.5.7
+#if (ORTHANC_PLUGINS_MINIMAL_MAJOR_NUMBER > 1 ||                  \
+     (ORTHANC_PLUGINS_MINIMAL_MAJOR_NUMBER == 1 &&                 \
+      (ORTHANC_PLUGINS_MINIMAL_MINOR_NUMBER > 5 ||                 \
+       (ORTHANC_PLUGINS_MINIMAL_MINOR_NUMBER == 5 &&               \
+        ORTHANC_PLUGINS_MINIMAL_REVISION_NUMBER >= 7))))
+#  define HAS_CHUNKED_HTTP_CLIENT   1
+#else
+#  define HAS_CHUNKED_HTTP_CLIENT   0
+#endif
+
 namespace OrthancPlugins
 {
   struct MultipartItem
@@ -43,6 +54,13 @@ namespace OrthancPlugins
     std::string   contentType_;
   };
 
+  enum ByteRangeStatus
+  {
+    ByteRangeStatus_Satisfiable,
+    ByteRangeStatus_Unsatisfiable,   // Valid range that is outside of the resource
+    ByteRangeStatus_Invalid          // Syntax error or list of ranges
+  };
+
   bool LookupHttpHeader(std::string& value,
                         const OrthancPluginHttpRequest* request,
                         const std::string& header);
@@ -51,6 +69,17 @@ namespace OrthancPlugins
                         std::map<std::string, std::string>& attributes,
                         const std::string& header);
 
+  // Parses a single byte range, either from the HTTP "Range" header
+  // ("bytes=first-last", "bytes=first-" or "bytes=-suffix") or from
+  // the "range" media type parameter ("first-last"). The resulting
+  // range is [start, end[. As specified by RFC 7233, an invalid range
+  // must be ignored, whereas a range that cannot be satisfied by a
+  // resource of the given size must be answered with a 416 status.
+  ByteRangeStatus ParseByteRange(uint64_t& start /* out */,
+                                 uint64_t& end /* out */,
+                                 const std::string& range,
+                                 uint64_t size);
+
   void ParseMultipartBody(std::vector<MultipartItem>& result,
                           OrthancPluginContext* context,
                           const char* body,
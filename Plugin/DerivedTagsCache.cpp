@@ -0,0 +1,225 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "DerivedTagsCache.h"
+#include <cassert>
+
+namespace OrthancPlugins
+{
+  // Default number of resources whose derived attributes are kept in memory
+  static const size_t DEFAULT_MAX_SIZE = 10000;
+
+  // Number of invalidated resources that are individually tracked,
+  // beyond which all the values being computed are dropped
+  static const size_t MAX_INVALIDATIONS = 10000;
+
+
+  DerivedTagsCache::DerivedTagsCache() :
+    revision_(0),
+    floor_(0),
+    maxSize_(DEFAULT_MAX_SIZE)
+  {
+  }
+
+
+  void DerivedTagsCache::RemoveInternal(Content::iterator entry)
+  {
+    assert(entry != content_.end());
+    recency_.erase(entry->second.recency_);
+    content_.erase(entry);
+  }
+
+
+  bool DerivedTagsCache::IsOutdated(unsigned int revision,
+                                    const std::string& resource) const
+  {
+    if (revision < floor_)
+    {
+      return true;
+    }
+
+    Invalidations::const_iterator found = invalidations_.find(resource);
+    return (found != invalidations_.end() &&
+            found->second > revision);
+  }
+
+
+  DerivedTagsCache& DerivedTagsCache::GetInstance()
+  {
+    static DerivedTagsCache singleton;
+    return singleton;
+  }
+
+
+  unsigned int DerivedTagsCache::GetRevision()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return revision_;
+  }
+
+
+  bool DerivedTagsCache::Lookup(std::string& instance,
+                                Tags& tags,
+                                const std::string& resource)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Content::iterator found = content_.find(resource);
+    if (found == content_.end())
+    {
+      return false;
+    }
+    else
+    {
+      recency_.splice(recency_.begin(), recency_, found->second.recency_);
+      instance = found->second.instance_;
+      tags = found->second.tags_;
+      return true;
+    }
+  }
+
+
+  void DerivedTagsCache::Store(unsigned int revision,
+                               const std::string& resource,
+                               const std::string& instance,
+                               const Tags& tags)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (maxSize_ == 0 ||
+        IsOutdated(revision, resource))
+    {
+      // This resource has changed since its derived attributes were
+      // computed: They might be outdated, so don't store them
+      return;
+    }
+
+    Content::iterator found = content_.find(resource);
+    if (found != content_.end())
+    {
+      RemoveInternal(found);
+    }
+
+    while (content_.size() >= maxSize_)
+    {
+      // Drop the least recently used resource
+      RemoveInternal(content_.find(recency_.back()));
+    }
+
+    recency_.push_front(resource);
+
+    Entry& entry = content_[resource];
+    entry.instance_ = instance;
+    entry.tags_ = tags;
+    entry.recency_ = recency_.begin();
+  }
+
+
+  void DerivedTagsCache::Invalidate(const std::string& resource)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    revision_++;
+
+    if (invalidations_.size() >= MAX_INVALIDATIONS)
+    {
+      // Forget about the individual invalidations, which drops the
+      // values of all the resources that are being computed
+      invalidations_.clear();
+      floor_ = revision_;
+    }
+    else
+    {
+      invalidations_[resource] = revision_;
+    }
+
+    Content::iterator found = content_.find(resource);
+    if (found != content_.end())
+    {
+      RemoveInternal(found);
+    }
+  }
+
+
+  void DerivedTagsCache::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    revision_++;
+    floor_ = revision_;
+    invalidations_.clear();
+    content_.clear();
+    recency_.clear();
+  }
+
+
+  void DerivedTagsCache::SetMaxSize(size_t size)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maxSize_ = size;
+
+    while (content_.size() > maxSize_)
+    {
+      RemoveInternal(content_.find(recency_.back()));
+    }
+  }
+
+
+  size_t DerivedTagsCache::GetSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return content_.size();
+  }
+
+
+  void DerivedTagsCache::SignalChange(OrthancPluginChangeType changeType,
+                                      OrthancPluginResourceType resourceType,
+                                      const std::string& resourceId)
+  {
+    switch (changeType)
+    {
+      case OrthancPluginChangeType_NewChildInstance:
+        // The Orthanc core signals a new instance to each of its
+        // parent resources, which gives the study and the series
+        // whose counters are to be updated
+      case OrthancPluginChangeType_StableSeries:
+      case OrthancPluginChangeType_StableStudy:
+        Invalidate(resourceId);
+        break;
+
+      case OrthancPluginChangeType_Deleted:
+        if (resourceType == OrthancPluginResourceType_Study ||
+            resourceType == OrthancPluginResourceType_Series)
+        {
+          Invalidate(resourceId);
+        }
+        else
+        {
+          // The parent study and series of a deleted instance or the
+          // children of a deleted patient are not known anymore
+          Clear();
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+}
@@ -0,0 +1,106 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <orthanc/OrthancCPlugin.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <gdcmTag.h>
+
+namespace OrthancPlugins
+{
+  /**
+   * Cache of the derived attributes of the studies and series (number
+   * of related series/instances, modalities in study) that are
+   * reported by QIDO-RS, indexed by the Orthanc identifier of the
+   * resource. The cache is invalidated by the changes that are
+   * signaled by the Orthanc core. The number of cached resources is
+   * bounded, the least recently used ones being dropped first.
+   **/
+  class DerivedTagsCache : public boost::noncopyable
+  {
+  public:
+    typedef std::map<gdcm::Tag, std::string>  Tags;
+
+  private:
+    typedef std::list<std::string>  Recency;   // Resources, the most recently used first
+
+    struct Entry
+    {
+      std::string        instance_;
+      Tags               tags_;
+      Recency::iterator  recency_;
+    };
+
+    typedef std::map<std::string, Entry>         Content;
+    typedef std::map<std::string, unsigned int>  Invalidations;
+
+    boost::mutex   mutex_;
+    unsigned int   revision_;
+    unsigned int   floor_;           // No value computed before this revision is stored
+    size_t         maxSize_;
+    Content        content_;
+    Recency        recency_;
+    Invalidations  invalidations_;   // Revision of the last invalidation of the resources
+
+    DerivedTagsCache();  // Forbidden (singleton pattern)
+
+    void RemoveInternal(Content::iterator entry);
+
+    bool IsOutdated(unsigned int revision,
+                    const std::string& resource) const;
+
+  public:
+    static DerivedTagsCache& GetInstance();
+
+    // The revision is incremented each time some entry is
+    // invalidated. It must be read before computing the derived
+    // attributes, so that the values of a resource that has changed
+    // in the meantime are not stored.
+    unsigned int GetRevision();
+
+    bool Lookup(std::string& instance /* out */,
+                Tags& tags /* out */,
+                const std::string& resource);
+
+    void Store(unsigned int revision,
+               const std::string& resource,
+               const std::string& instance,
+               const Tags& tags);
+
+    void Invalidate(const std::string& resource);
+
+    void Clear();
+
+    // In number of resources, 0 disables the cache
+    void SetMaxSize(size_t size);
+
+    size_t GetSize();
+
+    void SignalChange(OrthancPluginChangeType changeType,
+                      OrthancPluginResourceType resourceType,
+                      const std::string& resourceId);
+  };
+}
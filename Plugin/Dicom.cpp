@@ -23,9 +23,11 @@
 
 #include "Plugin.h"
 #include "ChunkedBuffer.h"
+#include "MemoryStream.h"
 
 #include <Core/Toolbox.h>
 
+#include <gdcmAttribute.h>
 #include <gdcmDictEntry.h>
 #include <gdcmStringFilter.h>
 #include <boost/lexical_cast.hpp>
@@ -208,18 +210,70 @@ namespace OrthancPlugins
 
 
 
-  void ParsedDicomFile::Setup(const std::string& dicom)
+  void ParsedDicomFile::AddPixelDataPlaceholder()
   {
-    // Prepare a memory stream over the DICOM instance
-    std::stringstream stream(dicom);
+    gdcm::DataSet& dataset = reader_.GetFile().GetDataSet();
+
+    if (!dataset.FindDataElement(DICOM_TAG_ROWS) ||
+        dataset.FindDataElement(DICOM_TAG_PIXEL_DATA))
+    {
+      // Not an image, or the pixel data was already read
+      return;
+    }
+
+    // Empty element with the VR of the pixel data, so that the
+    // metadata still reports its "BulkDataURI"
+    gdcm::DataElement element(DICOM_TAG_PIXEL_DATA);
+
+    gdcm::Attribute<0x0028, 0x0100> bitsAllocated;  // Bits Allocated
+    bitsAllocated.SetFromDataSet(dataset);
+
+    if (reader_.GetFile().GetHeader().GetDataSetTransferSyntax().IsEncapsulated() ||
+        bitsAllocated.GetValue() <= 8)
+    {
+      element.SetVR(gdcm::VR::OB);
+    }
+    else
+    {
+      element.SetVR(gdcm::VR::OW);
+    }
+
+    dataset.Insert(element);
+  }
+
+
+  void ParsedDicomFile::Setup(const void* dicom,
+                              size_t size,
+                              bool headerOnly)
+  {
+    // Prepare a memory stream over the DICOM instance, without copying it
+    MemoryInputStream stream(dicom, size);
 
     // Parse the DICOM instance using GDCM
     reader_.SetStream(stream);
 
-    if (!reader_.Read())
+    bool success;
+    if (headerOnly)
+    {
+      // Stop at the pixel data, without loading its value
+      std::set<gdcm::Tag> skip;
+      skip.insert(DICOM_TAG_PIXEL_DATA);
+      success = reader_.ReadUpToTag(DICOM_TAG_PIXEL_DATA, skip);
+
+      if (success)
+      {
+        AddPixelDataPlaceholder();
+      }
+    }
+    else
+    {
+      success = reader_.Read();
+    }
+
+    if (!success)
     {
       OrthancPlugins::Configuration::LogError("GDCM cannot decode this DICOM instance of length " +
-                                              boost::lexical_cast<std::string>(dicom.size()));
+                                              boost::lexical_cast<std::string>(size));
       throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
     }
   }
@@ -227,17 +281,20 @@ namespace OrthancPlugins
 
   ParsedDicomFile::ParsedDicomFile(const OrthancPlugins::MultipartItem& item)
   {
-    // TODO Avoid this unnecessary memcpy by defining a stream over the MultipartItem
-    std::string dicom(item.data_, item.data_ + item.size_);
-    Setup(dicom);
+    Setup(item.data_, item.size_, false);
   }
 
 
   ParsedDicomFile::ParsedDicomFile(const OrthancPlugins::MemoryBuffer& buffer)
   {
-    // TODO Avoid this unnecessary memcpy by defining a stream over the MemoryBuffer
-    std::string dicom(buffer.GetData(), buffer.GetData() + buffer.GetSize());
-    Setup(dicom);
+    Setup(buffer.GetData(), buffer.GetSize(), false);
+  }
+
+
+  ParsedDicomFile::ParsedDicomFile(const OrthancPlugins::MemoryBuffer& buffer,
+                                   bool headerOnly)
+  {
+    Setup(buffer.GetData(), buffer.GetSize(), headerOnly);
   }
 
 
@@ -290,6 +347,101 @@ namespace OrthancPlugins
   }
 
 
+  DicomTagsPeeker::DicomTagsPeeker(const void* dicom,
+                                   size_t size) :
+    parser_(dicom, size),
+    count_(0),
+    done_(false)
+  {
+  }
+
+
+  void DicomTagsPeeker::AddTag(const gdcm::Tag& tag)
+  {
+    if (done_ ||
+        count_ == MAX_TAGS)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    tags_[count_] = tag;
+    count_++;
+  }
+
+
+  bool DicomTagsPeeker::Apply()
+  {
+    if (done_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (count_ == 0)
+    {
+      done_ = true;
+      return parser_.IsSupported();
+    }
+
+    gdcm::Tag maxTag = tags_[0];
+    for (size_t i = 1; i < count_; i++)
+    {
+      if (maxTag < tags_[i])
+      {
+        maxTag = tags_[i];
+      }
+    }
+
+    done_ = true;
+    return (parser_.LookupValues(values_, sizes_, tags_, count_, maxTag) ==
+            RawDicomParser::Status_Found);
+  }
+
+
+  bool DicomTagsPeeker::LookupValue(const char*& value,
+                                    size_t& size,
+                                    const gdcm::Tag& tag) const
+  {
+    if (!done_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    for (size_t i = 0; i < count_; i++)
+    {
+      if (tags_[i] == tag)
+      {
+        value = values_[i];
+        size = sizes_[i];
+        return (value != NULL);
+      }
+    }
+
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+
+
+  std::string DicomTagsPeeker::GetStringValue(const gdcm::Tag& tag,
+                                              const std::string& defaultValue) const
+  {
+    const char* value = NULL;
+    size_t size = 0;
+
+    if (!LookupValue(value, size, tag))
+    {
+      return defaultValue;
+    }
+
+    while (size > 0 &&
+           (value[size - 1] == '\0' ||
+            value[size - 1] == ' '))
+    {
+      size--;
+    }
+
+    return std::string(value, size);
+  }
+
+
   bool ParsedDicomFile::GetStringTag(std::string& result,
                                      const gdcm::Dict& dictionary,
                                      const gdcm::Tag& tag,
@@ -368,7 +520,7 @@ namespace OrthancPlugins
 
 
 
-  static bool IsBulkData(const std::string& vr)
+  bool IsBulkData(const std::string& vr)
   {
     /**
      * Full list of VR (Value Representations) that are admissible for
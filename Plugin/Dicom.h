@@ -22,6 +22,7 @@
 #pragma once
 
 #include "Configuration.h"
+#include "RawDicomParser.h"
 
 #include <Core/ChunkedBuffer.h>
 #include <Core/Enumerations.h>
@@ -60,16 +61,25 @@ namespace OrthancPlugins
   private:
     gdcm::Reader reader_;
 
-    void Setup(const std::string& dicom);
+    void Setup(const void* dicom,
+               size_t size,
+               bool headerOnly);
+
+    void AddPixelDataPlaceholder();
 
   public:
     explicit ParsedDicomFile(const OrthancPlugins::MultipartItem& item);
 
     explicit ParsedDicomFile(const OrthancPlugins::MemoryBuffer& item);
 
+    // If "headerOnly" is true, the parsing stops at the pixel data,
+    // whose value is not loaded. This is sufficient for the metadata.
+    ParsedDicomFile(const OrthancPlugins::MemoryBuffer& item,
+                    bool headerOnly);
+
     explicit ParsedDicomFile(const std::string& dicom)
     {
-      Setup(dicom);
+      Setup(dicom.empty() ? NULL : dicom.c_str(), dicom.size(), false);
     }
 
     const gdcm::File& GetFile() const
@@ -105,10 +115,58 @@ namespace OrthancPlugins
   };
 
 
+  /**
+   * Reads a handful of top-level elements (typically the UIDs) from
+   * the raw bytes of a DICOM file, in one forward scan that stops
+   * after the last requested tag. The values point inside the
+   * buffer, that must remain valid as long as the peeker is in use.
+   * If "Apply()" returns false, the caller must fall back to GDCM.
+   **/
+  class DicomTagsPeeker : public boost::noncopyable
+  {
+  private:
+    enum
+    {
+      MAX_TAGS = 8
+    };
+
+    RawDicomParser  parser_;
+    size_t          count_;
+    gdcm::Tag       tags_[MAX_TAGS];
+    const char*     values_[MAX_TAGS];
+    size_t          sizes_[MAX_TAGS];
+    bool            done_;
+
+  public:
+    DicomTagsPeeker(const void* dicom,
+                    size_t size);
+
+    void AddTag(const gdcm::Tag& tag);
+
+    bool Apply();
+
+    bool LookupValue(const char*& value /* out */,
+                     size_t& size /* out */,
+                     const gdcm::Tag& tag) const;
+
+    // The trailing padding of the value is removed
+    std::string GetStringValue(const gdcm::Tag& tag,
+                               const std::string& defaultValue) const;
+
+    std::string GetTransferSyntax() const
+    {
+      return parser_.GetTransferSyntax();
+    }
+  };
+
+
   const char* GetVRName(bool& isSequence /* out */,
                         const gdcm::Dict& dictionary,
                         const gdcm::Tag& tag);
 
+  // Tells whether an element with this VR is retrieved as bulk data
+  bool IsBulkData(const std::string& vr);
+
   void GenerateSingleDicomAnswer(std::string& result,
                                  const std::string& wadoBase,
                                  const gdcm::Dict& dictionary,
@@ -35,45 +35,66 @@ namespace OrthancPlugins
                              OrthancPluginRestOutput* output,
                              const std::string& wadoBase,
                              const gdcm::Dict& dictionary,
-                             bool isXml,
+                             Format format,
                              bool isBulkAccessible) :
     context_(context),
     output_(output),
     wadoBase_(wadoBase),
     dictionary_(dictionary),
     isFirst_(true),
-    isXml_(isXml),
+    format_(format),
     isBulkAccessible_(isBulkAccessible)
   {
-    if (isXml_ &&
-        OrthancPluginStartMultipartAnswer(context_, output_, "related", "application/dicom+xml") != 0)
+    switch (format_)
     {
-      OrthancPlugins::Configuration::LogError("Unable to create a multipart stream of DICOM+XML answers");
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
-    }
+      case Format_Json:
+        // The JSON array is directly written into one single string,
+        // to avoid the copies of "Orthanc::ChunkedBuffer::Flatten()"
+        json_ = "[\n";
+        break;
+
+      case Format_JsonMultipart:
+        if (OrthancPluginStartMultipartAnswer(context_, output_, "related", "application/dicom+json") != 0)
+        {
+          OrthancPlugins::Configuration::LogError("Unable to create a multipart stream of DICOM+JSON answers");
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+        }
+        break;
+
+      case Format_Xml:
+        if (OrthancPluginStartMultipartAnswer(context_, output_, "related", "application/dicom+xml") != 0)
+        {
+          OrthancPlugins::Configuration::LogError("Unable to create a multipart stream of DICOM+XML answers");
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+        }
+        break;
 
-    jsonWriter_.AddChunk("[\n");
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
   }
 
 
   void DicomResults::AddInternal(const std::string& item)
   {
-    if (isXml_)
+    if (format_ == Format_Json)
     {
-      if (OrthancPluginSendMultipartItem(context_, output_, item.c_str(), item.size()) != 0)
+      if (!isFirst_)
       {
-        OrthancPlugins::Configuration::LogError("Unable to create a multipart stream of DICOM+XML answers");
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+        json_ += ",\n";
       }
+
+      json_ += item;
     }
     else
     {
-      if (!isFirst_)
+      // Each item is sent as soon as it is available, which bounds
+      // the memory and lowers the time to the first byte
+      if (OrthancPluginSendMultipartItem(context_, output_, item.c_str(), item.size()) != 0)
       {
-        jsonWriter_.AddChunk(",\n");
+        OrthancPlugins::Configuration::LogError("Unable to create a multipart stream of DICOMweb answers");
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
       }
-
-      jsonWriter_.AddChunk(item);
     }
 
     isFirst_ = false;
@@ -84,14 +105,7 @@ namespace OrthancPlugins
   {
     std::string item;
 
-    if (isXml_)
-    {
-      GenerateSingleDicomAnswer(item, wadoBase_, dictionary_, dicom, true, isBulkAccessible_);
-    }
-    else
-    {
-      GenerateSingleDicomAnswer(item, wadoBase_, dictionary_, dicom, false, isBulkAccessible_);
-    }
+    GenerateSingleDicomAnswer(item, wadoBase_, dictionary_, dicom, IsXml(), isBulkAccessible_);
 
     AddInternal(item);
 
@@ -383,7 +397,7 @@ namespace OrthancPlugins
       bulkUriRoot = wadoUrl + "bulk/";
     }
 
-    if (isXml_)
+    if (IsXml())
     {
       pugi::xml_document doc;
       OrthancToDicomWebXml(doc, dicom, dictionary_, bulkUriRoot);
@@ -410,17 +424,17 @@ namespace OrthancPlugins
 
   void DicomResults::Answer()
   {
-    if (isXml_)
+    if (format_ == Format_Json)
     {
-      // Nothing to do in this case
+      json_ += "]\n";
+      OrthancPluginAnswerBuffer(context_, output_, json_.c_str(), json_.size(), "application/dicom+json");
+
+      std::string empty;
+      json_.swap(empty);  // Release the memory
     }
     else
     {
-      jsonWriter_.AddChunk("]\n");
-
-      std::string answer;
-      jsonWriter_.Flatten(answer);
-      OrthancPluginAnswerBuffer(context_, output_, answer.c_str(), answer.size(), "application/dicom+json");
+      // Nothing to do in the multipart case, the items are already sent
     }
   }
 }
@@ -21,28 +21,40 @@
 
 #pragma once
 
-#include "ChunkedBuffer.h"
-
 #include <orthanc/OrthancCPlugin.h>
 #include <gdcmDataSet.h>
 #include <gdcmDict.h>
 #include <gdcmFile.h>
 #include <json/value.h>
+#include <string>
 
 namespace OrthancPlugins
 {
   class DicomResults
   {
+  public:
+    enum Format
+    {
+      Format_Json,           // One JSON array, sent at once by "Answer()"
+      Format_JsonMultipart,  // One multipart item per DICOM+JSON object, streamed
+      Format_Xml             // One multipart item per DICOM+XML document, streamed
+    };
+
   private:
     OrthancPluginContext*     context_;
     OrthancPluginRestOutput*  output_;
     std::string               wadoBase_;
     const gdcm::Dict&         dictionary_;
-    Orthanc::ChunkedBuffer    jsonWriter_;  // Used for JSON output
+    std::string               json_;  // Used for non-multipart JSON output
     bool                      isFirst_; 
-    bool                      isXml_;
+    Format                    format_;
     bool                      isBulkAccessible_;
 
+    bool IsXml() const
+    {
+      return format_ == Format_Xml;
+    }
+
     void AddInternal(const std::string& item);
 
     void AddInternal(const gdcm::DataSet& dicom);
@@ -52,7 +64,7 @@ namespace OrthancPlugins
                  OrthancPluginRestOutput* output,
                  const std::string& wadoBase,
                  const gdcm::Dict& dictionary,
-                 bool isXml,
+                 Format format,
                  bool isBulkAccessible);
 
     void Add(const gdcm::File& file)
@@ -23,13 +23,19 @@
 
 #include "Plugin.h"
 #include "DicomWebServers.h"
+#include "MultipartStreamReader.h"
+#include "OrderedTasksPool.h"
+#include "Semaphore.h"
+#include "StowRequestBody.h"
+#include "TransferJobs.h"
 
 #include <json/reader.h>
+#include <algorithm>
 #include <list>
+#include <memory>
 #include <set>
 #include <boost/lexical_cast.hpp>
 
-#include <Core/ChunkedBuffer.h>
 #include <Core/Toolbox.h>
 
 
@@ -94,9 +100,85 @@ static bool GetSequenceSize(size_t& result,
 
 
 
+// Whether the request must be run as a background transfer job,
+// instead of blocking the HTTP connection until its completion
+static bool IsAsynchronousRequest(const Json::Value& body)
+{
+  static const char* ASYNCHRONOUS = "Asynchronous";
+
+  if (!body.isMember(ASYNCHRONOUS))
+  {
+    return false;
+  }
+  else if (body[ASYNCHRONOUS].type() != Json::booleanValue)
+  {
+    OrthancPlugins::Configuration::LogError("The field \"" + std::string(ASYNCHRONOUS) + "\" of a request to "
+                                            "the DICOMweb client must be a Boolean");
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+  }
+  else
+  {
+    return body[ASYNCHRONOUS].asBool();
+  }
+}
+
+
+// Returns a random identifier generated by Orthanc
+static std::string GenerateUuid()
+{
+  OrthancPluginContext* context = OrthancPlugins::Configuration::GetContext();
+
+  char* uuid = OrthancPluginGenerateUuid(context);
+  if (uuid == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+
+  std::string result;
+
+  try
+  {
+    result.assign(uuid);
+  }
+  catch (...)
+  {
+    OrthancPluginFreeString(context, uuid);
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
+  }
+
+  OrthancPluginFreeString(context, uuid);
+  return result;
+}
+
+
+// Hands a job over to the background threads, and answers with the
+// URI where its progress can be monitored
+static void SubmitTransferJob(OrthancPluginRestOutput* output,
+                              OrthancPlugins::TransferJobs::IJob* job,
+                              const std::string& type,
+                              const std::string& server)
+{
+  // The identifiers of the jobs cannot be guessed by other clients
+  const std::string id = GenerateUuid();
+  OrthancPlugins::TransferJobs::GetInstance().Submit(job, id, type, server);
+
+  OrthancPlugins::Configuration::LogInfo("DICOMweb client: " + type + " job " + id +
+                                         " submitted for server " + server);
+
+  Json::Value answer = Json::objectValue;
+  answer["ID"] = id;
+  answer["Path"] = OrthancPlugins::Configuration::GetRoot() + "servers/" + server + "/jobs/" + id;
+
+  std::string s = answer.toStyledString();
+  OrthancPluginAnswerBuffer(OrthancPlugins::Configuration::GetContext(), output,
+                            s.c_str(), s.size(), "application/json");
+}
+
+
 static void ParseStowRequest(std::list<std::string>& instances /* out */,
                              std::map<std::string, std::string>& httpHeaders /* out */,
                              std::map<std::string, std::string>& queryArguments /* out */,
+                             bool& asynchronous /* out */,
                              const OrthancPluginHttpRequest* request /* in */)
 {
   static const char* RESOURCES = "Resources";
@@ -121,6 +203,8 @@ static void ParseStowRequest(std::list<std::string>& instances /* out */,
   OrthancPlugins::ParseAssociativeArray(queryArguments, body, QUERY_ARGUMENTS);
   OrthancPlugins::ParseAssociativeArray(httpHeaders, body, HTTP_HEADERS);
 
+  asynchronous = IsAsynchronousRequest(body);
+
   Json::Value& resources = body[RESOURCES];
 
   // Extract information about all the child instances
@@ -169,25 +253,238 @@ static void ParseStowRequest(std::list<std::string>& instances /* out */,
 }
 
 
-static void SendStowChunks(const Orthanc::WebServiceParameters& server,
-                           const std::map<std::string, std::string>& httpHeaders,
-                           const std::map<std::string, std::string>& queryArguments,
-                           const std::string& boundary,
-                           Orthanc::ChunkedBuffer& chunks,
-                           size_t& countInstances,
-                           bool force)
+static void CheckStowAnswer(const Orthanc::WebServiceParameters& server,
+                            const char* answer,
+                            size_t answerSize,
+                            size_t countInstances)
 {
-  unsigned int maxInstances = OrthancPlugins::Configuration::GetUnsignedIntegerValue("StowMaxInstances", 10);
-  size_t maxSize = static_cast<size_t>(OrthancPlugins::Configuration::GetUnsignedIntegerValue("StowMaxSize", 10)) * 1024 * 1024;
+  Json::Value response;
+  Json::Reader reader;
+  bool success = reader.parse(answer, answer + answerSize, response);
 
-  if ((force && countInstances > 0) ||
-      (maxInstances != 0 && countInstances >= maxInstances) ||
-      (maxSize != 0 && chunks.GetNumBytes() >= maxSize))
+  if (!success ||
+      response.type() != Json::objectValue ||
+      !response.isMember("00081199"))
+  {
+    OrthancPlugins::Configuration::LogError("Unable to parse STOW-RS JSON response from DICOMweb server " + server.GetUrl());
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+  }
+
+  size_t size;
+  if (!GetSequenceSize(size, response, "00081199", true, server.GetUrl()) ||
+      size != countInstances)
+  {
+    OrthancPlugins::Configuration::LogError("The STOW-RS server was only able to receive " + 
+                                            boost::lexical_cast<std::string>(size) + " instances out of " +
+                                            boost::lexical_cast<std::string>(countInstances));
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+  }
+
+  if (GetSequenceSize(size, response, "00081198", false, server.GetUrl()) &&
+      size != 0)
+  {
+    OrthancPlugins::Configuration::LogError("The response from the STOW-RS server contains " + 
+                                            boost::lexical_cast<std::string>(size) + 
+                                            " items in its Failed SOP Sequence (0008,1198) tag");
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);    
+  }
+
+  if (GetSequenceSize(size, response, "0008119A", false, server.GetUrl()) &&
+      size != 0)
+  {
+    OrthancPlugins::Configuration::LogError("The response from the STOW-RS server contains " + 
+                                            boost::lexical_cast<std::string>(size) + 
+                                            " items in its Other Failures Sequence (0008,119A) tag");
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);    
+  }
+}
+
+
+static size_t GetStowMaxInstances()
+{
+  return OrthancPlugins::Configuration::GetUnsignedIntegerValue("StowMaxInstances", 10);
+}
+
+
+static size_t GetStowMaxSize()
+{
+  return static_cast<size_t>(OrthancPlugins::Configuration::GetUnsignedIntegerValue("StowMaxSize", 10)) * 1024 * 1024;
+}
+
+
+static OrthancPlugins::Semaphore& GetStowUploadSemaphore()
+{
+  // Global cap on the number of concurrent uploads, shared by all
+  // the STOW-RS client requests and jobs to all the servers
+  static OrthancPlugins::Semaphore semaphore(
+    std::max(1u, OrthancPlugins::Configuration::GetUnsignedIntegerValue("StowMaxConcurrency", 8)));
+  return semaphore;
+}
+
+
+namespace
+{
+  // Reads the instances of a STOW-RS group from Orthanc, skipping the
+  // instances that were deleted in the meantime. A background thread
+  // reads the next instances while the current one is being uploaded.
+  class OrthancInstancesSource : public OrthancPlugins::StowRequestBody::IInstancesSource
+  {
+  private:
+    static const size_t MAX_PREFETCH = 2;  // Number of instances read ahead
+
+    class ReadTask : public OrthancPlugins::OrderedTasksPool::ITask
+    {
+    private:
+      OrthancPlugins::MemoryBuffer  dicom_;
+      std::string                   instance_;
+      bool                          success_;
+
+    public:
+      ReadTask(OrthancPluginContext* context,
+               const std::string& instance) :
+        dicom_(context),
+        instance_(instance),
+        success_(false)
+      {
+      }
+
+      virtual void Execute()
+      {
+        success_ = dicom_.RestApiGet("/instances/" + instance_ + "/file", false);
+      }
+
+      bool IsSuccess() const
+      {
+        return success_;
+      }
+
+      const OrthancPlugins::MemoryBuffer& GetDicom() const
+      {
+        return dicom_;
+      }
+    };
+
+    OrthancPluginContext*                   context_;
+    const std::list<std::string>&           instances_;
+    std::list<std::string>::const_iterator  next_;
+    OrthancPlugins::OrderedTasksPool        pool_;
+    std::auto_ptr<ReadTask>                 current_;
+
+    void Prefetch()
+    {
+      while (next_ != instances_.end() &&
+             pool_.GetSize() < MAX_PREFETCH)
+      {
+        pool_.Push(new ReadTask(context_, *next_));
+        ++next_;
+      }
+    }
+
+  public:
+    OrthancInstancesSource(OrthancPluginContext* context,
+                           const std::list<std::string>& instances) :
+      context_(context),
+      instances_(instances),
+      next_(instances.begin()),
+      pool_(1)
+    {
+    }
+
+    virtual bool ReadNextInstance()
+    {
+      current_.reset(NULL);
+
+      for (;;)
+      {
+        Prefetch();
+
+        if (pool_.GetSize() == 0)
+        {
+          return false;
+        }
+
+        std::auto_ptr<OrthancPlugins::OrderedTasksPool::ITask> task(pool_.Dequeue());
+        current_.reset(dynamic_cast<ReadTask*>(task.release()));
+
+        if (current_->IsSuccess())
+        {
+          Prefetch();
+          return true;
+        }
+      }
+    }
+
+    virtual const void* GetInstanceData() const
+    {
+      return current_->GetDicom().GetData();
+    }
+
+    virtual size_t GetInstanceSize() const
+    {
+      return current_->GetDicom().GetSize();
+    }
+
+    virtual void ClearInstance()
+    {
+      current_.reset(NULL);
+    }
+  };
+}
+
+
+#if HAS_CHUNKED_HTTP_CLIENT == 1
+namespace
+{
+  // Streams a STOW-RS batch through the chunked HTTP client
+  class ChunkedStowBody : public OrthancPlugins::IChunkedRequestBody
   {
-    chunks.AddChunk("\r\n--" + boundary + "--\r\n");
+  private:
+    OrthancPlugins::StowRequestBody&  body_;
+
+  public:
+    explicit ChunkedStowBody(OrthancPlugins::StowRequestBody& body) :
+      body_(body)
+    {
+    }
+
+    virtual bool IsDone() const
+    {
+      return body_.IsDone();
+    }
+
+    virtual const void* GetChunkData() const
+    {
+      return body_.GetChunkData();
+    }
 
-    std::string body;
-    chunks.Flatten(body);
+    virtual size_t GetChunkSize() const
+    {
+      return body_.GetChunkSize();
+    }
+
+    virtual void Next()
+    {
+      body_.Next();
+    }
+  };
+}
+
+#else
+
+static void SendStowBody(const Orthanc::WebServiceParameters& server,
+                         const std::map<std::string, std::string>& httpHeaders,
+                         const std::map<std::string, std::string>& queryArguments,
+                         const std::string& boundary,
+                         std::string& body,
+                         size_t& countInstances,
+                         OrthancPlugins::TransferJobs::Progress& progress,
+                         bool force)
+{
+  if ((force && countInstances > 0) ||
+      OrthancPlugins::StowRequestBody::IsBatchFull(countInstances, body.size(),
+                                                   GetStowMaxInstances(), GetStowMaxSize()))
+  {
+    body += "\r\n--" + boundary + "--\r\n";
 
     OrthancPlugins::MemoryBuffer answerBody(OrthancPlugins::Configuration::GetContext());
     std::map<std::string, std::string> answerHeaders;
@@ -195,53 +492,257 @@ static void SendStowChunks(const Orthanc::WebServiceParameters& server,
     std::string uri;
     OrthancPlugins::UriEncode(uri, "studies", queryArguments);
 
-    OrthancPlugins::CallServer(answerBody, answerHeaders, server, OrthancPluginHttpMethod_Post,
-                               httpHeaders, uri, body);
+    {
+      OrthancPlugins::Semaphore::Locker locker(GetStowUploadSemaphore());
+      OrthancPlugins::CallServer(answerBody, answerHeaders, server, OrthancPluginHttpMethod_Post,
+                                 httpHeaders, uri, body);
+    }
+
+    const size_t bodySize = body.size();
+
+    // Release the memory of the batch before parsing the answer
+    std::string().swap(body);
+
+    CheckStowAnswer(server, answerBody.GetData(), answerBody.GetSize(), countInstances);
 
-    Json::Value response;
-    Json::Reader reader;
-    bool success = reader.parse(reinterpret_cast<const char*>((*answerBody)->data),
-                                reinterpret_cast<const char*>((*answerBody)->data) + (*answerBody)->size, response);
-    answerBody.Clear();
+    progress.AddCompletedInstances(static_cast<unsigned int>(countInstances));
+    progress.AddTransferredBytes(bodySize);
 
-    if (!success ||
-        response.type() != Json::objectValue ||
-        !response.isMember("00081199"))
+    countInstances = 0;
+  }
+}
+#endif
+
+
+namespace
+{
+  // Upload of one group of instances by the STOW-RS client, that is
+  // split into batches according to "StowMaxInstances" and "StowMaxSize"
+  class StowGroupTask : public OrthancPlugins::OrderedTasksPool::ITask
+  {
+  private:
+    const Orthanc::WebServiceParameters&       server_;
+    const std::map<std::string, std::string>&  httpHeaders_;
+    const std::map<std::string, std::string>&  queryArguments_;
+    const std::string&                         boundary_;
+    OrthancPlugins::TransferJobs::Progress&    progress_;
+    std::list<std::string>                     instances_;
+
+  public:
+    StowGroupTask(const Orthanc::WebServiceParameters& server,
+                  const std::map<std::string, std::string>& httpHeaders,
+                  const std::map<std::string, std::string>& queryArguments,
+                  const std::string& boundary,
+                  OrthancPlugins::TransferJobs::Progress& progress) :
+      server_(server),
+      httpHeaders_(httpHeaders),
+      queryArguments_(queryArguments),
+      boundary_(boundary),
+      progress_(progress)
     {
-      OrthancPlugins::Configuration::LogError("Unable to parse STOW-RS JSON response from DICOMweb server " + server.GetUrl());
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
     }
 
-    size_t size;
-    if (!GetSequenceSize(size, response, "00081199", true, server.GetUrl()) ||
-        size != countInstances)
+    std::list<std::string>& GetInstances()
     {
-      OrthancPlugins::Configuration::LogError("The STOW-RS server was only able to receive " + 
-                                              boost::lexical_cast<std::string>(size) + " instances out of " +
-                                              boost::lexical_cast<std::string>(countInstances));
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+      return instances_;
+    }
+
+    virtual void Execute()
+    {
+      OrthancPluginContext* context = OrthancPlugins::Configuration::GetContext();
+
+#if HAS_CHUNKED_HTTP_CLIENT == 1
+      // The body of each batch is streamed to the remote server with
+      // the chunked transfer encoding, so that it never stands in memory
+      OrthancInstancesSource source(context, instances_);
+      OrthancPlugins::StowRequestBody body(source, boundary_, GetStowMaxInstances(), GetStowMaxSize());
+      ChunkedStowBody chunked(body);
+
+      std::string uri;
+      OrthancPlugins::UriEncode(uri, "studies", queryArguments_);
+
+      for (;;)
+      {
+        progress_.CheckCanceled();
+
+        if (!body.StartBatch())
+        {
+          break;
+        }
+
+        std::string answerBody;
+        std::map<std::string, std::string> answerHeaders;
+
+        {
+          OrthancPlugins::Semaphore::Locker locker(GetStowUploadSemaphore());
+          OrthancPlugins::CallServer(answerBody, answerHeaders, server_, OrthancPluginHttpMethod_Post,
+                                     httpHeaders_, uri, chunked);
+        }
+
+        CheckStowAnswer(server_, answerBody.c_str(), answerBody.size(), body.GetCountInstances());
+
+        progress_.AddCompletedInstances(static_cast<unsigned int>(body.GetCountInstances()));
+        progress_.AddTransferredBytes(body.GetBatchSize());
+      }
+#else
+      // The instances are directly appended to the body of the batch,
+      // which avoids a second copy of the batch while flattening it
+      const size_t maxSize = GetStowMaxSize();
+
+      OrthancInstancesSource source(context, instances_);
+
+      std::string body;
+      size_t countInstances = 0;
+
+      for (;;)
+      {
+        progress_.CheckCanceled();
+
+        if (!source.ReadNextInstance())
+        {
+          break;
+        }
+
+        if (body.empty())
+        {
+          body.reserve(maxSize);
+        }
+
+        body += OrthancPlugins::StowRequestBody::FormatPartHeader(boundary_, source.GetInstanceSize());
+        body.append(reinterpret_cast<const char*>(source.GetInstanceData()), source.GetInstanceSize());
+        source.ClearInstance();
+        countInstances ++;
+
+        SendStowBody(server_, httpHeaders_, queryArguments_, boundary_, body, countInstances, progress_, false);
+      }
+
+      SendStowBody(server_, httpHeaders_, queryArguments_, boundary_, body, countInstances, progress_, true);
+#endif
     }
+  };
+}
+
 
-    if (GetSequenceSize(size, response, "00081198", false, server.GetUrl()) &&
-        size != 0)
+namespace
+{
+  // Upload of a set of instances by the STOW-RS client, that can
+  // either be run in the HTTP thread or as a background job
+  class StowJob : public OrthancPlugins::TransferJobs::IJob
+  {
+  private:
+    Orthanc::WebServiceParameters       server_;
+    std::string                         serverName_;
+    std::string                         boundary_;
+    std::map<std::string, std::string>  httpHeaders_;
+    std::map<std::string, std::string>  queryArguments_;
+    std::list<std::string>              instances_;
+
+  public:
+    StowJob(const Orthanc::WebServiceParameters& server,
+            const std::string& serverName,
+            const std::string& boundary) :
+      server_(server),
+      serverName_(serverName),
+      boundary_(boundary)
     {
-      OrthancPlugins::Configuration::LogError("The response from the STOW-RS server contains " + 
-                                              boost::lexical_cast<std::string>(size) + 
-                                              " items in its Failed SOP Sequence (0008,1198) tag");
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);    
     }
 
-    if (GetSequenceSize(size, response, "0008119A", false, server.GetUrl()) &&
-        size != 0)
+    std::map<std::string, std::string>& GetHttpHeaders()
     {
-      OrthancPlugins::Configuration::LogError("The response from the STOW-RS server contains " + 
-                                              boost::lexical_cast<std::string>(size) + 
-                                              " items in its Other Failures Sequence (0008,119A) tag");
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);    
+      return httpHeaders_;
     }
 
-    countInstances = 0;
-  }
+    std::map<std::string, std::string>& GetQueryArguments()
+    {
+      return queryArguments_;
+    }
+
+    std::list<std::string>& GetInstances()
+    {
+      return instances_;
+    }
+
+    virtual void Execute(OrthancPlugins::TransferJobs::Progress& progress)
+    {
+      progress.SetTotalInstances(static_cast<unsigned int>(instances_.size()));
+
+      // The instances are split into groups of "StowMaxInstances", that
+      // are uploaded concurrently according to the "StowConcurrency"
+      // option of the server, within the global "StowMaxConcurrency".
+      // Each group reads its next instances from Orthanc while its
+      // current instances are being uploaded.
+      unsigned int countThreads = OrthancPlugins::DicomWebServers::GetInstance().GetStowConcurrency(serverName_);
+
+      size_t groupSize = GetStowMaxInstances();
+      if (groupSize == 0)
+      {
+        // No limit on the number of instances per batch: Share the
+        // instances evenly between the threads
+        groupSize = std::max(static_cast<size_t>(1), (instances_.size() + countThreads - 1) / countThreads);
+      }
+
+      if (countThreads > (instances_.size() + groupSize - 1) / groupSize)
+      {
+        countThreads = (instances_.size() + groupSize - 1) / groupSize;
+      }
+
+      if (countThreads <= 1)
+      {
+        countThreads = 0;  // No need to start a thread, use the current one
+      }
+
+      const size_t maxInFlight = (countThreads == 0 ? 1 : countThreads);
+
+      OrthancPlugins::OrderedTasksPool pool(countThreads);
+
+      std::list<std::string>::const_iterator next = instances_.begin();
+
+      for (;;)
+      {
+        while (next != instances_.end() &&
+               pool.GetSize() < maxInFlight)
+        {
+          std::auto_ptr<StowGroupTask> task(new StowGroupTask(server_, httpHeaders_, queryArguments_, boundary_, progress));
+
+          for (size_t i = 0; i < groupSize && next != instances_.end(); i++, ++next)
+          {
+            task->GetInstances().push_back(*next);
+          }
+
+          pool.Push(task.release());
+        }
+
+        if (pool.GetSize() == 0)
+        {
+          break;
+        }
+
+        // Rethrows the error of the batch, if any
+        delete pool.Dequeue();
+      }
+    }
+
+    virtual void FormatResult(Json::Value& result) const
+    {
+      result = Json::objectValue;
+      result["Instances"] = static_cast<unsigned int>(instances_.size());
+    }
+
+    virtual bool GetAnswerSize(size_t& /*size*/) const
+    {
+      return false;
+    }
+
+    virtual bool TakeAnswer(std::string& /*body*/,
+                            std::string& /*contentType*/)
+    {
+      return false;
+    }
+
+    virtual void ReleaseAnswer()
+    {
+    }
+  };
 }
 
 
@@ -264,60 +765,34 @@ void StowClient(OrthancPluginRestOutput* output,
 
   Orthanc::WebServiceParameters server(OrthancPlugins::DicomWebServers::GetInstance().GetServer(request->groups[0]));
 
-  std::string boundary;
-
-  {
-    char* uuid = OrthancPluginGenerateUuid(context);
-    try
-    {
-      boundary.assign(uuid);
-    }
-    catch (...)
-    {
-      OrthancPluginFreeString(context, uuid);
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
-    }
-
-    OrthancPluginFreeString(context, uuid);
-  }
-
+  std::string boundary = GenerateUuid();
   std::string mime = "multipart/related; type=application/dicom; boundary=" + boundary;
 
-  std::map<std::string, std::string> queryArguments;
-  std::map<std::string, std::string> httpHeaders;
+  std::auto_ptr<StowJob> job(new StowJob(server, request->groups[0], boundary));
+
+  std::map<std::string, std::string>& httpHeaders = job->GetHttpHeaders();
   httpHeaders["Accept"] = "application/dicom+json";
   httpHeaders["Expect"] = "";
   httpHeaders["Content-Type"] = mime;
 
-  std::list<std::string> instances;
-  ParseStowRequest(instances, httpHeaders, queryArguments, request);
+  bool asynchronous;
+  ParseStowRequest(job->GetInstances(), httpHeaders, job->GetQueryArguments(), asynchronous, request);
 
-  OrthancPlugins::Configuration::LogInfo("Sending " + boost::lexical_cast<std::string>(instances.size()) +
+  OrthancPlugins::Configuration::LogInfo("Sending " + boost::lexical_cast<std::string>(job->GetInstances().size()) +
                                          " instances using STOW-RS to DICOMweb server: " + server.GetUrl());
 
-  Orthanc::ChunkedBuffer chunks;
-  size_t countInstances = 0;
-
-  for (std::list<std::string>::const_iterator it = instances.begin(); it != instances.end(); ++it)
+  if (asynchronous)
   {
-    OrthancPlugins::MemoryBuffer dicom(context);
-    if (dicom.RestApiGet("/instances/" + *it + "/file", false))
-    {
-      chunks.AddChunk("\r\n--" + boundary + "\r\n" +
-                      "Content-Type: application/dicom\r\n" +
-                      "Content-Length: " + boost::lexical_cast<std::string>(dicom.GetSize()) +
-                      "\r\n\r\n");
-      chunks.AddChunk(dicom.GetData(), dicom.GetSize());
-      countInstances ++;
-
-      SendStowChunks(server, httpHeaders, queryArguments, boundary, chunks, countInstances, false);
-    }
+    SubmitTransferJob(output, job.release(), "Stow", request->groups[0]);
   }
+  else
+  {
+    OrthancPlugins::TransferJobs::Progress progress;
+    job->Execute(progress);
 
-  SendStowChunks(server, httpHeaders, queryArguments, boundary, chunks, countInstances, true);
-
-  std::string answer = "{}\n";
-  OrthancPluginAnswerBuffer(context, output, answer.c_str(), answer.size(), "application/json");
+    std::string answer = "{}\n";
+    OrthancPluginAnswerBuffer(context, output, answer.c_str(), answer.size(), "application/json");
+  }
 }
 
 
@@ -347,7 +822,113 @@ static bool GetStringValue(std::string& target,
 }
 
 
-void GetFromServer(OrthancPluginRestOutput* output,
+namespace
+{
+  // Download of an arbitrary URI of the remote server. In the
+  // asynchronous mode, the body is kept until the job is forgotten.
+  class GetJob : public OrthancPlugins::TransferJobs::IJob
+  {
+  private:
+    Orthanc::WebServiceParameters       server_;
+    std::map<std::string, std::string>  httpHeaders_;
+    std::string                         uri_;
+    OrthancPlugins::MemoryBuffer        answerBody_;
+    size_t                              answerSize_;   // Kept after "answerBody_" is released
+    std::map<std::string, std::string>  answerHeaders_;
+    std::string                         contentType_;
+
+  public:
+    GetJob(OrthancPluginContext* context,
+           const Orthanc::WebServiceParameters& server,
+           const std::map<std::string, std::string>& httpHeaders,
+           const std::string& uri) :
+      server_(server),
+      httpHeaders_(httpHeaders),
+      uri_(uri),
+      answerBody_(context),
+      answerSize_(0),
+      contentType_("application/octet-stream")
+    {
+    }
+
+    virtual void Execute(OrthancPlugins::TransferJobs::Progress& progress)
+    {
+      progress.CheckCanceled();
+
+      OrthancPlugins::CallServer(answerBody_, answerHeaders_, server_, OrthancPluginHttpMethod_Get, httpHeaders_, uri_, "");
+      answerSize_ = answerBody_.GetSize();
+      progress.AddTransferredBytes(answerSize_);
+
+      for (std::map<std::string, std::string>::const_iterator
+             it = answerHeaders_.begin(); it != answerHeaders_.end(); ++it)
+      {
+        std::string key = it->first;
+        Orthanc::Toolbox::ToLowerCase(key);
+
+        if (key == "content-type")
+        {
+          contentType_ = it->second;
+        }
+      }
+    }
+
+    // Forwards the answer of the remote server to the HTTP client
+    void Answer(OrthancPluginContext* context,
+                OrthancPluginRestOutput* output) const
+    {
+      for (std::map<std::string, std::string>::const_iterator
+             it = answerHeaders_.begin(); it != answerHeaders_.end(); ++it)
+      {
+        std::string key = it->first;
+        Orthanc::Toolbox::ToLowerCase(key);
+
+        if (key == "content-type" ||
+            key == "transfer-encoding")
+        {
+          // Do not forward these headers
+        }
+        else
+        {
+          OrthancPluginSetHttpHeader(context, output, it->first.c_str(), it->second.c_str());
+        }
+      }
+
+      OrthancPluginAnswerBuffer(context, output, 
+                                reinterpret_cast<const char*>(answerBody_.GetData()),
+                                answerBody_.GetSize(), contentType_.c_str());
+    }
+
+    virtual void FormatResult(Json::Value& result) const
+    {
+      result = Json::objectValue;
+      result["ContentType"] = contentType_;
+      result["Size"] = boost::lexical_cast<std::string>(answerSize_);
+    }
+
+    virtual bool GetAnswerSize(size_t& size) const
+    {
+      size = answerSize_;
+      return true;
+    }
+
+    virtual bool TakeAnswer(std::string& body,
+                            std::string& contentType)
+    {
+      body.assign(reinterpret_cast<const char*>(answerBody_.GetData()), answerBody_.GetSize());
+      contentType = contentType_;
+      answerBody_.Clear();
+      return true;
+    }
+
+    virtual void ReleaseAnswer()
+    {
+      answerBody_.Clear();
+    }
+  };
+}
+
+
+void GetFromServer(OrthancPluginRestOutput* output,
                    const char* /*url*/,
                    const OrthancPluginHttpRequest* request)
 {
@@ -386,52 +967,28 @@ void GetFromServer(OrthancPluginRestOutput* output,
   std::map<std::string, std::string> httpHeaders;
   OrthancPlugins::ParseAssociativeArray(httpHeaders, body, HTTP_HEADERS);
 
-  OrthancPlugins::MemoryBuffer answerBody(context);
-  std::map<std::string, std::string> answerHeaders;
-  OrthancPlugins::CallServer(answerBody, answerHeaders, server, OrthancPluginHttpMethod_Get, httpHeaders, uri, "");
+  std::auto_ptr<GetJob> job(new GetJob(context, server, httpHeaders, uri));
 
-  std::string contentType = "application/octet-stream";
-
-  for (std::map<std::string, std::string>::const_iterator
-         it = answerHeaders.begin(); it != answerHeaders.end(); ++it)
+  if (IsAsynchronousRequest(body))
   {
-    std::string key = it->first;
-    Orthanc::Toolbox::ToLowerCase(key);
-
-    if (key == "content-type")
-    {
-      contentType = it->second;
-    }
-    else if (key == "transfer-encoding")
-    {
-      // Do not forward this header
-    }
-    else
-    {
-      OrthancPluginSetHttpHeader(context, output, it->first.c_str(), it->second.c_str());
-    }
+    SubmitTransferJob(output, job.release(), "Get", request->groups[0]);
+  }
+  else
+  {
+    OrthancPlugins::TransferJobs::Progress progress;
+    job->Execute(progress);
+    job->Answer(context, output);
   }
-
-  OrthancPluginAnswerBuffer(context, output, 
-                            reinterpret_cast<const char*>(answerBody.GetData()),
-                            answerBody.GetSize(), contentType.c_str());
 }
 
 
 
-static void RetrieveFromServerInternal(std::set<std::string>& instances,
-                                       const Orthanc::WebServiceParameters& server,
-                                       const std::map<std::string, std::string>& httpHeaders,
-                                       const std::map<std::string, std::string>& getArguments,
-                                       const Json::Value& resource)
+static std::string FormatRetrieveUri(const std::map<std::string, std::string>& getArguments,
+                                     const Json::Value& resource)
 {
   static const std::string STUDY = "Study";
   static const std::string SERIES = "Series";
   static const std::string INSTANCE = "Instance";
-  static const std::string MULTIPART_RELATED = "multipart/related";
-  static const std::string APPLICATION_DICOM = "application/dicom";
-
-  OrthancPluginContext* context = OrthancPlugins::Configuration::GetContext();
 
   if (resource.type() != Json::objectValue)
   {
@@ -473,9 +1030,14 @@ static void RetrieveFromServerInternal(std::set<std::string>& instances,
   std::string uri;
   OrthancPlugins::UriEncode(uri, tmpUri, getArguments);
 
-  OrthancPlugins::MemoryBuffer answerBody(context);
-  std::map<std::string, std::string> answerHeaders;
-  OrthancPlugins::CallServer(answerBody, answerHeaders, server, OrthancPluginHttpMethod_Get, httpHeaders, uri, "");
+  return uri;
+}
+
+
+static std::string GetMultipartBoundary(const std::map<std::string, std::string>& answerHeaders)
+{
+  static const std::string MULTIPART_RELATED = "multipart/related";
+  static const std::string APPLICATION_DICOM = "application/dicom";
 
   std::vector<std::string> contentType;
   for (std::map<std::string, std::string>::const_iterator 
@@ -552,43 +1114,821 @@ static void RetrieveFromServerInternal(std::set<std::string>& instances,
     throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
   }
 
-  std::vector<OrthancPlugins::MultipartItem> parts;
-  OrthancPlugins::ParseMultipartBody(parts, context, 
-                                     reinterpret_cast<const char*>(answerBody.GetData()),
-                                     answerBody.GetSize(), boundary);
+  return boundary;
+}
 
-  OrthancPlugins::Configuration::LogInfo("The remote WADO-RS server has provided " +
-                                         boost::lexical_cast<std::string>(parts.size()) + 
-                                         " DICOM instances");
 
-  for (size_t i = 0; i < parts.size(); i++)
+namespace
+{
+  // Stores into Orthanc the DICOM instances of a WADO-RS answer as
+  // soon as their part is parsed. One background thread stores the
+  // parts while the next ones are received, and at most 2 parts are
+  // pending, which bounds the memory to a few instances.
+  class RetrieveConsumer : public OrthancPlugins::MultipartStreamReader::IHandler
+#if HAS_CHUNKED_HTTP_CLIENT == 1
+                         , public OrthancPlugins::IChunkedAnswer
+#endif
   {
-    if (parts[i].contentType_ != APPLICATION_DICOM)
+  private:
+    class StoreTask : public OrthancPlugins::OrderedTasksPool::ITask
+    {
+    private:
+      OrthancPluginContext*  context_;
+      std::string            copy_;
+      const char*            data_;
+      size_t                 size_;
+      std::string            id_;
+
+    public:
+      StoreTask(OrthancPluginContext* context,
+                const void* part,
+                size_t size,
+                bool copy) :
+        context_(context),
+        data_(reinterpret_cast<const char*>(part)),
+        size_(size)
+      {
+        if (copy)
+        {
+          // The part only lives during the call to "HandlePart()"
+          copy_.assign(data_, size_);
+          data_ = copy_.c_str();
+        }
+      }
+
+      virtual void Execute()
+      {
+        OrthancPlugins::MemoryBuffer tmp(context_);
+        tmp.RestApiPost("/instances", data_, size_, false);
+
+        Json::Value result;
+        tmp.ToJson(result);
+
+        if (result.type() != Json::objectValue ||
+            !result.isMember("ID") ||
+            result["ID"].type() != Json::stringValue)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);      
+        }
+        else
+        {
+          id_ = result["ID"].asString();
+        }
+      }
+
+      const std::string& GetId() const
+      {
+        return id_;
+      }
+    };
+
+    OrthancPluginContext*                                  context_;
+    std::set<std::string>&                                 instances_;
+    OrthancPlugins::TransferJobs::Progress&                progress_;
+    bool                                                   copyParts_;
+    OrthancPlugins::OrderedTasksPool                       pool_;
+    std::map<std::string, std::string>                     headers_;
+    std::auto_ptr<OrthancPlugins::MultipartStreamReader>   reader_;
+    size_t                                                 countParts_;
+
+    void CollectResult()
+    {
+      std::auto_ptr<OrthancPlugins::OrderedTasksPool::ITask> task(pool_.Dequeue());
+      instances_.insert(dynamic_cast<const StoreTask&>(*task).GetId());
+      progress_.AddCompletedInstances(1);
+    }
+
+  public:
+    RetrieveConsumer(OrthancPluginContext* context,
+                     std::set<std::string>& instances,
+                     OrthancPlugins::TransferJobs::Progress& progress,
+                     bool copyParts) :
+      context_(context),
+      instances_(instances),
+      progress_(progress),
+      copyParts_(copyParts),
+      pool_(1),
+      countParts_(0)
     {
-      OrthancPlugins::Configuration::LogError("The remote WADO-RS server has provided a non-DICOM file in its multipart answer");
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);      
     }
 
-    OrthancPlugins::MemoryBuffer tmp(context);
-    tmp.RestApiPost("/instances", parts[i].data_, parts[i].size_, false);
+    virtual void HandlePart(const OrthancPlugins::MultipartStreamReader::HttpHeaders& headers,
+                            const void* part,
+                            size_t size)
+    {
+      progress_.CheckCanceled();
+
+      OrthancPlugins::MultipartStreamReader::HttpHeaders::const_iterator
+        contentType = headers.find("content-type");
+
+      if (contentType == headers.end() ||
+          contentType->second != "application/dicom")
+      {
+        OrthancPlugins::Configuration::LogError("The remote WADO-RS server has provided a non-DICOM file in its multipart answer");
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);      
+      }
+
+      while (pool_.GetSize() >= 2)
+      {
+        CollectResult();
+      }
 
-    Json::Value result;
-    tmp.ToJson(result);
+      pool_.Push(new StoreTask(context_, part, size, copyParts_));
+      countParts_++;
 
-    if (result.type() != Json::objectValue ||
-        !result.isMember("ID") ||
-        result["ID"].type() != Json::stringValue)
+      progress_.AddTransferredBytes(size);
+    }
+
+    virtual void AddHeader(const std::string& key,
+                           const std::string& value)
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);      
+      headers_[key] = value;
     }
-    else
+
+    virtual void AddChunk(const void* data,
+                          size_t size)
+    {
+      if (reader_.get() == NULL)
+      {
+        // First chunk of the body: The headers are all received
+        reader_.reset(new OrthancPlugins::MultipartStreamReader(*this, GetMultipartBoundary(headers_)));
+      }
+
+      reader_->AddChunk(data, size);
+    }
+
+    // Only for the streaming API, once the download is over
+    void CloseStream()
+    {
+      if (reader_.get() == NULL)
+      {
+        // Empty body
+        reader_.reset(new OrthancPlugins::MultipartStreamReader(*this, GetMultipartBoundary(headers_)));
+      }
+
+      reader_->CloseStream();
+    }
+
+    // Waits for all the parts to be stored
+    void Finalize()
+    {
+      while (pool_.GetSize() > 0)
+      {
+        CollectResult();
+      }
+
+      OrthancPlugins::Configuration::LogInfo("The remote WADO-RS server has provided " +
+                                             boost::lexical_cast<std::string>(countParts_) + 
+                                             " DICOM instances");
+    }
+
+    // Called after an error: Waits for the parts that are being
+    // stored, so that "instances" lists all the instances that were
+    // stored before the error
+    void Abandon()
+    {
+      while (pool_.GetSize() > 0)
+      {
+        try
+        {
+          CollectResult();
+        }
+        catch (Orthanc::OrthancException&)
+        {
+          // This part could not be stored
+        }
+      }
+    }
+  };
+}
+
+
+static void RetrieveFromServerInternal(std::set<std::string>& instances,
+                                       OrthancPlugins::TransferJobs::Progress& progress,
+                                       const Orthanc::WebServiceParameters& server,
+                                       const std::map<std::string, std::string>& httpHeaders,
+                                       const std::string& uri)
+{
+  OrthancPluginContext* context = OrthancPlugins::Configuration::GetContext();
+
+#if HAS_CHUNKED_HTTP_CLIENT == 1
+  // The multipart answer is parsed while it is downloaded, and each
+  // instance is stored as soon as its part is complete
+  RetrieveConsumer consumer(context, instances, progress, true /* the parts are transient */);
+
+  try
+  {
+    OrthancPlugins::CallServer(consumer, server, OrthancPluginHttpMethod_Get, httpHeaders, uri, NULL);
+    consumer.CloseStream();
+  }
+  catch (...)
+  {
+    consumer.Abandon();
+    throw;
+  }
+
+  consumer.Finalize();
+
+#else
+  // This plugin SDK cannot stream the answer: It is downloaded at
+  // once, but its parts are stored while it is being parsed
+  OrthancPlugins::MemoryBuffer answerBody(context);
+  std::map<std::string, std::string> answerHeaders;
+  OrthancPlugins::CallServer(answerBody, answerHeaders, server, OrthancPluginHttpMethod_Get, httpHeaders, uri, "");
+
+  RetrieveConsumer consumer(context, instances, progress, false /* the parts point inside "answerBody" */);
+
+  try
+  {
+    OrthancPlugins::MultipartStreamReader::ParseBody(consumer, answerBody.GetData(), answerBody.GetSize(),
+                                                     GetMultipartBoundary(answerHeaders));
+  }
+  catch (...)
+  {
+    consumer.Abandon();
+    throw;
+  }
+
+  consumer.Finalize();
+#endif
+}
+
+
+static OrthancPlugins::Semaphore& GetRetrieveSemaphore()
+{
+  // Global cap on the number of concurrent downloads, shared by all
+  // the WADO-RS Retrieve requests to all the servers
+  static OrthancPlugins::Semaphore semaphore(
+    std::max(1u, OrthancPlugins::Configuration::GetUnsignedIntegerValue("RetrieveMaxConcurrency", 8)));
+  return semaphore;
+}
+
+
+namespace
+{
+  // Retrieval of one resource by the WADO-RS Retrieve client. Its
+  // errors are reported, and do not abort the other resources. If
+  // the retrieval fails partway, the instances that were already
+  // stored are still reported.
+  class RetrieveResourceTask : public OrthancPlugins::OrderedTasksPool::ITask
+  {
+  private:
+    const Orthanc::WebServiceParameters&       server_;
+    const std::map<std::string, std::string>&  httpHeaders_;
+    OrthancPlugins::TransferJobs::Progress&    progress_;
+    Json::Value                                resource_;
+    std::string                                uri_;
+    std::set<std::string>                      instances_;
+    bool                                       success_;
+    std::string                                error_;
+
+  public:
+    RetrieveResourceTask(const Orthanc::WebServiceParameters& server,
+                         const std::map<std::string, std::string>& httpHeaders,
+                         OrthancPlugins::TransferJobs::Progress& progress,
+                         const Json::Value& resource,
+                         const std::string& uri) :
+      server_(server),
+      httpHeaders_(httpHeaders),
+      progress_(progress),
+      resource_(resource),
+      uri_(uri),
+      success_(false)
+    {
+    }
+
+    virtual void Execute()
+    {
+      OrthancPlugins::Semaphore::Locker locker(GetRetrieveSemaphore());
+
+      // Do not start a new download once the job is canceled
+      progress_.CheckCanceled();
+
+      try
+      {
+        RetrieveFromServerInternal(instances_, progress_, server_, httpHeaders_, uri_);
+        success_ = true;
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        OrthancPlugins::Configuration::LogError("WADO-RS Retrieve client: Cannot retrieve " + uri_ +
+                                                " from " + server_.GetUrl() + ": " + e.What());
+        error_ = e.What();
+      }
+    }
+
+    const std::set<std::string>& GetInstances() const
+    {
+      return instances_;
+    }
+
+    bool IsSuccess() const
+    {
+      return success_;
+    }
+
+    void Format(Json::Value& target) const
+    {
+      target = resource_;
+      target["Status"] = (success_ ? "Success" : "Failure");
+      target["Instances"] = Json::arrayValue;
+
+      for (std::set<std::string>::const_iterator
+             it = instances_.begin(); it != instances_.end(); ++it)
+      {
+        target["Instances"].append(*it);
+      }
+
+      if (!success_)
+      {
+        target["Error"] = error_;
+      }
+    }
+  };
+}
+
+
+static bool GetDicomJsonValue(Json::Value& target,
+                              const Json::Value& dataset,
+                              const std::string& tag)
+{
+  if (dataset.type() == Json::objectValue &&
+      dataset.isMember(tag) &&
+      dataset[tag].type() == Json::objectValue &&
+      dataset[tag].isMember("Value") &&
+      dataset[tag]["Value"].type() == Json::arrayValue &&
+      dataset[tag]["Value"].size() > 0)
+  {
+    target = dataset[tag]["Value"][0];
+    return true;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+
+// Lists the instances of a series that is stored in Orthanc
+static bool LookupLocalSeries(std::list<std::string>& instances,
+                              const std::string& seriesUid)
+{
+  OrthancPluginContext* context = OrthancPlugins::Configuration::GetContext();
+
+  instances.clear();
+
+  Json::Value lookup;
+  if (!OrthancPlugins::RestApiPost(lookup, context, "/tools/lookup", seriesUid, false) ||
+      lookup.type() != Json::arrayValue)
+  {
+    return false;
+  }
+
+  for (Json::Value::ArrayIndex i = 0; i < lookup.size(); i++)
+  {
+    Json::Value series;
+    if (lookup[i].type() == Json::objectValue &&
+        lookup[i].isMember("Type") &&
+        lookup[i].isMember("ID") &&
+        lookup[i]["Type"].asString() == "Series" &&
+        OrthancPlugins::RestApiGet(series, context, "/series/" + lookup[i]["ID"].asString() + "/instances", false) &&
+        series.type() == Json::arrayValue)
+    {
+      for (Json::Value::ArrayIndex j = 0; j < series.size(); j++)
+      {
+        AddInstance(instances, series[j]);
+      }
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+namespace
+{
+  // Decomposition of a study into its series, using a QIDO-RS query
+  // to the remote server. The series that are already completely
+  // stored in Orthanc are skipped.
+  class DecomposeStudyTask : public OrthancPlugins::OrderedTasksPool::ITask
+  {
+  private:
+    const Orthanc::WebServiceParameters&       server_;
+    const std::map<std::string, std::string>&  httpHeaders_;
+    OrthancPlugins::TransferJobs::Progress&    progress_;
+    Json::Value                                resource_;
+    std::string                                study_;
+    bool                                       success_;
+    std::vector<Json::Value>                   series_;    // In the order of the QIDO-RS answer
+    std::vector<bool>                          stored_;    // Series already stored, to be skipped
+
+  public:
+    DecomposeStudyTask(const Orthanc::WebServiceParameters& server,
+                       const std::map<std::string, std::string>& httpHeaders,
+                       OrthancPlugins::TransferJobs::Progress& progress,
+                       const Json::Value& resource,
+                       const std::string& study) :
+      server_(server),
+      httpHeaders_(httpHeaders),
+      progress_(progress),
+      resource_(resource),
+      study_(study),
+      success_(false)
     {
-      instances.insert(result["ID"].asString());
     }
+
+    virtual void Execute()
+    {
+      progress_.CheckCanceled();
+
+      Json::Value answer;
+
+      try
+      {
+        OrthancPlugins::Semaphore::Locker locker(GetRetrieveSemaphore());
+
+        std::map<std::string, std::string> arguments;
+        arguments["includefield"] = "00201209";  // Number of Series Related Instances
+
+        std::string uri;
+        OrthancPlugins::UriEncode(uri, "studies/" + study_ + "/series", arguments);
+
+        std::map<std::string, std::string> httpHeaders = httpHeaders_;
+        httpHeaders["Accept"] = "application/dicom+json";
+
+        OrthancPlugins::MemoryBuffer answerBody(OrthancPlugins::Configuration::GetContext());
+        std::map<std::string, std::string> answerHeaders;
+        OrthancPlugins::CallServer(answerBody, answerHeaders, server_, OrthancPluginHttpMethod_Get, httpHeaders, uri, "");
+
+        Json::Reader reader;
+        if (!reader.parse(answerBody.GetData(), answerBody.GetData() + answerBody.GetSize(), answer) ||
+            answer.type() != Json::arrayValue)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+        }
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        OrthancPlugins::Configuration::LogWarning("WADO-RS Retrieve client: Cannot list the series of study " + study_ +
+                                                  " on " + server_.GetUrl() + ", the study is retrieved at once: " + e.What());
+        return;
+      }
+
+      if (answer.size() == 0)
+      {
+        OrthancPlugins::Configuration::LogWarning("WADO-RS Retrieve client: No series is listed for study " + study_ +
+                                                  " on " + server_.GetUrl() + ", the study is retrieved at once");
+        return;
+      }
+
+      for (Json::Value::ArrayIndex i = 0; i < answer.size(); i++)
+      {
+        Json::Value uid, count;
+        if (!GetDicomJsonValue(uid, answer[i], "0020000E") ||
+            uid.type() != Json::stringValue)
+        {
+          OrthancPlugins::Configuration::LogWarning("WADO-RS Retrieve client: Invalid QIDO-RS answer for study " + study_ +
+                                                    ", the study is retrieved at once");
+          series_.clear();
+          stored_.clear();
+          return;
+        }
+
+        // The remote count of instances is either an IS string, or a number
+        int remoteCount = -1;
+        if (GetDicomJsonValue(count, answer[i], "00201209"))
+        {
+          if (count.isNumeric())
+          {
+            remoteCount = count.asInt();
+          }
+          else if (count.type() == Json::stringValue)
+          {
+            try
+            {
+              remoteCount = boost::lexical_cast<int>(Orthanc::Toolbox::StripSpaces(count.asString()));
+            }
+            catch (boost::bad_lexical_cast&)
+            {
+            }
+          }
+        }
+
+        Json::Value item = resource_;
+        item["Series"] = uid.asString();
+
+        std::list<std::string> local;
+        if (remoteCount > 0 &&
+            LookupLocalSeries(local, uid.asString()) &&
+            local.size() == static_cast<size_t>(remoteCount))
+        {
+          item["Status"] = "Skipped";
+          item["Instances"] = Json::arrayValue;
+
+          for (std::list<std::string>::const_iterator it = local.begin(); it != local.end(); ++it)
+          {
+            item["Instances"].append(*it);
+          }
+
+          stored_.push_back(true);
+        }
+        else
+        {
+          stored_.push_back(false);
+        }
+
+        series_.push_back(item);
+      }
+
+      success_ = true;
+    }
+
+    // If "false", the study must be retrieved as a whole
+    bool IsSuccess() const
+    {
+      return success_;
+    }
+
+    size_t GetSeriesCount() const
+    {
+      return series_.size();
+    }
+
+    // If the series is stored, this is its status in the answer
+    const Json::Value& GetSeries(size_t index) const
+    {
+      return series_[index];
+    }
+
+    bool IsStored(size_t index) const
+    {
+      return stored_[index];
+    }
+  };
+}
+
+
+static unsigned int GetRetrieveThreadsCount(const std::string& server,
+                                            size_t countResources)
+{
+  unsigned int countThreads = OrthancPlugins::DicomWebServers::GetInstance().GetRetrieveConcurrency(server);
+
+  if (countThreads > countResources)
+  {
+    countThreads = countResources;
+  }
+
+  if (countThreads <= 1)
+  {
+    countThreads = 0;  // No need to start a thread, use the current one
   }
+
+  return countThreads;
 }
 
 
+namespace
+{
+  // Retrieval of a set of resources by the WADO-RS Retrieve client,
+  // whose result lists the instances that are stored in Orthanc
+  class RetrieveJob : public OrthancPlugins::TransferJobs::IJob
+  {
+  private:
+    Orthanc::WebServiceParameters       server_;
+    std::string                         serverName_;
+    std::map<std::string, std::string>  httpHeaders_;
+    std::map<std::string, std::string>  getArguments_;
+    std::vector<Json::Value>            resources_;
+    std::vector<std::string>            uris_;      // Empty for the series that are skipped
+    bool                                splitStudies_;
+    Json::Value                         status_;
+
+    // Replace each whole study by its series, that are listed by
+    // QIDO-RS queries run concurrently
+    void SplitStudies(std::set<std::string>& instances,
+                      OrthancPlugins::TransferJobs::Progress& progress)
+    {
+      std::vector<size_t> studies;
+      for (size_t i = 0; i < resources_.size(); i++)
+      {
+        if (!resources_[i].isMember("Series") ||
+            resources_[i]["Series"].asString().empty())
+        {
+          studies.push_back(i);
+        }
+      }
+
+      const unsigned int countThreads = GetRetrieveThreadsCount(serverName_, studies.size());
+      const size_t maxInFlight = (countThreads == 0 ? 1 : 2 * countThreads);
+
+      OrthancPlugins::OrderedTasksPool pool(countThreads);
+
+      std::vector<Json::Value> splitResources;
+      std::vector<std::string> splitUris;
+      size_t next = 0;       // Next study to be decomposed
+      size_t copied = 0;     // Next resource to be copied as such
+
+      for (;;)
+      {
+        while (next < studies.size() &&
+               pool.GetSize() < maxInFlight)
+        {
+          const Json::Value& resource = resources_[studies[next]];
+          pool.Push(new DecomposeStudyTask(server_, httpHeaders_, progress, resource, resource["Study"].asString()));
+          next++;
+        }
+
+        if (pool.GetSize() == 0)
+        {
+          break;
+        }
+
+        std::auto_ptr<OrthancPlugins::OrderedTasksPool::ITask> task(pool.Dequeue());
+        const DecomposeStudyTask& decomposition = dynamic_cast<const DecomposeStudyTask&>(*task);
+
+        // Keep the order of the resources
+        const size_t study = studies[next - pool.GetSize() - 1];
+        for (; copied < study; copied++)
+        {
+          splitResources.push_back(resources_[copied]);
+          splitUris.push_back(uris_[copied]);
+        }
+
+        if (decomposition.IsSuccess())
+        {
+          for (size_t i = 0; i < decomposition.GetSeriesCount(); i++)
+          {
+            const Json::Value& series = decomposition.GetSeries(i);
+            splitResources.push_back(series);
+
+            if (decomposition.IsStored(i))
+            {
+              splitUris.push_back("");
+
+              for (Json::Value::ArrayIndex j = 0; j < series["Instances"].size(); j++)
+              {
+                instances.insert(series["Instances"][j].asString());
+              }
+            }
+            else
+            {
+              splitUris.push_back(FormatRetrieveUri(getArguments_, series));
+            }
+          }
+        }
+        else
+        {
+          splitResources.push_back(resources_[study]);
+          splitUris.push_back(uris_[study]);
+        }
+
+        copied = study + 1;
+      }
+
+      for (; copied < resources_.size(); copied++)
+      {
+        splitResources.push_back(resources_[copied]);
+        splitUris.push_back(uris_[copied]);
+      }
+
+      resources_.swap(splitResources);
+      uris_.swap(splitUris);
+    }
+
+  public:
+    RetrieveJob(const Orthanc::WebServiceParameters& server,
+                const std::string& serverName,
+                const std::map<std::string, std::string>& httpHeaders,
+                const std::map<std::string, std::string>& getArguments,
+                bool splitStudies) :
+      server_(server),
+      serverName_(serverName),
+      httpHeaders_(httpHeaders),
+      getArguments_(getArguments),
+      splitStudies_(splitStudies),
+      status_(Json::objectValue)
+    {
+    }
+
+    // Validates the resource before contacting the server
+    void AddResource(const Json::Value& resource)
+    {
+      uris_.push_back(FormatRetrieveUri(getArguments_, resource));
+      resources_.push_back(resource);
+    }
+
+    virtual void Execute(OrthancPlugins::TransferJobs::Progress& progress)
+    {
+      status_ = Json::objectValue;
+      status_["Resources"] = Json::arrayValue;
+
+      std::set<std::string> instances;
+
+      if (splitStudies_)
+      {
+        SplitStudies(instances, progress);
+      }
+
+      // The resources are retrieved concurrently, according to the
+      // "RetrieveConcurrency" option of the server
+      const unsigned int countThreads = GetRetrieveThreadsCount(serverName_, uris_.size());
+      const size_t maxInFlight = (countThreads == 0 ? 1 : 2 * countThreads);
+
+      OrthancPlugins::OrderedTasksPool pool(countThreads);
+
+      size_t countFailures = 0;
+
+      size_t next = 0;            // Next resource to be retrieved
+      size_t reported = 0;        // Next resource to be reported in the status
+      std::list<size_t> pending;  // Resources in the pool
+
+      for (;;)
+      {
+        while (next < uris_.size() &&
+               pool.GetSize() < maxInFlight)
+        {
+          if (!uris_[next].empty())
+          {
+            pool.Push(new RetrieveResourceTask(server_, httpHeaders_, progress, resources_[next], uris_[next]));
+            pending.push_back(next);
+          }
+
+          next++;
+        }
+
+        if (pool.GetSize() == 0)
+        {
+          break;
+        }
+
+        // The skipped series keep their position in the status
+        for (; reported < pending.front(); reported++)
+        {
+          status_["Resources"].append(resources_[reported]);
+        }
+
+        reported = pending.front() + 1;
+        pending.pop_front();
+
+        std::auto_ptr<OrthancPlugins::OrderedTasksPool::ITask> task(pool.Dequeue());
+
+        const RetrieveResourceTask& resource = dynamic_cast<const RetrieveResourceTask&>(*task);
+
+        // The failures of the resources are reported in the status,
+        // but a canceled job is aborted as a whole
+        progress.CheckCanceled();
+
+        if (!resource.IsSuccess())
+        {
+          countFailures++;
+        }
+
+        instances.insert(resource.GetInstances().begin(), resource.GetInstances().end());
+
+        Json::Value item;
+        resource.Format(item);
+        status_["Resources"].append(item);
+      }
+
+      for (; reported < resources_.size(); reported++)
+      {
+        status_["Resources"].append(resources_[reported]);
+      }
+
+      status_["Instances"] = Json::arrayValue;
+      status_["Failures"] = static_cast<unsigned int>(countFailures);
+  
+      for (std::set<std::string>::const_iterator
+             it = instances.begin(); it != instances.end(); ++it)
+      {
+        status_["Instances"].append(*it);
+      }
+    }
+
+    virtual void FormatResult(Json::Value& result) const
+    {
+      result = status_;
+    }
+
+    virtual bool GetAnswerSize(size_t& /*size*/) const
+    {
+      return false;
+    }
+
+    virtual bool TakeAnswer(std::string& /*body*/,
+                            std::string& /*contentType*/)
+    {
+      return false;
+    }
+
+    virtual void ReleaseAnswer()
+    {
+    }
+  };
+}
+
 
 void RetrieveFromServer(OrthancPluginRestOutput* output,
                         const char* /*url*/,
@@ -597,6 +1937,7 @@ void RetrieveFromServer(OrthancPluginRestOutput* output,
   static const std::string RESOURCES("Resources");
   static const char* HTTP_HEADERS = "HttpHeaders";
   static const std::string GET_ARGUMENTS = "Arguments";
+  static const std::string SPLIT_STUDIES = "SplitStudies";
 
   OrthancPluginContext* context = OrthancPlugins::Configuration::GetContext();
 
@@ -626,22 +1967,158 @@ void RetrieveFromServer(OrthancPluginRestOutput* output,
   std::map<std::string, std::string> getArguments;
   OrthancPlugins::ParseAssociativeArray(getArguments, body, GET_ARGUMENTS);
 
+  bool splitStudies = false;
+  if (body.isMember(SPLIT_STUDIES))
+  {
+    if (body[SPLIT_STUDIES].type() != Json::booleanValue)
+    {
+      OrthancPlugins::Configuration::LogError("The field \"" + SPLIT_STUDIES + "\" of a request to the DICOMweb "
+                                              "WADO-RS Retrieve client must be a Boolean");
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+    }
+
+    splitStudies = body[SPLIT_STUDIES].asBool();
+  }
+
+  std::auto_ptr<RetrieveJob> job(new RetrieveJob(server, request->groups[0], httpHeaders, getArguments, splitStudies));
 
-  std::set<std::string> instances;
   for (Json::Value::ArrayIndex i = 0; i < body[RESOURCES].size(); i++)
   {
-    RetrieveFromServerInternal(instances, server, httpHeaders, getArguments, body[RESOURCES][i]);
+    job->AddResource(body[RESOURCES][i]);
   }
 
-  Json::Value status = Json::objectValue;
-  status["Instances"] = Json::arrayValue;
-  
-  for (std::set<std::string>::const_iterator
-         it = instances.begin(); it != instances.end(); ++it)
+  if (IsAsynchronousRequest(body))
   {
-    status["Instances"].append(*it);
+    SubmitTransferJob(output, job.release(), "Retrieve", request->groups[0]);
   }
+  else
+  {
+    OrthancPlugins::TransferJobs::Progress progress;
+    job->Execute(progress);
+
+    Json::Value status;
+    job->FormatResult(status);
+
+    // As before the status of each resource was reported, a
+    // synchronous request fails if one resource cannot be retrieved
+    // (the error of each resource is logged). The asynchronous jobs
+    // report the failures in their result.
+    const unsigned int countFailures = status["Failures"].asUInt();
+    if (countFailures > 0)
+    {
+      OrthancPlugins::Configuration::LogError("WADO-RS Retrieve client: " +
+                                              boost::lexical_cast<std::string>(countFailures) + " resource(s) out of " +
+                                              boost::lexical_cast<std::string>(status["Resources"].size()) +
+                                              " could not be retrieved from " + server.GetUrl());
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+    }
+
+    std::string s = status.toStyledString();
+    OrthancPluginAnswerBuffer(context, output, s.c_str(), s.size(), "application/json");
+  }
+}
+
 
-  std::string s = status.toStyledString();
-  OrthancPluginAnswerBuffer(context, output, s.c_str(), s.size(), "application/json");
+void ListServerJobs(OrthancPluginRestOutput* output,
+                    const char* /*url*/,
+                    const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::Configuration::GetContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+    return;
+  }
+
+  // Make sure the server does exist
+  OrthancPlugins::DicomWebServers::GetInstance().GetServer(request->groups[0]);
+
+  std::list<std::string> jobs;
+  OrthancPlugins::TransferJobs::GetInstance().ListJobs(jobs, request->groups[0]);
+
+  Json::Value json = Json::arrayValue;
+  for (std::list<std::string>::const_iterator it = jobs.begin(); it != jobs.end(); ++it)
+  {
+    json.append(*it);
+  }
+
+  std::string answer = json.toStyledString();
+  OrthancPluginAnswerBuffer(context, output, answer.c_str(), answer.size(), "application/json");
+}
+
+
+void GetServerJob(OrthancPluginRestOutput* output,
+                  const char* /*url*/,
+                  const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::Configuration::GetContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+    return;
+  }
+
+  Json::Value status;
+  if (OrthancPlugins::TransferJobs::GetInstance().GetStatus(status, request->groups[0], request->groups[1]))
+  {
+    std::string answer = status.toStyledString();
+    OrthancPluginAnswerBuffer(context, output, answer.c_str(), answer.size(), "application/json");
+  }
+  else
+  {
+    OrthancPluginSendHttpStatusCode(context, output, 404);
+  }
+}
+
+
+void CancelServerJob(OrthancPluginRestOutput* output,
+                     const char* /*url*/,
+                     const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::Configuration::GetContext();
+
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "POST");
+    return;
+  }
+
+  if (OrthancPlugins::TransferJobs::GetInstance().Cancel(request->groups[0], request->groups[1]))
+  {
+    std::string answer = "{}\n";
+    OrthancPluginAnswerBuffer(context, output, answer.c_str(), answer.size(), "application/json");
+  }
+  else
+  {
+    OrthancPluginSendHttpStatusCode(context, output, 404);
+  }
+}
+
+
+void GetServerJobAnswer(OrthancPluginRestOutput* output,
+                        const char* /*url*/,
+                        const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::Configuration::GetContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+    return;
+  }
+
+  // Only the successful "get" jobs have an answer, that can only be
+  // fetched once, and that is released if the kept answers exceed
+  // "TransferJobsMaxAnswersSize"
+  std::string body, contentType;
+  if (OrthancPlugins::TransferJobs::GetInstance().TakeAnswer(body, contentType, request->groups[0], request->groups[1]))
+  {
+    OrthancPluginAnswerBuffer(context, output, body.c_str(), body.size(), contentType.c_str());
+  }
+  else
+  {
+    OrthancPluginSendHttpStatusCode(context, output, 404);
+  }
 }
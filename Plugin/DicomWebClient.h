@@ -35,3 +35,19 @@ void GetFromServer(OrthancPluginRestOutput* output,
 void RetrieveFromServer(OrthancPluginRestOutput* output,
                         const char* /*url*/,
                         const OrthancPluginHttpRequest* request);
+
+void ListServerJobs(OrthancPluginRestOutput* output,
+                    const char* /*url*/,
+                    const OrthancPluginHttpRequest* request);
+
+void GetServerJob(OrthancPluginRestOutput* output,
+                  const char* /*url*/,
+                  const OrthancPluginHttpRequest* request);
+
+void CancelServerJob(OrthancPluginRestOutput* output,
+                     const char* /*url*/,
+                     const OrthancPluginHttpRequest* request);
+
+void GetServerJobAnswer(OrthancPluginRestOutput* output,
+                        const char* /*url*/,
+                        const OrthancPluginHttpRequest* request);
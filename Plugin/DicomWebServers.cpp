@@ -33,6 +33,40 @@ namespace OrthancPlugins
     {
       delete it->second;
     }
+
+    servers_.clear();
+    retrieveConcurrency_.clear();
+    stowConcurrency_.clear();
+  }
+
+
+  static unsigned int ReadConcurrency(Json::Value& server /* modified */,
+                                      const std::string& name,
+                                      const std::string& key)
+  {
+    if (server.type() != Json::objectValue ||
+        !server.isMember(key))
+    {
+      return 1;
+    }
+
+    const Json::Value value = server[key];
+
+    // Remove the option, which is unknown to Orthanc
+    server.removeMember(key);
+
+    if ((value.type() == Json::intValue ||
+         value.type() == Json::uintValue) &&
+        value.asInt() > 0)
+    {
+      return static_cast<unsigned int>(value.asInt());
+    }
+    else
+    {
+      OrthancPlugins::Configuration::LogError("The option \"" + key + "\" of the DICOMweb server \"" +
+                                              name + "\" must be a positive integer");
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+    }
   }
 
 
@@ -56,10 +90,16 @@ namespace OrthancPlugins
 
         for (size_t i = 0; i < members.size(); i++)
         {
+          Json::Value server = servers[members[i]];
+          unsigned int retrieveConcurrency = ReadConcurrency(server, members[i], "RetrieveConcurrency");
+          unsigned int stowConcurrency = ReadConcurrency(server, members[i], "StowConcurrency");
+
           std::auto_ptr<Orthanc::WebServiceParameters> parameters(new Orthanc::WebServiceParameters);
-          parameters->FromJson(servers[members[i]]);
+          parameters->FromJson(server);
 
           servers_[members[i]] = parameters.release();
+          retrieveConcurrency_[members[i]] = retrieveConcurrency;
+          stowConcurrency_[members[i]] = stowConcurrency;
         }
       }
     }
@@ -103,6 +143,37 @@ namespace OrthancPlugins
   }
 
 
+  unsigned int DicomWebServers::GetConcurrency(const Concurrencies& concurrencies,
+                                               const std::string& name)
+  {
+    Concurrencies::const_iterator found = concurrencies.find(name);
+
+    if (found == concurrencies.end())
+    {
+      OrthancPlugins::Configuration::LogError("Inexistent server: " + name);
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem);
+    }
+    else
+    {
+      return found->second;
+    }
+  }
+
+
+  unsigned int DicomWebServers::GetRetrieveConcurrency(const std::string& name)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return GetConcurrency(retrieveConcurrency_, name);
+  }
+
+
+  unsigned int DicomWebServers::GetStowConcurrency(const std::string& name)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return GetConcurrency(stowConcurrency_, name);
+  }
+
+
   void DicomWebServers::ListServers(std::list<std::string>& servers)
   {
     boost::mutex::scoped_lock lock(mutex_);
@@ -128,18 +199,9 @@ namespace OrthancPlugins
   }
 
 
-
-  void CallServer(OrthancPlugins::MemoryBuffer& answerBody /* out */,
-                  std::map<std::string, std::string>& answerHeaders /* out */,
-                  const Orthanc::WebServiceParameters& server,
-                  OrthancPluginHttpMethod method,
-                  const std::map<std::string, std::string>& httpHeaders,
-                  const std::string& uri,
-                  const std::string& body)
+  static std::string FormatUrl(const Orthanc::WebServiceParameters& server,
+                               const std::string& uri)
   {
-    answerBody.Clear();
-    answerHeaders.clear();
-
     std::string url = server.GetUrl();
     assert(!url.empty() && url[url.size() - 1] == '/');
 
@@ -154,19 +216,43 @@ namespace OrthancPlugins
       url += uri;
     }
 
-    std::vector<const char*> httpHeadersKeys(httpHeaders.size());
-    std::vector<const char*> httpHeadersValues(httpHeaders.size());
+    return url;
+  }
+
+
+  static void ConvertHttpHeaders(std::vector<const char*>& keys /* out */,
+                                 std::vector<const char*>& values /* out */,
+                                 const std::map<std::string, std::string>& httpHeaders)
+  {
+    keys.resize(httpHeaders.size());
+    values.resize(httpHeaders.size());
 
+    size_t pos = 0;
+    for (std::map<std::string, std::string>::const_iterator
+           it = httpHeaders.begin(); it != httpHeaders.end(); ++it)
     {
-      size_t pos = 0;
-      for (std::map<std::string, std::string>::const_iterator
-             it = httpHeaders.begin(); it != httpHeaders.end(); ++it)
-      {
-        httpHeadersKeys[pos] = it->first.c_str();
-        httpHeadersValues[pos] = it->second.c_str();
-        pos += 1;
-      }
+      keys[pos] = it->first.c_str();
+      values[pos] = it->second.c_str();
+      pos += 1;
     }
+  }
+
+
+  void CallServer(OrthancPlugins::MemoryBuffer& answerBody /* out */,
+                  std::map<std::string, std::string>& answerHeaders /* out */,
+                  const Orthanc::WebServiceParameters& server,
+                  OrthancPluginHttpMethod method,
+                  const std::map<std::string, std::string>& httpHeaders,
+                  const std::string& uri,
+                  const std::string& body)
+  {
+    answerBody.Clear();
+    answerHeaders.clear();
+
+    const std::string url = FormatUrl(server, uri);
+
+    std::vector<const char*> httpHeadersKeys, httpHeadersValues;
+    ConvertHttpHeaders(httpHeadersKeys, httpHeadersValues, httpHeaders);
 
     const char* bodyContent = NULL;
     size_t bodySize = 0;
@@ -236,6 +322,213 @@ namespace OrthancPlugins
   }
 
 
+#if HAS_CHUNKED_HTTP_CLIENT == 1
+  namespace
+  {
+    class EmptyRequestBody : public IChunkedRequestBody
+    {
+    public:
+      virtual bool IsDone() const
+      {
+        return true;
+      }
+
+      virtual const void* GetChunkData() const
+      {
+        return NULL;
+      }
+
+      virtual size_t GetChunkSize() const
+      {
+        return 0;
+      }
+
+      virtual void Next()
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      }
+    };
+
+
+    class StringAnswer : public IChunkedAnswer
+    {
+    private:
+      std::string&                         body_;
+      std::map<std::string, std::string>&  headers_;
+
+    public:
+      StringAnswer(std::string& body,
+                   std::map<std::string, std::string>& headers) :
+        body_(body),
+        headers_(headers)
+      {
+      }
+
+      virtual void AddHeader(const std::string& key,
+                             const std::string& value)
+      {
+        headers_[key] = value;
+      }
+
+      virtual void AddChunk(const void* data,
+                            size_t size)
+      {
+        body_.append(reinterpret_cast<const char*>(data), size);
+      }
+    };
+  }
+
+
+  static OrthancPluginErrorCode ChunkedAnswerAddChunk(void* answer,
+                                                      const void* data,
+                                                      uint32_t size)
+  {
+    try
+    {
+      if (size != 0)
+      {
+        reinterpret_cast<IChunkedAnswer*>(answer)->AddChunk(data, size);
+      }
+
+      return OrthancPluginErrorCode_Success;
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+    }
+    catch (std::bad_alloc&)
+    {
+      return OrthancPluginErrorCode_NotEnoughMemory;
+    }
+    catch (...)
+    {
+      return OrthancPluginErrorCode_Plugin;
+    }
+  }
+
+
+  static OrthancPluginErrorCode ChunkedAnswerAddHeader(void* answer,
+                                                       const char* key,
+                                                       const char* value)
+  {
+    try
+    {
+      reinterpret_cast<IChunkedAnswer*>(answer)->AddHeader(key, value);
+      return OrthancPluginErrorCode_Success;
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+    }
+    catch (...)
+    {
+      return OrthancPluginErrorCode_NotEnoughMemory;
+    }
+  }
+
+
+  static uint8_t ChunkedBodyIsDone(void* body)
+  {
+    return reinterpret_cast<IChunkedRequestBody*>(body)->IsDone() ? 1 : 0;
+  }
+
+
+  static const void* ChunkedBodyGetData(void* body)
+  {
+    return reinterpret_cast<IChunkedRequestBody*>(body)->GetChunkData();
+  }
+
+
+  static uint32_t ChunkedBodyGetSize(void* body)
+  {
+    return static_cast<uint32_t>(reinterpret_cast<IChunkedRequestBody*>(body)->GetChunkSize());
+  }
+
+
+  static OrthancPluginErrorCode ChunkedBodyNext(void* body)
+  {
+    try
+    {
+      reinterpret_cast<IChunkedRequestBody*>(body)->Next();
+      return OrthancPluginErrorCode_Success;
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+    }
+    catch (...)
+    {
+      return OrthancPluginErrorCode_Plugin;
+    }
+  }
+
+
+  void CallServer(IChunkedAnswer& answer,
+                  const Orthanc::WebServiceParameters& server,
+                  OrthancPluginHttpMethod method,
+                  const std::map<std::string, std::string>& httpHeaders,
+                  const std::string& uri,
+                  IChunkedRequestBody* body)
+  {
+    const std::string url = FormatUrl(server, uri);
+
+    std::vector<const char*> httpHeadersKeys, httpHeadersValues;
+    ConvertHttpHeaders(httpHeadersKeys, httpHeadersValues, httpHeaders);
+
+    EmptyRequestBody emptyBody;
+    if (body == NULL)
+    {
+      body = &emptyBody;
+    }
+
+    uint16_t status = 0;
+    OrthancPluginErrorCode code = OrthancPluginChunkedHttpClient(
+      OrthancPlugins::Configuration::GetContext(),
+      /* Outputs */
+      &answer, ChunkedAnswerAddChunk, ChunkedAnswerAddHeader, &status,
+      method,
+      url.c_str(),
+      /* HTTP headers*/
+      httpHeaders.size(),
+      httpHeadersKeys.empty() ? NULL : &httpHeadersKeys[0],
+      httpHeadersValues.empty() ? NULL : &httpHeadersValues[0],
+      /* Body, that is read chunk by chunk */
+      body, ChunkedBodyIsDone, ChunkedBodyGetData, ChunkedBodyGetSize, ChunkedBodyNext,
+      ConvertToCString(server.GetUsername()), /* Authentication */
+      ConvertToCString(server.GetPassword()), 
+      0,                                      /* Timeout */
+      ConvertToCString(server.GetCertificateFile()),
+      ConvertToCString(server.GetCertificateKeyFile()),
+      ConvertToCString(server.GetCertificateKeyPassword()),
+      server.IsPkcs11Enabled() ? 1 : 0);
+
+    if (code != OrthancPluginErrorCode_Success ||
+        (status < 200 || status >= 300))
+    {
+      OrthancPlugins::Configuration::LogError("Cannot issue an HTTP query to " + url + 
+                                              " (HTTP status: " + boost::lexical_cast<std::string>(status) + ")");
+      throw Orthanc::OrthancException(static_cast<Orthanc::ErrorCode>(code));
+    }
+  }
+
+
+  void CallServer(std::string& answerBody /* out */,
+                  std::map<std::string, std::string>& answerHeaders /* out */,
+                  const Orthanc::WebServiceParameters& server,
+                  OrthancPluginHttpMethod method,
+                  const std::map<std::string, std::string>& httpHeaders,
+                  const std::string& uri,
+                  IChunkedRequestBody& body)
+  {
+    answerBody.clear();
+    answerHeaders.clear();
+
+    StringAnswer answer(answerBody, answerHeaders);
+    CallServer(answer, server, method, httpHeaders, uri, &body);
+  }
+#endif
+
+
   void UriEncode(std::string& uri,
                  const std::string& resource,
                  const std::map<std::string, std::string>& getArguments)
@@ -20,11 +20,14 @@
 
 #pragma once
 
+#include "Configuration.h"
+
 #include <Core/WebServiceParameters.h>
 #include <Plugins/Samples/Common/OrthancPluginCppWrapper.h>
 
 #include <list>
 #include <string>
+#include <boost/noncopyable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <json/value.h>
 
@@ -34,9 +37,15 @@ namespace OrthancPlugins
   {
   private:
     typedef std::map<std::string, Orthanc::WebServiceParameters*>  Servers;
+    typedef std::map<std::string, unsigned int>                    Concurrencies;
+
+    boost::mutex   mutex_;
+    Servers        servers_;
+    Concurrencies  retrieveConcurrency_;
+    Concurrencies  stowConcurrency_;
 
-    boost::mutex  mutex_;
-    Servers       servers_;
+    static unsigned int GetConcurrency(const Concurrencies& concurrencies,
+                                       const std::string& name);
 
     void Clear();
 
@@ -57,6 +66,14 @@ namespace OrthancPlugins
     Orthanc::WebServiceParameters GetServer(const std::string& name);
 
     void ListServers(std::list<std::string>& servers);
+
+    // Number of resources that are retrieved in parallel from this
+    // server by the WADO-RS client (option "RetrieveConcurrency")
+    unsigned int GetRetrieveConcurrency(const std::string& name);
+
+    // Number of STOW-RS batches that are uploaded in parallel to this
+    // server by the STOW-RS client (option "StowConcurrency")
+    unsigned int GetStowConcurrency(const std::string& name);
   };
 
 
@@ -68,6 +85,60 @@ namespace OrthancPlugins
                   const std::string& uri,
                   const std::string& body);
 
+#if HAS_CHUNKED_HTTP_CLIENT == 1
+  // Body of an HTTP request that is generated while it is uploaded,
+  // one chunk at a time. The chunk must remain valid until "Next()".
+  class IChunkedRequestBody : public boost::noncopyable
+  {
+  public:
+    virtual ~IChunkedRequestBody()
+    {
+    }
+
+    virtual bool IsDone() const = 0;
+
+    virtual const void* GetChunkData() const = 0;
+
+    virtual size_t GetChunkSize() const = 0;
+
+    virtual void Next() = 0;
+  };
+
+  // Receives the answer to an HTTP request while it is downloaded.
+  // All the headers are received before the first chunk of the body.
+  class IChunkedAnswer : public boost::noncopyable
+  {
+  public:
+    virtual ~IChunkedAnswer()
+    {
+    }
+
+    virtual void AddHeader(const std::string& key,
+                           const std::string& value) = 0;
+
+    virtual void AddChunk(const void* data,
+                          size_t size) = 0;
+  };
+
+  // The body of the request can be NULL (e.g. for GET requests)
+  void CallServer(IChunkedAnswer& answer,
+                  const Orthanc::WebServiceParameters& server,
+                  OrthancPluginHttpMethod method,
+                  const std::map<std::string, std::string>& httpHeaders,
+                  const std::string& uri,
+                  IChunkedRequestBody* body);
+
+  // Same as "CallServer()", but the body is sent using the chunked
+  // transfer encoding, which avoids holding it entirely in memory
+  void CallServer(std::string& answerBody /* out */,
+                  std::map<std::string, std::string>& answerHeaders /* out */,
+                  const Orthanc::WebServiceParameters& server,
+                  OrthancPluginHttpMethod method,
+                  const std::map<std::string, std::string>& httpHeaders,
+                  const std::string& uri,
+                  IChunkedRequestBody& body);
+#endif
+
   void UriEncode(std::string& uri,
                  const std::string& resource,
                  const std::map<std::string, std::string>& getArguments);
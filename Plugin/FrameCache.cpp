@@ -0,0 +1,216 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "FrameCache.h"
+
+#include <cassert>
+#include <boost/lexical_cast.hpp>
+
+namespace OrthancPlugins
+{
+  // Default maximum size of the cached frames (128MB)
+  static const size_t DEFAULT_MAX_SIZE = 128 * 1024 * 1024;
+
+
+  static std::string GetInstancePrefix(const std::string& instanceId)
+  {
+    return instanceId + "|";
+  }
+
+
+  static std::string GetKey(const std::string& instanceId,
+                            const std::string& transferSyntax,
+                            unsigned int frameIndex)
+  {
+    return (GetInstancePrefix(instanceId) + transferSyntax + "|" + 
+            boost::lexical_cast<std::string>(frameIndex));
+  }
+
+
+  FrameCache::FrameCache() :
+    revision_(0),
+    maxSize_(DEFAULT_MAX_SIZE),
+    size_(0)
+  {
+  }
+
+
+  void FrameCache::RemoveInternal(Content::iterator item)
+  {
+    assert(item != content_.end() &&
+           size_ >= item->second.frame_.size());
+    size_ -= item->second.frame_.size();
+    recency_.erase(item->second.recency_);
+    content_.erase(item);
+  }
+
+
+  void FrameCache::MakeRoom(size_t size)
+  {
+    while (!recency_.empty() &&
+           size_ + size > maxSize_)
+    {
+      // Drop the least recently used frame
+      RemoveInternal(content_.find(recency_.back()));
+    }
+  }
+
+
+  FrameCache& FrameCache::GetInstance()
+  {
+    static FrameCache singleton;
+    return singleton;
+  }
+
+
+  unsigned int FrameCache::GetRevision()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return revision_;
+  }
+
+
+  bool FrameCache::Lookup(std::string& frame,
+                          const std::string& instanceId,
+                          const std::string& transferSyntax,
+                          unsigned int frameIndex)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Content::iterator found = content_.find(GetKey(instanceId, transferSyntax, frameIndex));
+    if (found == content_.end())
+    {
+      return false;
+    }
+    else
+    {
+      recency_.splice(recency_.begin(), recency_, found->second.recency_);
+      frame = found->second.frame_;
+      return true;
+    }
+  }
+
+
+  void FrameCache::Store(unsigned int revision,
+                         const std::string& instanceId,
+                         const std::string& transferSyntax,
+                         unsigned int frameIndex,
+                         const void* frame,
+                         size_t size)
+  {
+    const std::string key = GetKey(instanceId, transferSyntax, frameIndex);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (revision != revision_)
+    {
+      // Some instance was deleted in the meantime: The frame might
+      // come from a file that does not exist anymore
+      return;
+    }
+
+    if (size > maxSize_)
+    {
+      return;  // This frame is too large to be cached (or the cache is disabled)
+    }
+
+    Content::iterator found = content_.find(key);
+    if (found != content_.end())
+    {
+      RemoveInternal(found);
+    }
+
+    MakeRoom(size);
+
+    recency_.push_front(key);
+
+    Item& item = content_[key];
+    item.frame_.assign(reinterpret_cast<const char*>(frame), size);
+    item.recency_ = recency_.begin();
+
+    size_ += size;
+  }
+
+
+  void FrameCache::Invalidate(const std::string& instanceId)
+  {
+    const std::string prefix = GetInstancePrefix(instanceId);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    revision_++;
+
+    // All the keys of this instance are contiguous in the map
+    Content::iterator it = content_.lower_bound(prefix);
+    while (it != content_.end() &&
+           it->first.compare(0, prefix.size(), prefix) == 0)
+    {
+      Content::iterator next = it;
+      ++next;
+      RemoveInternal(it);
+      it = next;
+    }
+  }
+
+
+  void FrameCache::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    revision_++;
+    content_.clear();
+    recency_.clear();
+    size_ = 0;
+  }
+
+
+  void FrameCache::SetMaxSize(size_t size)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maxSize_ = size;
+    MakeRoom(0);
+  }
+
+
+  size_t FrameCache::GetSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return size_;
+  }
+
+
+  void FrameCache::SignalChange(OrthancPluginChangeType changeType,
+                                OrthancPluginResourceType resourceType,
+                                const std::string& resourceId)
+  {
+    if (changeType == OrthancPluginChangeType_Deleted)
+    {
+      if (resourceType == OrthancPluginResourceType_Instance)
+      {
+        Invalidate(resourceId);
+      }
+      else
+      {
+        // The child instances of the deleted resource are not known
+        Clear();
+      }
+    }
+  }
+}
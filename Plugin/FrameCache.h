@@ -0,0 +1,99 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <orthanc/OrthancCPlugin.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace OrthancPlugins
+{
+  /**
+   * Cache of the frames that were transcoded by WADO-RS
+   * RetrieveFrames, indexed by the Orthanc identifier of the instance,
+   * the target transfer syntax and the frame index. The total size of
+   * the cached frames is bounded, the least recently used frames being
+   * dropped first.
+   **/
+  class FrameCache : public boost::noncopyable
+  {
+  private:
+    typedef std::list<std::string>  Recency;   // Keys, the most recently used first
+
+    struct Item
+    {
+      std::string        frame_;
+      Recency::iterator  recency_;
+    };
+
+    typedef std::map<std::string, Item>  Content;
+
+    boost::mutex  mutex_;
+    unsigned int  revision_;
+    size_t        maxSize_;
+    size_t        size_;
+    Content       content_;
+    Recency       recency_;
+
+    FrameCache();  // Forbidden (singleton pattern)
+
+    void RemoveInternal(Content::iterator item);
+
+    void MakeRoom(size_t size);
+
+  public:
+    static FrameCache& GetInstance();
+
+    // To be read before the DICOM file is downloaded from Orthanc, cf.
+    // "HierarchyCache": The frames are not stored if some instance was
+    // deleted in the meantime
+    unsigned int GetRevision();
+
+    bool Lookup(std::string& frame /* out */,
+                const std::string& instanceId,
+                const std::string& transferSyntax,
+                unsigned int frameIndex);
+
+    void Store(unsigned int revision,
+               const std::string& instanceId,
+               const std::string& transferSyntax,
+               unsigned int frameIndex,
+               const void* frame,
+               size_t size);
+
+    void Invalidate(const std::string& instanceId);
+
+    void Clear();
+
+    // In bytes, 0 disables the cache
+    void SetMaxSize(size_t size);
+
+    size_t GetSize();
+
+    void SignalChange(OrthancPluginChangeType changeType,
+                      OrthancPluginResourceType resourceType,
+                      const std::string& resourceId);
+  };
+}
@@ -0,0 +1,379 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "FrameIndex.h"
+
+#include "Configuration.h"
+
+#include <Core/OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+#include <cassert>
+
+namespace OrthancPlugins
+{
+  static const gdcm::Tag DICOM_TAG_NUMBER_OF_FRAMES(0x0028, 0x0008);
+  static const gdcm::Tag DICOM_TAG_EXTENDED_OFFSET_TABLE(0x7fe0, 0x0001);
+
+
+  static uint64_t ReadLittleEndian(const uint8_t* p,
+                                   size_t size)
+  {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+      value |= static_cast<uint64_t>(p[i]) << (8 * i);
+    }
+
+    return value;
+  }
+
+
+  static bool ReadOffsets(std::vector<uint64_t>& offsets,
+                          const gdcm::ByteValue* table,
+                          unsigned int framesCount,
+                          size_t itemSize)
+  {
+    if (table == NULL ||
+        table->GetLength() != framesCount * itemSize)
+    {
+      return false;
+    }
+
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(table->GetPointer());
+
+    offsets.resize(framesCount);
+    for (unsigned int i = 0; i < framesCount; i++)
+    {
+      offsets[i] = ReadLittleEndian(p + i * itemSize, itemSize);
+    }
+
+    return true;
+  }
+
+
+  bool FrameIndex::SetupFromOffsets(const std::vector<uint64_t>& offsets)
+  {
+    // The offsets are counted from the first byte of the first
+    // fragment, each fragment being preceded by an 8-byte item header
+    std::vector<size_t> firsts;
+    firsts.reserve(offsets.size());
+
+    uint64_t position = 0;
+    for (size_t i = 0; i < fragments_.GetNumberOfFragments(); i++)
+    {
+      if (firsts.size() < offsets.size() &&
+          offsets[firsts.size()] == position)
+      {
+        firsts.push_back(i);
+      }
+
+      position += 8 + static_cast<uint32_t>(fragments_.GetFragment(i).GetVL());
+    }
+
+    if (firsts.size() != offsets.size())
+    {
+      return false;  // Some offset does not correspond to a fragment
+    }
+
+    frames_.resize(firsts.size());
+    for (size_t i = 0; i < firsts.size(); i++)
+    {
+      frames_[i].first_ = firsts[i];
+      frames_[i].count_ = (i + 1 < firsts.size() ? firsts[i + 1] : fragments_.GetNumberOfFragments()) - firsts[i];
+    }
+
+    return true;
+  }
+
+
+  bool FrameIndex::SetupFromExtendedOffsetTable(const gdcm::DataSet& dataset,
+                                                unsigned int framesCount)
+  {
+    std::vector<uint64_t> offsets;
+    return (dataset.FindDataElement(DICOM_TAG_EXTENDED_OFFSET_TABLE) &&
+            ReadOffsets(offsets, dataset.GetDataElement(DICOM_TAG_EXTENDED_OFFSET_TABLE).GetByteValue(), framesCount, 8) &&
+            SetupFromOffsets(offsets));
+  }
+
+
+  bool FrameIndex::SetupFromBasicOffsetTable(unsigned int framesCount)
+  {
+    std::vector<uint64_t> offsets;
+    return (ReadOffsets(offsets, fragments_.GetTable().GetByteValue(), framesCount, 4) &&
+            SetupFromOffsets(offsets));
+  }
+
+
+  bool FrameIndex::SetupFromMarkers(unsigned int framesCount)
+  {
+    std::vector<Range> frames;
+
+    for (size_t i = 0; i < fragments_.GetNumberOfFragments(); i++)
+    {
+      const gdcm::ByteValue* value = fragments_.GetFragment(i).GetByteValue();
+
+      if (value != NULL &&
+          IsStartOfFrame(value->GetPointer(), value->GetLength()))
+      {
+        Range range;
+        range.first_ = i;
+        range.count_ = 1;
+        frames.push_back(range);
+      }
+      else if (frames.empty())
+      {
+        return false;  // The first fragment must start a frame
+      }
+      else
+      {
+        frames.back().count_ ++;
+      }
+    }
+
+    if (frames.size() == framesCount)
+    {
+      frames_.swap(frames);
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  FrameIndex::FrameIndex(const gdcm::SequenceOfFragments& fragments,
+                         const gdcm::DataSet& dataset,
+                         unsigned int framesCount) :
+    fragments_(fragments)
+  {
+    const size_t fragmentsCount = fragments_.GetNumberOfFragments();
+
+    if (framesCount == 0 ||
+        fragmentsCount < framesCount)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+    }
+    else if (framesCount == 1)
+    {
+      // All the fragments belong to the single frame
+      frames_.resize(1);
+      frames_[0].first_ = 0;
+      frames_[0].count_ = fragmentsCount;
+    }
+    else if (SetupFromExtendedOffsetTable(dataset, framesCount) ||
+             SetupFromBasicOffsetTable(framesCount))
+    {
+      // The offset tables were successfully used
+    }
+    else if (fragmentsCount == framesCount)
+    {
+      // One fragment per frame
+      frames_.resize(framesCount);
+      for (unsigned int i = 0; i < framesCount; i++)
+      {
+        frames_[i].first_ = i;
+        frames_[i].count_ = 1;
+      }
+    }
+    else if (!SetupFromMarkers(framesCount))
+    {
+      OrthancPlugins::Configuration::LogError("Cannot locate the " + boost::lexical_cast<std::string>(framesCount) +
+                                              " frames in the " + boost::lexical_cast<std::string>(fragmentsCount) +
+                                              " fragments of the pixel data");
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+    }
+
+    assert(frames_.size() == framesCount);
+  }
+
+
+  size_t FrameIndex::GetFragmentsCount(unsigned int frame) const
+  {
+    if (frame >= frames_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    return frames_[frame].count_;
+  }
+
+
+  void FrameIndex::GetFrame(const char*& content,
+                            size_t& size,
+                            std::string& buffer,
+                            unsigned int frame) const
+  {
+    if (frame >= frames_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    const Range& range = frames_[frame];
+
+    if (range.count_ == 1)
+    {
+      const gdcm::ByteValue* value = fragments_.GetFragment(range.first_).GetByteValue();
+      if (value == NULL)
+      {
+        content = NULL;
+        size = 0;
+      }
+      else
+      {
+        content = value->GetPointer();
+        size = value->GetLength();
+      }
+    }
+    else
+    {
+      GetFrame(buffer, frame);
+      content = buffer.empty() ? NULL : buffer.c_str();
+      size = buffer.size();
+    }
+  }
+
+
+  void FrameIndex::GetFrame(std::string& target,
+                            unsigned int frame) const
+  {
+    if (frame >= frames_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    const Range& range = frames_[frame];
+
+    size_t size = 0;
+    for (size_t i = range.first_; i < range.first_ + range.count_; i++)
+    {
+      size += static_cast<uint32_t>(fragments_.GetFragment(i).GetVL());
+    }
+
+    target.clear();
+    target.reserve(size);
+
+    for (size_t i = range.first_; i < range.first_ + range.count_; i++)
+    {
+      const gdcm::ByteValue* value = fragments_.GetFragment(i).GetByteValue();
+      if (value != NULL)
+      {
+        target.append(value->GetPointer(), value->GetLength());
+      }
+    }
+  }
+
+
+  bool FrameIndex::IsStartOfFrame(const void* fragment,
+                                  size_t size)
+  {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(fragment);
+
+    if (size >= 3 &&
+        p[0] == 0xff && p[1] == 0xd8 && p[2] == 0xff)
+    {
+      return true;  // JPEG and JPEG-LS: Start of Image (SOI) marker
+    }
+
+    if (size >= 4 &&
+        p[0] == 0xff && p[1] == 0x4f && p[2] == 0xff && p[3] == 0x51)
+    {
+      return true;  // JPEG 2000 codestream: SOC and SIZ markers
+    }
+
+    if (size >= 8 &&
+        p[0] == 0x00 && p[1] == 0x00 && p[2] == 0x00 && p[3] == 0x0c &&
+        p[4] == 'j' && p[5] == 'P' && p[6] == ' ' && p[7] == ' ')
+    {
+      return true;  // JPEG 2000 file format: Signature box
+    }
+
+    if (size >= 64 &&
+        ReadLittleEndian(p, 4) >= 1 &&
+        ReadLittleEndian(p, 4) <= 15 &&
+        ReadLittleEndian(p + 4, 4) == 64)
+    {
+      return true;  // RLE: Header with the number of segments, and offset of the first segment
+    }
+
+    return false;
+  }
+
+
+  unsigned int FrameIndex::GetFramesCount(const gdcm::DataSet& dataset)
+  {
+    if (dataset.FindDataElement(DICOM_TAG_NUMBER_OF_FRAMES))
+    {
+      const gdcm::ByteValue* value = dataset.GetDataElement(DICOM_TAG_NUMBER_OF_FRAMES).GetByteValue();
+
+      if (value != NULL)
+      {
+        std::string s(value->GetPointer(), value->GetLength());
+
+        // Remove the padding of the Integer String
+        size_t first = s.find_first_not_of(" \0", 0, 2);
+        size_t last = s.find_last_not_of(" \0", std::string::npos, 2);
+
+        if (first != std::string::npos)
+        {
+          try
+          {
+            int count = boost::lexical_cast<int>(s.substr(first, last - first + 1));
+            if (count > 0)
+            {
+              return static_cast<unsigned int>(count);
+            }
+          }
+          catch (boost::bad_lexical_cast&)
+          {
+          }
+        }
+      }
+    }
+
+    return 1;
+  }
+
+
+  void FrameIndex::GetNativeFrame(const char*& content,
+                                  size_t& size,
+                                  const gdcm::ByteValue& pixelData,
+                                  unsigned int framesCount,
+                                  unsigned int frame)
+  {
+    if (framesCount == 0 ||
+        pixelData.GetLength() < framesCount)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+    }
+
+    if (frame >= framesCount)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    // The integer division discards the padding byte of the pixel
+    // data if its length is odd
+    size = pixelData.GetLength() / framesCount;
+    content = pixelData.GetPointer() + frame * size;
+  }
+}
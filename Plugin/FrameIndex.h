@@ -0,0 +1,99 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <gdcmDataSet.h>
+#include <gdcmSequenceOfFragments.h>
+
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+namespace OrthancPlugins
+{
+  /**
+   * Index giving the fragments of each frame of an encapsulated pixel
+   * data. The index is computed from the Extended Offset Table if
+   * present, then from the Basic Offset Table, and finally by looking
+   * for the start-of-image markers of the codecs at the beginning of
+   * the fragments.
+   **/
+  class FrameIndex : public boost::noncopyable
+  {
+  private:
+    struct Range
+    {
+      size_t  first_;   // Index of the first fragment of the frame
+      size_t  count_;   // Number of fragments in the frame
+    };
+
+    const gdcm::SequenceOfFragments&  fragments_;
+    std::vector<Range>                frames_;
+
+    bool SetupFromOffsets(const std::vector<uint64_t>& offsets);
+
+    bool SetupFromExtendedOffsetTable(const gdcm::DataSet& dataset,
+                                      unsigned int framesCount);
+
+    bool SetupFromBasicOffsetTable(unsigned int framesCount);
+
+    bool SetupFromMarkers(unsigned int framesCount);
+
+  public:
+    // The sequence of fragments must remain valid during the lifetime
+    // of the index
+    FrameIndex(const gdcm::SequenceOfFragments& fragments,
+               const gdcm::DataSet& dataset,
+               unsigned int framesCount);
+
+    unsigned int GetFramesCount() const
+    {
+      return frames_.size();
+    }
+
+    size_t GetFragmentsCount(unsigned int frame) const;
+
+    // Returns a pointer to the content of the frame, without copy if
+    // the frame is made of one single fragment. Otherwise, the
+    // fragments are concatenated into "buffer".
+    void GetFrame(const char*& content /* out */,
+                  size_t& size /* out */,
+                  std::string& buffer,
+                  unsigned int frame) const;
+
+    void GetFrame(std::string& target,
+                  unsigned int frame) const;
+
+    static bool IsStartOfFrame(const void* fragment,
+                               size_t size);
+
+    static unsigned int GetFramesCount(const gdcm::DataSet& dataset);
+
+    // Locates one frame in the pixel data of an uncompressed image.
+    // The size of the frames is derived from the length of the pixel
+    // data, which is correct for packed 1-bit and YBR_FULL_422 data.
+    static void GetNativeFrame(const char*& content /* out */,
+                               size_t& size /* out */,
+                               const gdcm::ByteValue& pixelData,
+                               unsigned int framesCount,
+                               unsigned int frame);
+  };
+}
@@ -0,0 +1,255 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "HierarchyCache.h"
+
+#include <cassert>
+
+namespace OrthancPlugins
+{
+  // Default number of series and instances whose location is kept in memory
+  static const size_t DEFAULT_MAX_SIZE = 100000;
+
+
+  static std::string GetSeriesKey(const std::string& seriesInstanceUid)
+  {
+    return "series|" + seriesInstanceUid;
+  }
+
+
+  static std::string GetInstanceKey(const std::string& sopInstanceUid)
+  {
+    return "instance|" + sopInstanceUid;
+  }
+
+
+  HierarchyCache::HierarchyCache() :
+    revision_(0),
+    maxSize_(DEFAULT_MAX_SIZE)
+  {
+  }
+
+
+  bool HierarchyCache::LookupInternal(Entry& entry,
+                                      const std::string& key)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Content::iterator found = content_.find(key);
+    if (found == content_.end())
+    {
+      return false;
+    }
+    else
+    {
+      // Move the item to the front of the recency list
+      recency_.splice(recency_.begin(), recency_, found->second.recency_);
+      entry = found->second.entry_;
+      return true;
+    }
+  }
+
+
+  void HierarchyCache::RemoveInternal(Content::iterator item)
+  {
+    assert(item != content_.end());
+    resources_.erase(item->second.entry_.resourceId_);
+    recency_.erase(item->second.recency_);
+    content_.erase(item);
+  }
+
+
+  void HierarchyCache::StoreInternal(unsigned int revision,
+                                     const std::string& key,
+                                     const Entry& entry)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (revision != revision_ ||
+        maxSize_ == 0)
+    {
+      // Some resource was deleted in the meantime: The entry might be outdated
+      return;
+    }
+
+    Content::iterator found = content_.find(key);
+    if (found != content_.end())
+    {
+      RemoveInternal(found);
+    }
+
+    while (content_.size() >= maxSize_)
+    {
+      // Drop the least recently used entry
+      assert(!recency_.empty());
+      RemoveInternal(content_.find(recency_.back()));
+    }
+
+    recency_.push_front(key);
+
+    Item& item = content_[key];
+    item.entry_ = entry;
+    item.recency_ = recency_.begin();
+
+    resources_[entry.resourceId_] = key;
+  }
+
+
+  void HierarchyCache::InvalidateResource(const std::string& resourceId)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    revision_++;
+
+    Resources::const_iterator resource = resources_.find(resourceId);
+    if (resource != resources_.end())
+    {
+      RemoveInternal(content_.find(resource->second));
+    }
+  }
+
+
+  HierarchyCache& HierarchyCache::GetInstance()
+  {
+    static HierarchyCache singleton;
+    return singleton;
+  }
+
+
+  unsigned int HierarchyCache::GetRevision()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return revision_;
+  }
+
+
+  bool HierarchyCache::LookupSeries(std::string& seriesId,
+                                    std::string& studyInstanceUid,
+                                    const std::string& seriesInstanceUid)
+  {
+    Entry entry;
+    if (LookupInternal(entry, GetSeriesKey(seriesInstanceUid)))
+    {
+      seriesId = entry.resourceId_;
+      studyInstanceUid = entry.studyInstanceUid_;
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  void HierarchyCache::StoreSeries(unsigned int revision,
+                                   const std::string& seriesInstanceUid,
+                                   const std::string& seriesId,
+                                   const std::string& studyInstanceUid)
+  {
+    Entry entry;
+    entry.resourceId_ = seriesId;
+    entry.seriesInstanceUid_ = seriesInstanceUid;
+    entry.studyInstanceUid_ = studyInstanceUid;
+    StoreInternal(revision, GetSeriesKey(seriesInstanceUid), entry);
+  }
+
+
+  bool HierarchyCache::LookupInstance(std::string& instanceId,
+                                      std::string& seriesInstanceUid,
+                                      std::string& studyInstanceUid,
+                                      const std::string& sopInstanceUid)
+  {
+    Entry entry;
+    if (LookupInternal(entry, GetInstanceKey(sopInstanceUid)))
+    {
+      instanceId = entry.resourceId_;
+      seriesInstanceUid = entry.seriesInstanceUid_;
+      studyInstanceUid = entry.studyInstanceUid_;
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  void HierarchyCache::StoreInstance(unsigned int revision,
+                                     const std::string& sopInstanceUid,
+                                     const std::string& instanceId,
+                                     const std::string& seriesInstanceUid,
+                                     const std::string& studyInstanceUid)
+  {
+    Entry entry;
+    entry.resourceId_ = instanceId;
+    entry.seriesInstanceUid_ = seriesInstanceUid;
+    entry.studyInstanceUid_ = studyInstanceUid;
+    StoreInternal(revision, GetInstanceKey(sopInstanceUid), entry);
+  }
+
+
+  void HierarchyCache::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    revision_++;
+    content_.clear();
+    resources_.clear();
+    recency_.clear();
+  }
+
+
+  void HierarchyCache::SetMaxSize(size_t size)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maxSize_ = size;
+
+    while (content_.size() > maxSize_)
+    {
+      RemoveInternal(content_.find(recency_.back()));
+    }
+  }
+
+
+  size_t HierarchyCache::GetSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return content_.size();
+  }
+
+
+  void HierarchyCache::SignalChange(OrthancPluginChangeType changeType,
+                                    OrthancPluginResourceType resourceType,
+                                    const std::string& resourceId)
+  {
+    if (changeType == OrthancPluginChangeType_Deleted)
+    {
+      if (resourceType == OrthancPluginResourceType_Instance)
+      {
+        InvalidateResource(resourceId);
+      }
+      else
+      {
+        // The child instances of the deleted resource are not known
+        Clear();
+      }
+    }
+  }
+}
@@ -0,0 +1,118 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <orthanc/OrthancCPlugin.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace OrthancPlugins
+{
+  /**
+   * Cache of the location of the series and instances in the DICOM
+   * hierarchy, as needed by WADO-RS: It maps a SeriesInstanceUID
+   * (resp. SOPInstanceUID) to the Orthanc identifier of the resource
+   * and to the UIDs of its parent study (resp. parent series and
+   * study). The least recently used entries are dropped first.
+   **/
+  class HierarchyCache : public boost::noncopyable
+  {
+  private:
+    struct Entry
+    {
+      std::string  resourceId_;
+      std::string  seriesInstanceUid_;
+      std::string  studyInstanceUid_;
+    };
+
+    typedef std::list<std::string>  Recency;   // Keys, the most recently used first
+
+    struct Item
+    {
+      Entry              entry_;
+      Recency::iterator  recency_;
+    };
+
+    typedef std::map<std::string, Item>         Content;    // Key => item
+    typedef std::map<std::string, std::string>  Resources;  // Orthanc ID => key
+
+    boost::mutex  mutex_;
+    unsigned int  revision_;
+    size_t        maxSize_;
+    Content       content_;
+    Resources     resources_;
+    Recency       recency_;
+
+    HierarchyCache();  // Forbidden (singleton pattern)
+
+    bool LookupInternal(Entry& entry,
+                        const std::string& key);
+
+    void StoreInternal(unsigned int revision,
+                       const std::string& key,
+                       const Entry& entry);
+
+    void RemoveInternal(Content::iterator item);
+
+    void InvalidateResource(const std::string& resourceId);
+
+  public:
+    static HierarchyCache& GetInstance();
+
+    // To be read before the lookups in Orthanc, cf. "DerivedTagsCache"
+    unsigned int GetRevision();
+
+    bool LookupSeries(std::string& seriesId /* out */,
+                      std::string& studyInstanceUid /* out */,
+                      const std::string& seriesInstanceUid);
+
+    void StoreSeries(unsigned int revision,
+                     const std::string& seriesInstanceUid,
+                     const std::string& seriesId,
+                     const std::string& studyInstanceUid);
+
+    bool LookupInstance(std::string& instanceId /* out */,
+                        std::string& seriesInstanceUid /* out */,
+                        std::string& studyInstanceUid /* out */,
+                        const std::string& sopInstanceUid);
+
+    void StoreInstance(unsigned int revision,
+                       const std::string& sopInstanceUid,
+                       const std::string& instanceId,
+                       const std::string& seriesInstanceUid,
+                       const std::string& studyInstanceUid);
+
+    void Clear();
+
+    // In number of series and instances, 0 disables the cache
+    void SetMaxSize(size_t size);
+
+    size_t GetSize();
+
+    void SignalChange(OrthancPluginChangeType changeType,
+                      OrthancPluginResourceType resourceType,
+                      const std::string& resourceId);
+  };
+}
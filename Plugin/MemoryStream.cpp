@@ -0,0 +1,105 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "MemoryStream.h"
+
+namespace OrthancPlugins
+{
+  MemoryStreamBuffer::MemoryStreamBuffer(const void* data,
+                                         size_t size)
+  {
+    // The "const_cast" is safe, as this stream buffer never writes to
+    // the memory area ("overflow()" and "pbackfail()" are not overridden)
+    char* begin = const_cast<char*>(reinterpret_cast<const char*>(data));
+
+    if (size == 0)
+    {
+      setg(NULL, NULL, NULL);
+    }
+    else
+    {
+      setg(begin, begin, begin + size);
+    }
+  }
+
+
+  MemoryStreamBuffer::pos_type MemoryStreamBuffer::seekoff(off_type offset,
+                                                           std::ios_base::seekdir direction,
+                                                           std::ios_base::openmode mode)
+  {
+    const pos_type failure = pos_type(off_type(-1));
+
+    if (!(mode & std::ios_base::in))
+    {
+      return failure;
+    }
+
+    const off_type size = egptr() - eback();
+    off_type position;
+
+    switch (direction)
+    {
+      case std::ios_base::beg:
+        position = offset;
+        break;
+
+      case std::ios_base::cur:
+        position = (gptr() - eback()) + offset;
+        break;
+
+      case std::ios_base::end:
+        position = size + offset;
+        break;
+
+      default:
+        return failure;
+    }
+
+    if (position < 0 ||
+        position > size)
+    {
+      return failure;
+    }
+    else
+    {
+      setg(eback(), eback() + position, egptr());
+      return pos_type(position);
+    }
+  }
+
+
+  MemoryStreamBuffer::pos_type MemoryStreamBuffer::seekpos(pos_type position,
+                                                           std::ios_base::openmode mode)
+  {
+    return seekoff(off_type(position), std::ios_base::beg, mode);
+  }
+
+
+  MemoryInputStream::MemoryInputStream(const void* data,
+                                       size_t size) :
+    std::istream(NULL),
+    buffer_(data, size)
+  {
+    // The stream buffer is only constructed after the base class
+    // "std::istream", so it must be attached afterwards
+    rdbuf(&buffer_);
+  }
+}
@@ -0,0 +1,60 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <istream>
+#include <streambuf>
+#include <boost/noncopyable.hpp>
+
+namespace OrthancPlugins
+{
+  /**
+   * Read-only stream buffer over a memory area that is owned by the
+   * caller, which avoids copying a DICOM file into a
+   * "std::stringstream" before giving it to GDCM. The memory area
+   * must remain valid as long as the stream buffer is in use.
+   **/
+  class MemoryStreamBuffer : public std::streambuf, public boost::noncopyable
+  {
+  protected:
+    virtual pos_type seekoff(off_type offset,
+                             std::ios_base::seekdir direction,
+                             std::ios_base::openmode mode);
+
+    virtual pos_type seekpos(pos_type position,
+                             std::ios_base::openmode mode);
+
+  public:
+    MemoryStreamBuffer(const void* data,
+                       size_t size);
+  };
+
+
+  class MemoryInputStream : public std::istream
+  {
+  private:
+    MemoryStreamBuffer  buffer_;
+
+  public:
+    MemoryInputStream(const void* data,
+                      size_t size);
+  };
+}
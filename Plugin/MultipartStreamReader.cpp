@@ -0,0 +1,456 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "MultipartStreamReader.h"
+
+#include "Configuration.h"
+
+#include <Core/OrthancException.h>
+#include <Core/Toolbox.h>
+
+#include <algorithm>
+#include <string.h>
+#include <boost/lexical_cast.hpp>
+
+namespace OrthancPlugins
+{
+  namespace
+  {
+    enum DelimiterEnd
+    {
+      DelimiterEnd_Incomplete,   // More bytes are needed
+      DelimiterEnd_NotDelimiter, // The boundary is followed by other characters
+      DelimiterEnd_NextPart,     // "--boundary" [padding] CRLF
+      DelimiterEnd_Closing       // "--boundary--"
+    };
+  }
+
+
+  // Analyzes the bytes following a boundary, cf. the "dash-boundary"
+  // and "close-delimiter" rules of RFC 2046, Section 5.1.1
+  static DelimiterEnd CheckDelimiterEnd(const char*& next /* out */,
+                                        const char* p,
+                                        const char* end,
+                                        bool isLast)
+  {
+    if (p < end &&
+        *p == '-')
+    {
+      if (end - p >= 2)
+      {
+        return (p[1] == '-' ? DelimiterEnd_Closing : DelimiterEnd_NotDelimiter);
+      }
+      else
+      {
+        return (isLast ? DelimiterEnd_Closing : DelimiterEnd_Incomplete);
+      }
+    }
+
+    // Skip the transport padding
+    while (p < end &&
+           (*p == ' ' || *p == '\t'))
+    {
+      p++;
+    }
+
+    if (end - p >= 2)
+    {
+      if (p[0] == '\r' &&
+          p[1] == '\n')
+      {
+        next = p + 2;
+        return DelimiterEnd_NextPart;
+      }
+      else
+      {
+        return DelimiterEnd_NotDelimiter;
+      }
+    }
+    else if (p == end ||
+             *p == '\r')
+    {
+      // The last boundary may have no trailing "--"
+      return (isLast ? DelimiterEnd_Closing : DelimiterEnd_Incomplete);
+    }
+    else
+    {
+      return DelimiterEnd_NotDelimiter;
+    }
+  }
+
+
+  MultipartStreamReader::MultipartStreamReader(IHandler& handler,
+                                               const std::string& boundary) :
+    handler_(handler),
+    delimiter_("\r\n--" + boundary),
+    skip_(256, delimiter_.size()),
+    state_(State_Preamble),
+    hasLength_(false),
+    length_(0),
+    scanned_(0)
+  {
+    if (boundary.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    // Horspool's table: Shift to apply depending on the last character
+    // of the window (the last character of the pattern is excluded)
+    for (size_t i = 0; i + 1 < delimiter_.size(); i++)
+    {
+      skip_[static_cast<uint8_t>(delimiter_[i])] = delimiter_.size() - 1 - i;
+    }
+  }
+
+
+  const char* MultipartStreamReader::Find(const char* start,
+                                          const char* end) const
+  {
+    const size_t size = delimiter_.size();
+    const char* pattern = delimiter_.c_str();
+
+    while (end - start >= static_cast<ptrdiff_t>(size))
+    {
+      const char last = start[size - 1];
+
+      if (last == pattern[size - 1] &&
+          memcmp(start, pattern, size - 1) == 0)
+      {
+        return start;
+      }
+
+      start += skip_[static_cast<uint8_t>(last)];
+    }
+
+    return NULL;
+  }
+
+
+  bool MultipartStreamReader::ParseHeaders(const char*& current,
+                                           const char* end)
+  {
+    headers_.clear();
+    hasLength_ = false;
+    length_ = 0;
+
+    const char* endHeaders;
+
+    if (end - current >= 2 &&
+        current[0] == '\r' &&
+        current[1] == '\n')
+    {
+      endHeaders = current;   // No header in this part
+    }
+    else
+    {
+      static const char ENDING[] = "\r\n\r\n";
+      endHeaders = std::search(current, end, ENDING, ENDING + 4);
+
+      if (endHeaders == end)
+      {
+        return false;  // The headers are not complete yet
+      }
+
+      endHeaders += 2;  // Keep the CRLF of the last header line
+    }
+
+    // Loop over the HTTP headers of this part, one per line
+    const char* line = current;
+    while (line < endHeaders)
+    {
+      const char* eol = line;
+      while (eol[0] != '\r' || eol[1] != '\n')
+      {
+        eol++;
+      }
+
+      const char* colon = std::find(line, eol, ':');
+      if (colon != eol)
+      {
+        std::string key = Orthanc::Toolbox::StripSpaces(std::string(line, colon));
+        Orthanc::Toolbox::ToLowerCase(key);
+        headers_[key] = Orthanc::Toolbox::StripSpaces(std::string(colon + 1, eol));
+      }
+
+      line = eol + 2;
+    }
+
+    HttpHeaders::const_iterator length = headers_.find("content-length");
+    if (length != headers_.end())
+    {
+      try
+      {
+        int tmp = boost::lexical_cast<int>(length->second);
+        if (tmp >= 0)
+        {
+          hasLength_ = true;
+          length_ = tmp;
+        }
+      }
+      catch (boost::bad_lexical_cast&)
+      {
+        OrthancPlugins::Configuration::LogWarning("Unable to parse the Content-Length of a multipart item");
+      }
+    }
+
+    current = endHeaders + 2;
+    return true;
+  }
+
+
+  size_t MultipartStreamReader::Parse(const char* data,
+                                      size_t size,
+                                      size_t& scanned,
+                                      bool isLast)
+  {
+    const char* current = data;   // First byte that is not consumed yet
+    const char* end = data + size;
+
+    for (;;)
+    {
+      switch (state_)
+      {
+        case State_Done:
+          return size;  // The epilogue is ignored
+
+        case State_Preamble:
+        {
+          // The first boundary may be at the very beginning of the body,
+          // thus without the leading CRLF
+          const char* next = NULL;
+          DelimiterEnd status = DelimiterEnd_NotDelimiter;
+
+          const size_t dashBoundary = delimiter_.size() - 2;
+          if (size >= dashBoundary &&
+              memcmp(data, delimiter_.c_str() + 2, dashBoundary) == 0)
+          {
+            status = CheckDelimiterEnd(next, data + dashBoundary, end, isLast);
+          }
+
+          const char* from = data + scanned;
+          while (status == DelimiterEnd_NotDelimiter)
+          {
+            const char* found = Find(from, end);
+            if (found == NULL)
+            {
+              if (isLast)
+              {
+                state_ = State_Done;   // No boundary at all
+                return size;
+              }
+
+              scanned = (size < delimiter_.size() ? 0 : size - delimiter_.size() + 1);
+              return 0;
+            }
+
+            status = CheckDelimiterEnd(next, found + delimiter_.size(), end, isLast);
+            if (status == DelimiterEnd_Incomplete)
+            {
+              scanned = found - data;
+            }
+
+            from = found + 1;
+          }
+
+          if (status == DelimiterEnd_Incomplete)
+          {
+            return 0;
+          }
+          else if (status == DelimiterEnd_Closing)
+          {
+            state_ = State_Done;
+          }
+          else
+          {
+            current = next;
+            state_ = State_Headers;
+          }
+
+          scanned = 0;
+          break;
+        }
+
+        case State_Headers:
+          if (!ParseHeaders(current, end))
+          {
+            if (isLast &&
+                current != end)
+            {
+              // Cannot find the HTTP headers of this part
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+            }
+            else if (isLast)
+            {
+              state_ = State_Done;
+            }
+
+            return current - data;
+          }
+
+          state_ = State_Content;
+          scanned = 0;
+          break;
+
+        case State_Content:
+        {
+          const char* found;
+          const char* next = NULL;
+          DelimiterEnd status;
+
+          if (hasLength_)
+          {
+            // Directly jump over the content, whose size is known
+            if (static_cast<size_t>(end - current) < length_ + delimiter_.size())
+            {
+              if (isLast)
+              {
+                throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+              }
+
+              return current - data;
+            }
+
+            found = current + length_;
+            if (memcmp(found, delimiter_.c_str(), delimiter_.size()) != 0)
+            {
+              // Cannot find the separator after skipping the "Content-Length" bytes
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+            }
+
+            status = CheckDelimiterEnd(next, found + delimiter_.size(), end, isLast);
+            if (status == DelimiterEnd_NotDelimiter)
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+            }
+          }
+          else
+          {
+            const char* from = current + scanned;
+
+            for (;;)
+            {
+              found = Find(from, end);
+
+              if (found == NULL)
+              {
+                if (isLast)
+                {
+                  // No more occurrence of the boundary separator
+                  throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+                }
+
+                // Remember the bytes that cannot start a delimiter, in
+                // order not to scan them again on the next chunk
+                const size_t available = end - current;
+                scanned = (available < delimiter_.size() ? 0 : available - delimiter_.size() + 1);
+                return current - data;
+              }
+
+              status = CheckDelimiterEnd(next, found + delimiter_.size(), end, isLast);
+
+              if (status == DelimiterEnd_NotDelimiter)
+              {
+                from = found + 1;   // The boundary is a prefix of the content
+              }
+              else
+              {
+                break;
+              }
+            }
+          }
+
+          if (status == DelimiterEnd_Incomplete)
+          {
+            scanned = found - current;
+            return current - data;
+          }
+
+          handler_.HandlePart(headers_, current, found - current);
+
+          if (status == DelimiterEnd_Closing)
+          {
+            state_ = State_Done;
+          }
+          else
+          {
+            current = next;
+            state_ = State_Headers;
+          }
+
+          scanned = 0;
+          break;
+        }
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+    }
+  }
+
+
+  void MultipartStreamReader::AddChunk(const void* chunk,
+                                       size_t size)
+  {
+    if (state_ == State_Done ||
+        size == 0)
+    {
+      return;
+    }
+
+    if (buffer_.empty())
+    {
+      // Parse the chunk in place, and only keep its unconsumed bytes
+      const char* data = reinterpret_cast<const char*>(chunk);
+      size_t consumed = Parse(data, size, scanned_, false);
+      buffer_.assign(data + consumed, size - consumed);
+    }
+    else
+    {
+      buffer_.append(reinterpret_cast<const char*>(chunk), size);
+      size_t consumed = Parse(buffer_.c_str(), buffer_.size(), scanned_, false);
+      buffer_.erase(0, consumed);
+    }
+  }
+
+
+  void MultipartStreamReader::CloseStream()
+  {
+    if (state_ != State_Done)
+    {
+      Parse(buffer_.c_str(), buffer_.size(), scanned_, true);
+    }
+
+    buffer_.clear();
+    scanned_ = 0;
+  }
+
+
+  void MultipartStreamReader::ParseBody(IHandler& handler,
+                                        const void* body,
+                                        size_t size,
+                                        const std::string& boundary)
+  {
+    MultipartStreamReader reader(handler, boundary);
+
+    size_t scanned = 0;
+    reader.Parse(reinterpret_cast<const char*>(body), size, scanned, true);
+  }
+}
@@ -0,0 +1,109 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+namespace OrthancPlugins
+{
+  /**
+   * Parser of multipart bodies (RFC 2046), whose cost is linear in
+   * the size of the body: The boundaries are located using the
+   * Boyer-Moore-Horspool algorithm, and each byte is scanned at most
+   * once. The body can be provided at once, in which case the parts
+   * given to the handler point inside the body (no copy), or as a
+   * stream of chunks, in which case the content of one part is
+   * buffered until its closing boundary is received.
+   **/
+  class MultipartStreamReader : public boost::noncopyable
+  {
+  public:
+    typedef std::map<std::string, std::string>  HttpHeaders;  // Keys are lower case
+
+    class IHandler : public boost::noncopyable
+    {
+    public:
+      virtual ~IHandler()
+      {
+      }
+
+      virtual void HandlePart(const HttpHeaders& headers,
+                              const void* part,
+                              size_t size) = 0;
+    };
+
+  private:
+    enum State
+    {
+      State_Preamble,
+      State_Headers,
+      State_Content,
+      State_Done
+    };
+
+    IHandler&            handler_;
+    std::string          delimiter_;    // "\r\n--" + boundary
+    std::vector<size_t>  skip_;         // Horspool table of "delimiter_"
+    State                state_;
+    HttpHeaders          headers_;      // Headers of the current part
+    bool                 hasLength_;
+    size_t               length_;       // Content-Length of the current part
+    std::string          buffer_;       // Pending bytes of a stream
+    size_t               scanned_;      // Bytes of "buffer_" known not to start a delimiter
+
+    const char* Find(const char* start,
+                     const char* end) const;
+
+    size_t Parse(const char* data,
+                 size_t size,
+                 size_t& scanned,
+                 bool isLast);
+
+    bool ParseHeaders(const char*& current,
+                      const char* end);
+
+  public:
+    MultipartStreamReader(IHandler& handler,
+                          const std::string& boundary);
+
+    // Streaming API
+    void AddChunk(const void* chunk,
+                  size_t size);
+
+    // Checks that the stream has been completely parsed
+    void CloseStream();
+
+    bool IsDone() const
+    {
+      return state_ == State_Done;
+    }
+
+    // Parses a body that is entirely available in memory, without copy
+    static void ParseBody(IHandler& handler,
+                          const void* body,
+                          size_t size,
+                          const std::string& boundary);
+  };
+}
@@ -0,0 +1,396 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "OrderedTasksPool.h"
+
+#include <Core/OrthancException.h>
+
+#include <cassert>
+#include <memory>
+
+namespace OrthancPlugins
+{
+  struct OrderedTasksPool::Slot
+  {
+    ITask*             task_;
+    bool               completed_;
+    Orthanc::ErrorCode error_;
+
+    explicit Slot(ITask* task) :
+      task_(task),
+      completed_(false),
+      error_(Orthanc::ErrorCode_Success)
+    {
+    }
+  };
+
+
+  void OrderedTasksPool::Execute(Slot& slot)
+  {
+    try
+    {
+      slot.task_->Execute();
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      slot.error_ = e.GetErrorCode();
+    }
+    catch (std::bad_alloc&)
+    {
+      slot.error_ = Orthanc::ErrorCode_NotEnoughMemory;
+    }
+    catch (...)
+    {
+      slot.error_ = Orthanc::ErrorCode_InternalError;
+    }
+  }
+
+
+  void OrderedTasksPool::Worker(OrderedTasksPool* that)
+  {
+    for (;;)
+    {
+      Slot* slot = NULL;
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        while (!that->done_ &&
+               that->pending_.empty())
+        {
+          that->taskAvailable_.wait(lock);
+        }
+
+        if (that->done_)
+        {
+          return;
+        }
+
+        slot = that->pending_.front();
+        that->pending_.pop_front();
+      }
+
+      Execute(*slot);
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+        slot->completed_ = true;
+      }
+
+      that->taskCompleted_.notify_all();
+    }
+  }
+
+
+  void OrderedTasksPool::SignalSharedCompleted(Slot& slot)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    assert(sharedInFlight_ > 0);
+    slot.completed_ = true;
+    sharedInFlight_--;
+
+    // Notify while the mutex is locked, as the pool might be
+    // destroyed as soon as its last task is completed
+    taskCompleted_.notify_all();
+  }
+
+
+  OrderedTasksPool::SharedWorkers::SharedWorkers(unsigned int countThreads) :
+    done_(false)
+  {
+    if (countThreads == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    workers_.reserve(countThreads);
+
+    for (unsigned int i = 0; i < countThreads; i++)
+    {
+      workers_.push_back(new boost::thread(Worker, this));
+    }
+  }
+
+
+  OrderedTasksPool::SharedWorkers::~SharedWorkers()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      assert(pending_.empty());
+      done_ = true;
+    }
+
+    taskAvailable_.notify_all();
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      if (workers_[i]->joinable())
+      {
+        workers_[i]->join();
+      }
+
+      delete workers_[i];
+    }
+  }
+
+
+  void OrderedTasksPool::SharedWorkers::Worker(SharedWorkers* that)
+  {
+    for (;;)
+    {
+      PendingTask task;
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        while (!that->done_ &&
+               that->pending_.empty())
+        {
+          that->taskAvailable_.wait(lock);
+        }
+
+        if (that->done_)
+        {
+          return;
+        }
+
+        task = that->pending_.front();
+        that->pending_.pop_front();
+      }
+
+      OrderedTasksPool::Execute(*task.second);
+      task.first->SignalSharedCompleted(*task.second);
+    }
+  }
+
+
+  void OrderedTasksPool::SharedWorkers::Push(OrderedTasksPool& pool,
+                                             Slot& slot)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      pending_.push_back(std::make_pair(&pool, &slot));
+    }
+
+    taskAvailable_.notify_one();
+  }
+
+
+  size_t OrderedTasksPool::SharedWorkers::Cancel(const OrderedTasksPool& pool)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    std::deque<PendingTask> kept;
+    size_t count = 0;
+
+    for (std::deque<PendingTask>::const_iterator it = pending_.begin(); it != pending_.end(); ++it)
+    {
+      if (it->first == &pool)
+      {
+        count++;
+      }
+      else
+      {
+        kept.push_back(*it);
+      }
+    }
+
+    pending_.swap(kept);
+    return count;
+  }
+
+
+  OrderedTasksPool::OrderedTasksPool(unsigned int countThreads) :
+    done_(false),
+    shared_(NULL),
+    sharedInFlight_(0)
+  {
+    workers_.reserve(countThreads);
+
+    for (unsigned int i = 0; i < countThreads; i++)
+    {
+      workers_.push_back(new boost::thread(Worker, this));
+    }
+  }
+
+
+  OrderedTasksPool::OrderedTasksPool(SharedWorkers& shared) :
+    done_(false),
+    shared_(&shared),
+    sharedInFlight_(0)
+  {
+  }
+
+
+  OrderedTasksPool::~OrderedTasksPool()
+  {
+    if (shared_ != NULL)
+    {
+      // Withdraw the tasks that are not started yet, then wait for
+      // the shared workers to complete the running ones
+      size_t canceled = shared_->Cancel(*this);
+
+      boost::mutex::scoped_lock lock(mutex_);
+      assert(sharedInFlight_ >= canceled);
+      sharedInFlight_ -= canceled;
+
+      while (sharedInFlight_ > 0)
+      {
+        taskCompleted_.wait(lock);
+      }
+    }
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      done_ = true;
+    }
+
+    taskAvailable_.notify_all();
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      if (workers_[i]->joinable())
+      {
+        workers_[i]->join();
+      }
+
+      delete workers_[i];
+    }
+
+    // The workers are stopped, so the remaining tasks can be safely deleted
+    for (size_t i = 0; i < queue_.size(); i++)
+    {
+      delete queue_[i]->task_;
+      delete queue_[i];
+    }
+  }
+
+
+  void OrderedTasksPool::Push(ITask* task)
+  {
+    if (task == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    std::auto_ptr<ITask> protection(task);
+    std::auto_ptr<Slot> slot(new Slot(task));
+
+    if (shared_ != NULL)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        queue_.push_back(slot.get());
+        sharedInFlight_++;
+      }
+
+      try
+      {
+        shared_->Push(*this, *slot);
+      }
+      catch (...)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        queue_.pop_back();
+        sharedInFlight_--;
+        throw;
+      }
+
+      slot.release();
+      protection.release();
+      return;
+    }
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      queue_.push_back(slot.get());
+
+      if (!workers_.empty())
+      {
+        try
+        {
+          pending_.push_back(slot.get());
+        }
+        catch (...)
+        {
+          queue_.pop_back();
+          throw;
+        }
+      }
+
+      slot.release();
+      protection.release();
+    }
+
+    taskAvailable_.notify_one();
+  }
+
+
+  OrderedTasksPool::ITask* OrderedTasksPool::Dequeue()
+  {
+    Slot* slot = NULL;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (queue_.empty())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      }
+
+      slot = queue_.front();
+
+      while (IsConcurrent() &&
+             !slot->completed_)
+      {
+        taskCompleted_.wait(lock);
+      }
+
+      queue_.pop_front();
+    }
+
+    if (!IsConcurrent())
+    {
+      // No worker thread: Execute the task in the calling thread
+      Execute(*slot);
+    }
+
+    std::auto_ptr<ITask> task(slot->task_);
+    Orthanc::ErrorCode error = slot->error_;
+    delete slot;
+
+    if (error != Orthanc::ErrorCode_Success)
+    {
+      throw Orthanc::OrthancException(error);
+    }
+
+    return task.release();
+  }
+
+
+  size_t OrderedTasksPool::GetSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return queue_.size();
+  }
+}
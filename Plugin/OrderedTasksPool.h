@@ -0,0 +1,140 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <Core/Enumerations.h>
+
+#include <deque>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+namespace OrthancPlugins
+{
+  /**
+   * Pool of worker threads that executes a sequence of tasks
+   * concurrently, but that gives the tasks back to the caller in the
+   * order where they were pushed. If the pool has no thread, the
+   * tasks are executed by the caller, when they are dequeued. The
+   * threads are either owned by the pool, or shared with other pools.
+   **/
+  class OrderedTasksPool : public boost::noncopyable
+  {
+  public:
+    class ITask : public boost::noncopyable
+    {
+    public:
+      virtual ~ITask()
+      {
+      }
+
+      virtual void Execute() = 0;
+    };
+
+  private:
+    struct Slot;
+
+  public:
+    /**
+     * Worker threads that are shared by several pools, which bounds
+     * the number of threads across all the REST requests. The tasks
+     * of all the pools are started in the order of submission. The
+     * pools must be destroyed before their shared workers.
+     **/
+    class SharedWorkers : public boost::noncopyable
+    {
+    private:
+      typedef std::pair<OrderedTasksPool*, Slot*>  PendingTask;
+
+      boost::mutex                 mutex_;
+      boost::condition_variable    taskAvailable_;
+      bool                         done_;
+      std::deque<PendingTask>      pending_;
+      std::vector<boost::thread*>  workers_;
+
+      static void Worker(SharedWorkers* that);
+
+    public:
+      explicit SharedWorkers(unsigned int countThreads);
+
+      ~SharedWorkers();
+
+      void Push(OrderedTasksPool& pool,
+                Slot& slot);
+
+      // Forgets about the tasks of the pool that are not started
+      // yet, and returns their number
+      size_t Cancel(const OrderedTasksPool& pool);
+
+      unsigned int GetThreadsCount() const
+      {
+        return workers_.size();
+      }
+    };
+
+  private:
+    friend class SharedWorkers;
+
+    boost::mutex                 mutex_;
+    boost::condition_variable    taskAvailable_;
+    boost::condition_variable    taskCompleted_;
+    bool                         done_;
+    std::deque<Slot*>            pending_;   // Tasks that are not started yet
+    std::deque<Slot*>            queue_;     // All the tasks, in the order of submission
+    std::vector<boost::thread*>  workers_;
+    SharedWorkers*               shared_;
+    size_t                       sharedInFlight_;   // Tasks given to the shared workers, not completed yet
+
+    static void Execute(Slot& slot);
+
+    static void Worker(OrderedTasksPool* that);
+
+    void SignalSharedCompleted(Slot& slot);
+
+    bool IsConcurrent() const
+    {
+      return (shared_ != NULL || !workers_.empty());
+    }
+
+  public:
+    explicit OrderedTasksPool(unsigned int countThreads);
+
+    explicit OrderedTasksPool(SharedWorkers& shared);
+
+    ~OrderedTasksPool();
+
+    // Takes the ownership of the task
+    void Push(ITask* task);
+
+    // Waits for the completion of the oldest task that is still in
+    // the queue, and gives its ownership back to the caller. If the
+    // task has failed, its exception is rethrown.
+    ITask* Dequeue();
+
+    size_t GetSize();
+
+    unsigned int GetThreadsCount() const
+    {
+      return (shared_ == NULL ? workers_.size() : shared_->GetThreadsCount());
+    }
+  };
+}
@@ -28,6 +28,10 @@
 #include "WadoUri.h"
 #include "Configuration.h"
 #include "DicomWebServers.h"
+#include "DerivedTagsCache.h"
+#include "FrameCache.h"
+#include "HierarchyCache.h"
+#include "TransferJobs.h"
 
 #include <Plugins/Samples/Common/OrthancPluginCppWrapper.h>
 #include <Core/Toolbox.h>
@@ -36,6 +40,7 @@
 #include <gdcmDict.h>
 #include <gdcmDicts.h>
 #include <gdcmGlobal.h>
+#include <boost/thread.hpp>
 
 
 // Global state
@@ -163,6 +168,7 @@ void ListServerOperations(OrthancPluginRestOutput* output,
 
     Json::Value json = Json::arrayValue;
     json.append("get");
+    json.append("jobs");
     json.append("retrieve");
     json.append("stow");
 
@@ -172,6 +178,34 @@ void ListServerOperations(OrthancPluginRestOutput* output,
 }
 
 
+static OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeType,
+                                               OrthancPluginResourceType resourceType,
+                                               const char* resourceId)
+{
+  try
+  {
+    if (resourceId != NULL)
+    {
+      OrthancPlugins::DerivedTagsCache::GetInstance().SignalChange(changeType, resourceType, resourceId);
+      OrthancPlugins::HierarchyCache::GetInstance().SignalChange(changeType, resourceType, resourceId);
+      OrthancPlugins::FrameCache::GetInstance().SignalChange(changeType, resourceType, resourceId);
+    }
+
+    return OrthancPluginErrorCode_Success;
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    OrthancPlugins::Configuration::LogError("Exception in the change callback of the DICOMweb plugin: " +
+                                            std::string(e.What()));
+    return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+  }
+  catch (...)
+  {
+    return OrthancPluginErrorCode_Plugin;
+  }
+}
+
+
 static bool DisplayPerformanceWarning(OrthancPluginContext* context)
 {
   (void) DisplayPerformanceWarning;   // Disable warning about unused function
@@ -239,6 +273,42 @@ extern "C"
         OrthancPlugins::RegisterRestCallback<StowClient>(context, root + "servers/([^/]*)/stow", true);
         OrthancPlugins::RegisterRestCallback<GetFromServer>(context, root + "servers/([^/]*)/get", true);
         OrthancPlugins::RegisterRestCallback<RetrieveFromServer>(context, root + "servers/([^/]*)/retrieve", true);
+        OrthancPlugins::RegisterRestCallback<ListServerJobs>(context, root + "servers/([^/]*)/jobs", true);
+        OrthancPlugins::RegisterRestCallback<GetServerJob>(context, root + "servers/([^/]*)/jobs/([^/]*)", true);
+        OrthancPlugins::RegisterRestCallback<CancelServerJob>(context, root + "servers/([^/]*)/jobs/([^/]*)/cancel", true);
+        OrthancPlugins::RegisterRestCallback<GetServerJobAnswer>(context, root + "servers/([^/]*)/jobs/([^/]*)/answer", true);
+
+        // Background threads running the asynchronous requests to the
+        // DICOMweb client, number of finished jobs that are kept, and
+        // total size of their downloaded answers (in MB)
+        unsigned int transferThreads = OrthancPlugins::Configuration::GetUnsignedIntegerValue("TransferJobsThreads", 2);
+        if (transferThreads == 0)
+        {
+          transferThreads = 1;
+        }
+
+        OrthancPlugins::TransferJobs::GetInstance().Start(
+          transferThreads, OrthancPlugins::Configuration::GetUnsignedIntegerValue("TransferJobsHistory", 100),
+          static_cast<size_t>(OrthancPlugins::Configuration::GetUnsignedIntegerValue("TransferJobsMaxAnswersSize", 100)) * 1024 * 1024);
+
+        // Number of studies and series whose derived attributes are cached
+        OrthancPlugins::DerivedTagsCache::GetInstance().SetMaxSize(
+          OrthancPlugins::Configuration::GetUnsignedIntegerValue("DerivedTagsCacheSize", 10000));
+
+        // Number of series and instances whose location in the DICOM hierarchy is cached
+        OrthancPlugins::HierarchyCache::GetInstance().SetMaxSize(
+          OrthancPlugins::Configuration::GetUnsignedIntegerValue("HierarchyCacheSize", 100000));
+
+        // Threads transcoding the frames of RetrieveFrames, shared by all the requests
+        InitializeTranscodingThreads(OrthancPlugins::Configuration::GetUnsignedIntegerValue(
+          "TranscodingThreads", boost::thread::hardware_concurrency()));
+
+        // Size of the cache of the transcoded frames (in MB)
+        OrthancPlugins::FrameCache::GetInstance().SetMaxSize(
+          static_cast<size_t>(OrthancPlugins::Configuration::GetUnsignedIntegerValue("FramesCacheSize", 128)) * 1024 * 1024);
+
+        // Monitor the changes, in order to invalidate the caches
+        OrthancPluginRegisterOnChangeCallback(context, OnChangeCallback);
       }
       else
       {
@@ -276,6 +346,8 @@ extern "C"
 
   ORTHANC_PLUGINS_API void OrthancPluginFinalize()
   {
+    OrthancPlugins::TransferJobs::GetInstance().Stop();
+    FinalizeTranscodingThreads();
   }
 
 
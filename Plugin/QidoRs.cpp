@@ -26,11 +26,16 @@
 #include "Dicom.h"
 #include "DicomResults.h"
 #include "Configuration.h"
+#include "DerivedTagsCache.h"
+#include "OrderedTasksPool.h"
+#include "Semaphore.h"
 
 #include <Core/Toolbox.h>
 
 #include <gdcmTag.h>
+#include <algorithm>
 #include <list>
+#include <set>
 #include <stdexcept>
 #include <boost/lexical_cast.hpp>
 #include <gdcmDict.h>
@@ -270,7 +275,7 @@ namespace
           throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
       }
 
-      result["Expand"] = false;
+      result["Expand"] = true;  // Needed by "ResolveMatchedResources()"
       result["CaseSensitive"] = OrthancPlugins::Configuration::GetBooleanValue("QidoCaseSensitive", true);
       result["Query"] = Json::objectValue;
       result["Limit"] = limit_;
@@ -293,6 +298,37 @@ namespace
     }
 
 
+    static void SetStudyDerivedTags(Filters& target,
+                                    size_t countSeries,
+                                    size_t countInstances,
+                                    const std::set<std::string>& modalities)
+    {
+      std::string s;
+      for (std::set<std::string>::const_iterator 
+             it = modalities.begin(); it != modalities.end(); ++it)
+      {
+        if (!s.empty())
+        {
+          s += "\\";
+        }
+
+        s += *it;
+      }
+
+      target[gdcm::Tag(0x0008, 0x0061)] = s;  // Modalities in Study
+      target[gdcm::Tag(0x0020, 0x1206)] = boost::lexical_cast<std::string>(countSeries);  // Number of Study Related Series
+      target[gdcm::Tag(0x0020, 0x1208)] = boost::lexical_cast<std::string>(countInstances);  // Number of Study Related Instances
+    }
+
+
+    static void SetSeriesDerivedTags(Filters& target,
+                                     size_t countInstances)
+    {
+      // Number of Series Related Instances
+      target[gdcm::Tag(0x0020, 0x1209)] = boost::lexical_cast<std::string>(countInstances);
+    }
+
+
     void ComputeDerivedTags(Filters& target,
                             QueryLevel level,
                             const std::string& resource) const
@@ -309,12 +345,6 @@ namespace
           if (OrthancPlugins::RestApiGet(series, context, "/studies/" + resource + "/series?expand", false) &&
               OrthancPlugins::RestApiGet(instances, context, "/studies/" + resource + "/instances", false))
           {
-            // Number of Study Related Series
-            target[gdcm::Tag(0x0020, 0x1206)] = boost::lexical_cast<std::string>(series.size());
-
-            // Number of Study Related Instances
-            target[gdcm::Tag(0x0020, 0x1208)] = boost::lexical_cast<std::string>(instances.size());
-
             // Collect the Modality of all the child series
             std::set<std::string> modalities;
             for (Json::Value::ArrayIndex i = 0; i < series.size(); i++)
@@ -326,25 +356,11 @@ namespace
               }
             }
 
-            std::string s;
-            for (std::set<std::string>::const_iterator 
-                   it = modalities.begin(); it != modalities.end(); ++it)
-            {
-              if (!s.empty())
-              {
-                s += "\\";
-              }
-
-              s += *it;
-            }
-
-            target[gdcm::Tag(0x0008, 0x0061)] = s;  // Modalities in Study
+            SetStudyDerivedTags(target, series.size(), instances.size(), modalities);
           }
           else
           {
-            target[gdcm::Tag(0x0008, 0x0061)] = "";   // Modalities in Study
-            target[gdcm::Tag(0x0020, 0x1206)] = "0";  // Number of Study Related Series
-            target[gdcm::Tag(0x0020, 0x1208)] = "0";  // Number of Study Related Instances
+            SetStudyDerivedTags(target, 0, 0, std::set<std::string>());
           }
 
           break;
@@ -355,12 +371,11 @@ namespace
           Json::Value instances;
           if (OrthancPlugins::RestApiGet(instances, context, "/series/" + resource + "/instances", false))
           {
-            // Number of Series Related Instances
-            target[gdcm::Tag(0x0020, 0x1209)] = boost::lexical_cast<std::string>(instances.size());
+            SetSeriesDerivedTags(target, instances.size());
           }
           else
           {
-            target[gdcm::Tag(0x0020, 0x1209)] = "0";  // Number of Series Related Instances
+            SetSeriesDerivedTags(target, 0);
           }
 
           break;
@@ -511,6 +526,490 @@ namespace
 
 
 
+namespace
+{
+  // Resource matching a QIDO-RS query, together with one of its child
+  // instances (whose tags are used to fill the answer) and with its
+  // derived attributes. If "resolved_" is false, the child instance
+  // and the derived attributes must still be looked up one by one.
+  struct MatchedResource
+  {
+    std::string             resource_;
+    std::string             instance_;
+    ModuleMatcher::Filters  derivedTags_;
+    bool                    resolved_;
+
+    MatchedResource() :
+      resolved_(true)
+    {
+    }
+  };
+
+  typedef std::list<MatchedResource>  MatchedResources;
+
+
+  // Summary of the child series of one study
+  struct StudyChildren
+  {
+    size_t                 countSeries_;
+    size_t                 countInstances_;
+    std::set<std::string>  modalities_;
+    std::string            instance_;
+
+    StudyChildren() :
+      countSeries_(0),
+      countInstances_(0)
+    {
+    }
+  };
+
+  typedef std::map<std::string, StudyChildren>  StudiesChildren;
+}
+
+
+// Maximum number of StudyInstanceUID that are looked up at once by
+// "LookupSeriesOfStudies()"
+static const size_t MAX_STUDIES_PER_LOOKUP = 100;
+
+
+static bool GetResourceId(std::string& id,
+                          const Json::Value& resource)
+{
+  if (resource.type() == Json::stringValue)
+  {
+    // Not expanded
+    id = resource.asString();
+    return true;
+  }
+  else if (resource.type() == Json::objectValue &&
+           resource.isMember("ID") &&
+           resource["ID"].type() == Json::stringValue)
+  {
+    id = resource["ID"].asString();
+    return true;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+
+static bool LookupChildInstance(std::string& instance,
+                                const std::string& root,
+                                const std::string& resource)
+{
+  Json::Value tmp;
+  if (OrthancPlugins::RestApiGet(tmp, OrthancPlugins::Configuration::GetContext(), 
+                                 root + resource + "/instances", false) &&
+      tmp.type() == Json::arrayValue &&
+      tmp.size() > 0)
+  {
+    instance = tmp[0]["ID"].asString();
+    return true;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+
+static void LookupSeriesOfStudies(StudiesChildren& children,
+                                  const std::vector<std::string>& studyInstanceUids,
+                                  size_t start,
+                                  size_t end)
+{
+  // Use one single call to "/tools/find" to list the child series of
+  // a whole range of studies (list matching over the StudyInstanceUID)
+  std::string uids;
+  for (size_t i = start; i < end; i++)
+  {
+    if (i != start)
+    {
+      uids += "\\";
+    }
+
+    uids += studyInstanceUids[i];
+  }
+
+  Json::Value find = Json::objectValue;
+  find["Level"] = "Series";
+  find["Expand"] = true;
+  find["CaseSensitive"] = true;
+  find["Query"] = Json::objectValue;
+  find["Query"][FormatOrthancTag(OrthancPlugins::DICOM_TAG_STUDY_INSTANCE_UID)] = uids;
+
+  Json::FastWriter writer;
+  std::string body = writer.write(find);
+
+  Json::Value series;
+  if (!OrthancPlugins::RestApiPost(series, OrthancPlugins::Configuration::GetContext(), "/tools/find", body, false) ||
+      series.type() != Json::arrayValue)
+  {
+    // The studies that are not filled will be resolved one by one
+    return;
+  }
+
+  for (Json::Value::ArrayIndex i = 0; i < series.size(); i++)
+  {
+    const Json::Value& s = series[i];
+
+    if (s.type() != Json::objectValue ||
+        !s.isMember("ParentStudy") ||
+        !s.isMember("Instances") ||
+        s["ParentStudy"].type() != Json::stringValue ||
+        s["Instances"].type() != Json::arrayValue)
+    {
+      continue;
+    }
+
+    StudiesChildren::iterator study = children.find(s["ParentStudy"].asString());
+    if (study == children.end())
+    {
+      // This series belongs to another study with the same UID (in another patient)
+      continue;
+    }
+
+    study->second.countSeries_ ++;
+    study->second.countInstances_ += s["Instances"].size();
+
+    if (s.isMember("MainDicomTags") &&
+        s["MainDicomTags"].isMember("Modality"))
+    {
+      study->second.modalities_.insert(s["MainDicomTags"]["Modality"].asString());
+    }
+
+    if (study->second.instance_.empty() &&
+        s["Instances"].size() > 0)
+    {
+      study->second.instance_ = s["Instances"][0].asString();
+    }
+  }
+}
+
+
+static void ResolveStudies(MatchedResources& target,
+                           unsigned int revision,
+                           const Json::Value& studies)
+{
+  OrthancPlugins::DerivedTagsCache& cache = OrthancPlugins::DerivedTagsCache::GetInstance();
+
+  std::vector<std::string> ids, uids;
+  StudiesChildren children;
+  std::map<std::string, MatchedResource> cached;
+
+  for (Json::Value::ArrayIndex i = 0; i < studies.size(); i++)
+  {
+    std::string id;
+    if (GetResourceId(id, studies[i]))
+    {
+      ids.push_back(id);
+
+      MatchedResource item;
+      if (cache.Lookup(item.instance_, item.derivedTags_, id))
+      {
+        item.resource_ = id;
+        cached[id] = item;
+        continue;
+      }
+
+      children[id] = StudyChildren();
+
+      if (studies[i].type() == Json::objectValue &&
+          studies[i].isMember("MainDicomTags") &&
+          studies[i]["MainDicomTags"].isMember("StudyInstanceUID"))
+      {
+        uids.push_back(studies[i]["MainDicomTags"]["StudyInstanceUID"].asString());
+      }
+    }
+  }
+
+  for (size_t start = 0; start < uids.size(); start += MAX_STUDIES_PER_LOOKUP)
+  {
+    LookupSeriesOfStudies(children, uids, start, std::min(start + MAX_STUDIES_PER_LOOKUP, uids.size()));
+  }
+
+  for (size_t i = 0; i < ids.size(); i++)
+  {
+    std::map<std::string, MatchedResource>::const_iterator found = cached.find(ids[i]);
+    if (found != cached.end())
+    {
+      target.push_back(found->second);
+      continue;
+    }
+
+    const StudyChildren& study = children[ids[i]];
+
+    MatchedResource item;
+    item.resource_ = ids[i];
+
+    if (study.countSeries_ > 0 &&
+        !study.instance_.empty())
+    {
+      item.instance_ = study.instance_;
+      ModuleMatcher::SetStudyDerivedTags(item.derivedTags_, study.countSeries_,
+                                         study.countInstances_, study.modalities_);
+      cache.Store(revision, item.resource_, item.instance_, item.derivedTags_);
+    }
+    else
+    {
+      // Fallback to REST calls for this study, that are issued by the
+      // worker threads of "ApplyMatcher()"
+      item.resolved_ = false;
+    }
+
+    target.push_back(item);
+  }
+}
+
+
+static void ResolveSeries(MatchedResources& target,
+                          const Json::Value& series)
+{
+  for (Json::Value::ArrayIndex i = 0; i < series.size(); i++)
+  {
+    const Json::Value& s = series[i];
+
+    MatchedResource item;
+    if (!GetResourceId(item.resource_, s))
+    {
+      continue;
+    }
+
+    if (s.type() == Json::objectValue &&
+        s.isMember("Instances") &&
+        s["Instances"].type() == Json::arrayValue &&
+        s["Instances"].size() > 0)
+    {
+      // The expanded series directly lists its child instances
+      item.instance_ = s["Instances"][0].asString();
+      ModuleMatcher::SetSeriesDerivedTags(item.derivedTags_, s["Instances"].size());
+    }
+    else
+    {
+      item.resolved_ = false;
+    }
+
+    target.push_back(item);
+  }
+}
+
+
+static void ResolveMatchedResources(MatchedResources& target,
+                                    unsigned int revision,
+                                    QueryLevel level,
+                                    const Json::Value& resources)
+{
+  target.clear();
+
+  switch (level)
+  {
+    case QueryLevel_Study:
+      ResolveStudies(target, revision, resources);
+      break;
+
+    case QueryLevel_Series:
+      ResolveSeries(target, resources);
+      break;
+
+    case QueryLevel_Instance:
+      for (Json::Value::ArrayIndex i = 0; i < resources.size(); i++)
+      {
+        MatchedResource item;
+        if (GetResourceId(item.resource_, resources[i]))
+        {
+          item.instance_ = item.resource_;
+          target.push_back(item);
+        }
+      }
+      break;
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+}
+
+
+static unsigned int GetQidoThreads()
+{
+  return OrthancPlugins::Configuration::GetUnsignedIntegerValue("QidoThreads", 4);
+}
+
+
+static OrthancPlugins::Semaphore& GetQidoSemaphore()
+{
+  // "QidoThreads" bounds the number of matched resources that are
+  // formatted concurrently, across all the QIDO-RS requests
+  static OrthancPlugins::Semaphore semaphore(std::max(1u, GetQidoThreads()));
+  return semaphore;
+}
+
+
+namespace
+{
+  // Retrieval of the tags of one matched resource, and conversion to
+  // the fields of the QIDO-RS answer
+  class ExtractFieldsTask : public OrthancPlugins::OrderedTasksPool::ITask
+  {
+  private:
+    const ModuleMatcher&  matcher_;
+    QueryLevel            level_;
+    unsigned int          revision_;
+    const std::string&    wadoBase_;
+    MatchedResource       resource_;
+    bool                  found_;
+    Json::Value           result_;
+    std::string           wadoUrl_;
+
+    bool Resolve()
+    {
+      if (resource_.resolved_)
+      {
+        return true;
+      }
+
+      std::string root;
+      switch (level_)
+      {
+        case QueryLevel_Study:
+          root = "/studies/";
+          break;
+
+        case QueryLevel_Series:
+          root = "/series/";
+          break;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+
+      OrthancPlugins::DerivedTagsCache& cache = OrthancPlugins::DerivedTagsCache::GetInstance();
+
+      if (cache.Lookup(resource_.instance_, resource_.derivedTags_, resource_.resource_))
+      {
+        return true;
+      }
+      else if (LookupChildInstance(resource_.instance_, root, resource_.resource_))
+      {
+        matcher_.ComputeDerivedTags(resource_.derivedTags_, level_, resource_.resource_);
+        cache.Store(revision_, resource_.resource_, resource_.instance_, resource_.derivedTags_);
+        return true;
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+  public:
+    ExtractFieldsTask(const ModuleMatcher& matcher,
+                      QueryLevel level,
+                      unsigned int revision,
+                      const std::string& wadoBase,
+                      const MatchedResource& resource) :
+      matcher_(matcher),
+      level_(level),
+      revision_(revision),
+      wadoBase_(wadoBase),
+      resource_(resource),
+      found_(false)
+    {
+    }
+
+    virtual void Execute()
+    {
+      OrthancPlugins::Semaphore::Locker locker(GetQidoSemaphore());
+
+      Json::Value tags;
+      if (!Resolve() ||
+          !OrthancPlugins::RestApiGet(tags, OrthancPlugins::Configuration::GetContext(),
+                                      "/instances/" + resource_.instance_ + "/tags", false))
+      {
+        return;
+      }
+
+      wadoUrl_ = OrthancPlugins::Configuration::GetWadoUrl(
+        wadoBase_, 
+        GetOrthancTag(tags, OrthancPlugins::DICOM_TAG_STUDY_INSTANCE_UID, ""),
+        GetOrthancTag(tags, OrthancPlugins::DICOM_TAG_SERIES_INSTANCE_UID, ""),
+        GetOrthancTag(tags, OrthancPlugins::DICOM_TAG_SOP_INSTANCE_UID, ""));
+
+      matcher_.ExtractFields(result_, tags, wadoBase_, level_);
+
+      // Inject the derived tags
+      for (ModuleMatcher::Filters::const_iterator
+             tag = resource_.derivedTags_.begin(); tag != resource_.derivedTags_.end(); ++tag)
+      {
+        Json::Value tmp = Json::objectValue;
+        tmp["Name"] = OrthancPlugins::GetKeyword(*dictionary_, tag->first);
+        tmp["Type"] = "String";
+        tmp["Value"] = tag->second;
+        result_[FormatOrthancTag(tag->first)] = tmp;
+      }
+
+      found_ = true;
+    }
+
+    bool IsFound() const
+    {
+      return found_;
+    }
+
+    const Json::Value& GetResult() const
+    {
+      return result_;
+    }
+
+    const std::string& GetWadoUrl() const
+    {
+      return wadoUrl_;
+    }
+  };
+}
+
+
+static OrthancPlugins::DicomResults::Format GetResultsFormat(const OrthancPluginHttpRequest* request)
+{
+  std::string accept;
+  if (OrthancPlugins::LookupHttpHeader(accept, request, "accept"))
+  {
+    std::string application;
+    std::map<std::string, std::string> attributes;
+    OrthancPlugins::ParseContentType(application, attributes, accept);
+
+    std::map<std::string, std::string>::const_iterator type = attributes.find("type");
+
+    if (application == "multipart/related" &&
+        type != attributes.end())
+    {
+      std::string s = type->second;
+      Orthanc::Toolbox::ToLowerCase(s);
+
+      if (s == "application/dicom+json")
+      {
+        // The client accepts one multipart item per match, which
+        // allows to stream the answers
+        return OrthancPlugins::DicomResults::Format_JsonMultipart;
+      }
+      else if (s == "application/dicom+xml")
+      {
+        return OrthancPlugins::DicomResults::Format_Xml;
+      }
+    }
+  }
+
+  if (IsXmlExpected(request))
+  {
+    return OrthancPlugins::DicomResults::Format_Xml;
+  }
+  else
+  {
+    return OrthancPlugins::DicomResults::Format_Json;
+  }
+}
+
+
 static void ApplyMatcher(OrthancPluginRestOutput* output,
                          const OrthancPluginHttpRequest* request,
                          const ModuleMatcher& matcher,
@@ -518,6 +1017,10 @@ static void ApplyMatcher(OrthancPluginRestOutput* output,
 {
   OrthancPluginContext* context = OrthancPlugins::Configuration::GetContext();
 
+  // Read the revision of the cache of the derived tags before looking
+  // for the resources, so that no outdated value gets cached
+  const unsigned int revision = OrthancPlugins::DerivedTagsCache::GetInstance().GetRevision();
+
   Json::Value find;
   matcher.ConvertToOrthanc(find, level);
 
@@ -531,50 +1034,25 @@ static void ApplyMatcher(OrthancPluginRestOutput* output,
     throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
   }
 
-  typedef std::list< std::pair<std::string, std::string> > ResourcesAndInstances;
+  // Batch resolution of the child instances and of the derived tags,
+  // instead of issuing several REST calls for each matched resource
+  MatchedResources matched;
+  ResolveMatchedResources(matched, revision, level, resources);
 
-  ResourcesAndInstances resourcesAndInstances;
-  std::string root = (level == QueryLevel_Study ? "/studies/" : "/series/");
-    
-  for (Json::Value::ArrayIndex i = 0; i < resources.size(); i++)
-  {
-    const std::string resource = resources[i].asString();
-
-    if (level == QueryLevel_Study ||
-        level == QueryLevel_Series)
-    {
-      // Find one child instance of this resource
-      Json::Value tmp;
-      if (OrthancPlugins::RestApiGet(tmp, context, root + resource + "/instances", false) &&
-          tmp.type() == Json::arrayValue &&
-          tmp.size() > 0)
-      {
-        resourcesAndInstances.push_back(std::make_pair(resource, tmp[0]["ID"].asString()));
-      }
-    }
-    else
-    {
-      resourcesAndInstances.push_back(std::make_pair(resource, resource));
-    }
-  }
-  
   std::string wadoBase = OrthancPlugins::Configuration::GetBaseUrl(request);
 
-  OrthancPlugins::DicomResults results(context, output, wadoBase, *dictionary_, IsXmlExpected(request), true);
+  OrthancPlugins::DicomResults results(context, output, wadoBase, *dictionary_, GetResultsFormat(request), true);
 
 #if 0
   // Implementation up to version 0.2 of the plugin. Each instance is
   // downloaded and decoded using GDCM, which slows down things
   // wrt. the new implementation below that directly uses the Orthanc
   // pre-computed JSON summary.
-  for (ResourcesAndInstances::const_iterator
-         it = resourcesAndInstances.begin(); it != resourcesAndInstances.end(); ++it)
+  for (MatchedResources::const_iterator
+         it = matched.begin(); it != matched.end(); ++it)
   {
-    ModuleMatcher::Filters derivedTags;
-    matcher.ComputeDerivedTags(derivedTags, level, it->first);
-
     std::string file;
-    if (OrthancPlugins::RestApiGetString(file, context, "/instances/" + it->second + "/file", false))
+    if (OrthancPlugins::RestApiGetString(file, context, "/instances/" + it->instance_ + "/file", false))
     {
       OrthancPlugins::ParsedDicomFile dicom(file);
 
@@ -582,11 +1060,8 @@ static void ApplyMatcher(OrthancPluginRestOutput* output,
       matcher.ExtractFields(*result, dicom, wadoBase, level);
 
       // Inject the derived tags
-      ModuleMatcher::Filters derivedTags;
-      matcher.ComputeDerivedTags(derivedTags, level, it->first);
-
       for (ModuleMatcher::Filters::const_iterator
-             tag = derivedTags.begin(); tag != derivedTags.end(); ++tag)
+             tag = it->derivedTags_.begin(); tag != it->derivedTags_.end(); ++tag)
       {
         gdcm::DataElement element(tag->first);
         element.SetByteValue(tag->second.c_str(), tag->second.size());
@@ -598,37 +1073,37 @@ static void ApplyMatcher(OrthancPluginRestOutput* output,
   }
 
 #else
-  // Fix of issue #13
-  for (ResourcesAndInstances::const_iterator
-         it = resourcesAndInstances.begin(); it != resourcesAndInstances.end(); ++it)
+  // Fix of issue #13. The tags of the matched resources are retrieved
+  // and formatted by a pool of threads, but the answers are added in
+  // the order of the matches. The concurrent requests share the
+  // "QidoThreads" slots of the global semaphore.
+  unsigned int countThreads = GetQidoThreads();
+  if (countThreads > matched.size())
   {
-    Json::Value tags;
-    if (OrthancPlugins::RestApiGet(tags, context, "/instances/" + it->second + "/tags", false))
-    {
-      std::string wadoUrl = OrthancPlugins::Configuration::GetWadoUrl(
-        wadoBase, 
-        GetOrthancTag(tags, OrthancPlugins::DICOM_TAG_STUDY_INSTANCE_UID, ""),
-        GetOrthancTag(tags, OrthancPlugins::DICOM_TAG_SERIES_INSTANCE_UID, ""),
-        GetOrthancTag(tags, OrthancPlugins::DICOM_TAG_SOP_INSTANCE_UID, ""));
+    countThreads = matched.size();
+  }
 
-      Json::Value result;
-      matcher.ExtractFields(result, tags, wadoBase, level);
+  if (countThreads == 1)
+  {
+    countThreads = 0;  // No need to start a thread, use the current one
+  }
 
-      // Inject the derived tags
-      ModuleMatcher::Filters derivedTags;
-      matcher.ComputeDerivedTags(derivedTags, level, it->first);
+  OrthancPlugins::OrderedTasksPool pool(countThreads);
 
-      for (ModuleMatcher::Filters::const_iterator
-             tag = derivedTags.begin(); tag != derivedTags.end(); ++tag)
-      {
-        Json::Value tmp = Json::objectValue;
-        tmp["Name"] = OrthancPlugins::GetKeyword(*dictionary_, tag->first);
-        tmp["Type"] = "String";
-        tmp["Value"] = tag->second;
-        result[FormatOrthancTag(tag->first)] = tmp;
-      }
+  for (MatchedResources::const_iterator
+         it = matched.begin(); it != matched.end(); ++it)
+  {
+    pool.Push(new ExtractFieldsTask(matcher, level, revision, wadoBase, *it));
+  }
+
+  while (pool.GetSize() > 0)
+  {
+    std::auto_ptr<OrthancPlugins::OrderedTasksPool::ITask> task(pool.Dequeue());
 
-      results.AddFromOrthanc(result, wadoUrl);
+    const ExtractFieldsTask& extracted = dynamic_cast<const ExtractFieldsTask&>(*task);
+    if (extracted.IsFound())
+    {
+      results.AddFromOrthanc(extracted.GetResult(), extracted.GetWadoUrl());
     }
   }
 #endif
@@ -0,0 +1,771 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "RawDicomParser.h"
+
+#include "Dicom.h"
+
+#include <string.h>
+
+namespace OrthancPlugins
+{
+  static const uint32_t UNDEFINED_LENGTH = 0xffffffffu;
+  static const uint16_t GROUP_ITEMS = 0xfffe;
+  static const uint16_t ELEMENT_ITEM = 0xe000;
+  static const uint16_t ELEMENT_ITEM_DELIMITATION = 0xe00d;
+  static const uint16_t ELEMENT_SEQUENCE_DELIMITATION = 0xe0dd;
+
+  // Protection against stack overflows in the case of corrupted files
+  static const unsigned int MAX_DEPTH = 64;
+
+
+  static uint16_t ReadUint16(const uint8_t* p,
+                             bool bigEndian)
+  {
+    if (bigEndian)
+    {
+      return (static_cast<uint16_t>(p[0]) << 8) | static_cast<uint16_t>(p[1]);
+    }
+    else
+    {
+      return static_cast<uint16_t>(p[0]) | (static_cast<uint16_t>(p[1]) << 8);
+    }
+  }
+
+
+  static uint32_t ReadUint32(const uint8_t* p,
+                             bool bigEndian)
+  {
+    if (bigEndian)
+    {
+      return ((static_cast<uint32_t>(ReadUint16(p, true)) << 16) |
+              static_cast<uint32_t>(ReadUint16(p + 2, true)));
+    }
+    else
+    {
+      return (static_cast<uint32_t>(ReadUint16(p, false)) |
+              (static_cast<uint32_t>(ReadUint16(p + 2, false)) << 16));
+    }
+  }
+
+
+  static bool HasLongLength(const char* vr)
+  {
+    // Value representations whose explicit encoding has 2 reserved
+    // bytes, followed by a 32-bit length (PS3.5 Section 7.1.2)
+    static const char* const LONG_VR[] = {
+      "OB", "OD", "OF", "OL", "OV", "OW", "SQ", "SV", "UC", "UN", "UR", "UT", "UV"
+    };
+
+    for (size_t i = 0; i < sizeof(LONG_VR) / sizeof(LONG_VR[0]); i++)
+    {
+      if (vr[0] == LONG_VR[i][0] &&
+          vr[1] == LONG_VR[i][1])
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  RawDicomParser::RawDicomParser(const void* dicom,
+                                 size_t size) :
+    dicom_(reinterpret_cast<const uint8_t*>(dicom)),
+    size_(size),
+    supported_(false),
+    datasetStart_(0),
+    transferSyntax_(NULL),
+    transferSyntaxSize_(0)
+  {
+    encoding_.explicit_ = true;
+    encoding_.bigEndian_ = false;
+
+    supported_ = ReadMetaHeader();
+  }
+
+
+  bool RawDicomParser::IsTransferSyntax(const char* uid) const
+  {
+    return (transferSyntax_ != NULL &&
+            strlen(uid) == transferSyntaxSize_ &&
+            memcmp(uid, transferSyntax_, transferSyntaxSize_) == 0);
+  }
+
+
+  std::string RawDicomParser::GetTransferSyntax() const
+  {
+    if (transferSyntax_ == NULL)
+    {
+      return "";
+    }
+    else
+    {
+      return std::string(transferSyntax_, transferSyntaxSize_);
+    }
+  }
+
+
+  bool RawDicomParser::ReadMetaHeader()
+  {
+    // 128-byte preamble, followed by the "DICM" prefix
+    if (dicom_ == NULL ||
+        size_ < 132 ||
+        memcmp(dicom_ + 128, "DICM", 4) != 0)
+    {
+      return false;
+    }
+
+    // The meta header is always encoded as explicit VR little endian
+    Encoding meta;
+    meta.explicit_ = true;
+    meta.bigEndian_ = false;
+
+    size_t position = 132;
+    bool hasTransferSyntax = false;
+
+    for (;;)
+    {
+      if (position + 2 > size_ ||
+          ReadUint16(dicom_ + position, false) != 0x0002)
+      {
+        break;  // End of the meta header
+      }
+
+      ElementHeader header;
+      if (!ReadElementHeader(header, position, size_, meta) ||
+          header.length_ == UNDEFINED_LENGTH ||
+          header.length_ > size_ - position - header.headerSize_)
+      {
+        return false;
+      }
+
+      if (header.element_ == 0x0010)
+      {
+        // Transfer Syntax UID, whose padding is removed
+        transferSyntax_ = reinterpret_cast<const char*>(dicom_ + position + header.headerSize_);
+        transferSyntaxSize_ = header.length_;
+
+        while (transferSyntaxSize_ > 0 &&
+               (transferSyntax_[transferSyntaxSize_ - 1] == '\0' ||
+                transferSyntax_[transferSyntaxSize_ - 1] == ' '))
+        {
+          transferSyntaxSize_--;
+        }
+
+        hasTransferSyntax = true;
+      }
+
+      position += header.headerSize_ + header.length_;
+    }
+
+    datasetStart_ = position;
+
+    if (!hasTransferSyntax ||
+        IsTransferSyntax("1.2.840.10008.1.2.1.99"))  // Deflated explicit VR little endian
+    {
+      return false;
+    }
+    else if (IsTransferSyntax("1.2.840.10008.1.2"))
+    {
+      encoding_.explicit_ = false;   // Implicit VR little endian
+    }
+    else if (IsTransferSyntax("1.2.840.10008.1.2.2"))
+    {
+      encoding_.bigEndian_ = true;   // Explicit VR big endian
+    }
+
+    // All the other transfer syntaxes are explicit VR little endian
+    return true;
+  }
+
+
+  bool RawDicomParser::ReadElementHeader(ElementHeader& header,
+                                         size_t position,
+                                         size_t end,
+                                         const Encoding& encoding) const
+  {
+    if (position > end ||
+        end - position < 8)
+    {
+      return false;
+    }
+
+    const uint8_t* p = dicom_ + position;
+
+    header.group_ = ReadUint16(p, encoding.bigEndian_);
+    header.element_ = ReadUint16(p + 2, encoding.bigEndian_);
+
+    if (header.group_ == GROUP_ITEMS ||
+        !encoding.explicit_)
+    {
+      // Items, delimiters and implicit VR have no VR and a 32-bit length
+      header.hasVR_ = false;
+      header.length_ = ReadUint32(p + 4, encoding.bigEndian_);
+      header.headerSize_ = 8;
+      return true;
+    }
+
+    header.hasVR_ = true;
+    header.vr_[0] = static_cast<char>(p[4]);
+    header.vr_[1] = static_cast<char>(p[5]);
+
+    if (header.vr_[0] < 'A' || header.vr_[0] > 'Z' ||
+        header.vr_[1] < 'A' || header.vr_[1] > 'Z')
+    {
+      return false;
+    }
+
+    if (HasLongLength(header.vr_))
+    {
+      if (end - position < 12)
+      {
+        return false;
+      }
+
+      header.length_ = ReadUint32(p + 8, encoding.bigEndian_);
+      header.headerSize_ = 12;
+    }
+    else
+    {
+      header.length_ = ReadUint16(p + 6, encoding.bigEndian_);
+      header.headerSize_ = 8;
+    }
+
+    return true;
+  }
+
+
+  bool RawDicomParser::SkipElement(size_t& position,
+                                   size_t end,
+                                   const Encoding& encoding,
+                                   unsigned int depth) const
+  {
+    ElementHeader header;
+    if (!ReadElementHeader(header, position, end, encoding))
+    {
+      return false;
+    }
+
+    if (header.length_ != UNDEFINED_LENGTH)
+    {
+      if (header.length_ > end - position - header.headerSize_)
+      {
+        return false;
+      }
+
+      position += header.headerSize_ + header.length_;
+      return true;
+    }
+
+    // Undefined length: Sequence, encapsulated pixel data, or UN
+    // element whose content is encoded as implicit VR little endian
+    Encoding nested = encoding;
+    if (header.hasVR_ &&
+        header.vr_[0] == 'U' &&
+        header.vr_[1] == 'N')
+    {
+      nested.explicit_ = false;
+      nested.bigEndian_ = false;
+    }
+
+    position += header.headerSize_;
+    return SkipSequence(position, end, nested, depth + 1);
+  }
+
+
+  bool RawDicomParser::SkipSequence(size_t& position,
+                                    size_t end,
+                                    const Encoding& encoding,
+                                    unsigned int depth) const
+  {
+    if (depth > MAX_DEPTH)
+    {
+      return false;
+    }
+
+    for (;;)
+    {
+      ElementHeader header;
+      if (!ReadElementHeader(header, position, end, encoding) ||
+          header.group_ != GROUP_ITEMS)
+      {
+        return false;
+      }
+
+      if (header.element_ == ELEMENT_SEQUENCE_DELIMITATION)
+      {
+        position += header.headerSize_;
+        return true;
+      }
+      else if (header.element_ != ELEMENT_ITEM)
+      {
+        return false;
+      }
+      else if (header.length_ == UNDEFINED_LENGTH)
+      {
+        position += header.headerSize_;
+        if (!SkipItem(position, end, encoding, depth))
+        {
+          return false;
+        }
+      }
+      else if (header.length_ > end - position - header.headerSize_)
+      {
+        return false;
+      }
+      else
+      {
+        position += header.headerSize_ + header.length_;
+      }
+    }
+  }
+
+
+  bool RawDicomParser::SkipItem(size_t& position,
+                                size_t end,
+                                const Encoding& encoding,
+                                unsigned int depth) const
+  {
+    // Skips the elements of an item of undefined length, up to its
+    // delimitation item
+    for (;;)
+    {
+      ElementHeader header;
+      if (!ReadElementHeader(header, position, end, encoding))
+      {
+        return false;
+      }
+
+      if (header.group_ == GROUP_ITEMS &&
+          header.element_ == ELEMENT_ITEM_DELIMITATION)
+      {
+        position += header.headerSize_;
+        return true;
+      }
+
+      if (!SkipElement(position, end, encoding, depth))
+      {
+        return false;
+      }
+    }
+  }
+
+
+  RawDicomParser::Status RawDicomParser::LookupValue(const char*& content,
+                                                     size_t& size,
+                                                     const std::vector<gdcm::Tag>& tags,
+                                                     const std::vector<unsigned int>& items) const
+  {
+    content = NULL;
+    size = 0;
+
+    if (!supported_ ||
+        tags.empty() ||
+        items.size() + 1 != tags.size())
+    {
+      return Status_Unsupported;
+    }
+
+    // Bounds of the current dataset. If "delimited" is true, the
+    // dataset is an item of undefined length, that ends with a
+    // delimitation item.
+    size_t position = datasetStart_;
+    size_t end = size_;
+    bool delimited = false;
+    Encoding encoding = encoding_;
+
+    for (size_t level = 0; ; level++)
+    {
+      const gdcm::Tag& target = tags[level];
+
+      // Look for the target element in the current dataset, whose
+      // elements are sorted by increasing tags
+      ElementHeader header;
+
+      for (;;)
+      {
+        if (position == end)
+        {
+          return (delimited ? Status_Unsupported : Status_NotFound);
+        }
+
+        if (!ReadElementHeader(header, position, end, encoding))
+        {
+          return Status_Unsupported;
+        }
+
+        if (header.group_ == GROUP_ITEMS &&
+            header.element_ == ELEMENT_ITEM_DELIMITATION)
+        {
+          return (delimited ? Status_NotFound : Status_Unsupported);
+        }
+
+        const gdcm::Tag tag(header.group_, header.element_);
+
+        if (tag == target)
+        {
+          break;
+        }
+        else if (target < tag)
+        {
+          return Status_NotFound;
+        }
+        else if (!SkipElement(position, end, encoding, level))
+        {
+          return Status_Unsupported;
+        }
+      }
+
+      if (header.length_ != UNDEFINED_LENGTH &&
+          header.length_ > end - position - header.headerSize_)
+      {
+        return Status_Unsupported;
+      }
+
+      if (level + 1 == tags.size())
+      {
+        if (header.length_ == UNDEFINED_LENGTH)
+        {
+          return Status_Unsupported;  // Encapsulated pixel data, let GDCM deal with it
+        }
+
+        if (header.hasVR_ &&
+            header.vr_[0] == 'S' &&
+            header.vr_[1] == 'Q')
+        {
+          return Status_Found;  // A sequence has no value by itself
+        }
+
+        content = reinterpret_cast<const char*>(dicom_ + position + header.headerSize_);
+        size = header.length_;
+        return Status_Found;
+      }
+
+      // The target is a sequence, locate its requested item
+      if (items[level] == 0)
+      {
+        return Status_NotFound;
+      }
+
+      if (header.hasVR_ &&
+          header.vr_[0] == 'U' &&
+          header.vr_[1] == 'N')
+      {
+        encoding.explicit_ = false;
+        encoding.bigEndian_ = false;
+      }
+
+      position += header.headerSize_;
+
+      const size_t sequenceEnd = (header.length_ == UNDEFINED_LENGTH ? end : position + header.length_);
+
+      for (unsigned int item = 1; ; item++)
+      {
+        if (position == sequenceEnd &&
+            header.length_ != UNDEFINED_LENGTH)
+        {
+          return Status_NotFound;  // End of a sequence of defined length
+        }
+
+        ElementHeader itemHeader;
+        if (!ReadElementHeader(itemHeader, position, sequenceEnd, encoding) ||
+            itemHeader.group_ != GROUP_ITEMS)
+        {
+          return Status_Unsupported;
+        }
+
+        if (itemHeader.element_ == ELEMENT_SEQUENCE_DELIMITATION)
+        {
+          return Status_NotFound;
+        }
+        else if (itemHeader.element_ != ELEMENT_ITEM)
+        {
+          return Status_Unsupported;
+        }
+
+        position += itemHeader.headerSize_;
+
+        if (item == items[level])
+        {
+          // Enter the dataset of this item
+          if (itemHeader.length_ == UNDEFINED_LENGTH)
+          {
+            end = sequenceEnd;
+            delimited = true;
+          }
+          else if (itemHeader.length_ > sequenceEnd - position)
+          {
+            return Status_Unsupported;
+          }
+          else
+          {
+            end = position + itemHeader.length_;
+            delimited = false;
+          }
+
+          break;
+        }
+        else if (itemHeader.length_ == UNDEFINED_LENGTH)
+        {
+          if (!SkipItem(position, sequenceEnd, encoding, level + 1))
+          {
+            return Status_Unsupported;
+          }
+        }
+        else if (itemHeader.length_ > sequenceEnd - position)
+        {
+          return Status_Unsupported;
+        }
+        else
+        {
+          position += itemHeader.length_;
+        }
+      }
+    }
+  }
+
+
+  RawDicomParser::Status RawDicomParser::LookupValues(const char** values,
+                                                      size_t* sizes,
+                                                      const gdcm::Tag* tags,
+                                                      size_t count,
+                                                      const gdcm::Tag& maxTag) const
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      values[i] = NULL;
+      sizes[i] = 0;
+    }
+
+    if (!supported_)
+    {
+      return Status_Unsupported;
+    }
+
+    size_t position = datasetStart_;
+
+    while (position < size_)
+    {
+      ElementHeader header;
+      if (!ReadElementHeader(header, position, size_, encoding_) ||
+          header.group_ == GROUP_ITEMS)
+      {
+        return Status_Unsupported;
+      }
+
+      const gdcm::Tag tag(header.group_, header.element_);
+      if (maxTag < tag)
+      {
+        break;  // The elements are sorted, the remaining ones are not needed
+      }
+
+      if (header.length_ != UNDEFINED_LENGTH)
+      {
+        for (size_t i = 0; i < count; i++)
+        {
+          if (tags[i] == tag &&
+              header.length_ <= size_ - position - header.headerSize_)
+          {
+            values[i] = reinterpret_cast<const char*>(dicom_ + position + header.headerSize_);
+            sizes[i] = header.length_;
+          }
+        }
+      }
+
+      if (!SkipElement(position, size_, encoding_, 0))
+      {
+        return Status_Unsupported;
+      }
+    }
+
+    return Status_Found;
+  }
+
+
+  RawDicomParser::Status RawDicomParser::LookupValue(const char*& content,
+                                                     size_t& size,
+                                                     const gdcm::Tag& tag) const
+  {
+    return LookupValue(content, size, std::vector<gdcm::Tag>(1, tag), std::vector<unsigned int>());
+  }
+
+
+  bool RawDicomParser::WalkDataset(IVisitor& visitor,
+                                   const gdcm::Dict& dictionary,
+                                   std::vector<gdcm::Tag>& tags,
+                                   std::vector<unsigned int>& items,
+                                   size_t& position,
+                                   size_t end,
+                                   bool delimited,
+                                   const Encoding& encoding,
+                                   unsigned int depth) const
+  {
+    if (depth > MAX_DEPTH)
+    {
+      return false;
+    }
+
+    for (;;)
+    {
+      if (position == end)
+      {
+        return !delimited;
+      }
+
+      ElementHeader header;
+      if (!ReadElementHeader(header, position, end, encoding))
+      {
+        return false;
+      }
+
+      if (header.group_ == GROUP_ITEMS &&
+          header.element_ == ELEMENT_ITEM_DELIMITATION)
+      {
+        position += header.headerSize_;
+        return delimited;
+      }
+
+      if (header.length_ != UNDEFINED_LENGTH &&
+          header.length_ > end - position - header.headerSize_)
+      {
+        return false;
+      }
+
+      const gdcm::Tag tag(header.group_, header.element_);
+
+      bool isSequence;
+      std::string vr;
+      if (header.hasVR_)
+      {
+        vr.assign(header.vr_, 2);
+        isSequence = (vr == "SQ");
+      }
+      else
+      {
+        vr = GetVRName(isSequence, dictionary, tag);
+      }
+
+      const bool isUndefinedUN = (header.length_ == UNDEFINED_LENGTH && vr == "UN");
+
+      if (header.length_ == UNDEFINED_LENGTH &&
+          !isSequence &&
+          !isUndefinedUN)
+      {
+        // Encapsulated pixel data, that cannot be accessed as a whole
+        position += header.headerSize_;
+        if (!SkipSequence(position, end, encoding, depth + 1))
+        {
+          return false;
+        }
+      }
+      else if (isSequence ||
+               isUndefinedUN)
+      {
+        Encoding nested = encoding;
+        if (isUndefinedUN)
+        {
+          nested.explicit_ = false;
+          nested.bigEndian_ = false;
+        }
+
+        position += header.headerSize_;
+
+        const bool isDefined = (header.length_ != UNDEFINED_LENGTH);
+        const size_t sequenceEnd = (isDefined ? position + header.length_ : end);
+
+        tags.push_back(tag);
+
+        for (unsigned int item = 1; ; item++)
+        {
+          if (isDefined &&
+              position == sequenceEnd)
+          {
+            break;
+          }
+
+          ElementHeader itemHeader;
+          if (!ReadElementHeader(itemHeader, position, sequenceEnd, nested) ||
+              itemHeader.group_ != GROUP_ITEMS)
+          {
+            return false;
+          }
+
+          position += itemHeader.headerSize_;
+
+          if (itemHeader.element_ == ELEMENT_SEQUENCE_DELIMITATION)
+          {
+            break;
+          }
+          else if (itemHeader.element_ != ELEMENT_ITEM)
+          {
+            return false;
+          }
+
+          items.push_back(item);
+
+          if (itemHeader.length_ == UNDEFINED_LENGTH)
+          {
+            if (!WalkDataset(visitor, dictionary, tags, items, position, sequenceEnd, true, nested, depth + 1))
+            {
+              return false;
+            }
+          }
+          else if (itemHeader.length_ > sequenceEnd - position ||
+                   !WalkDataset(visitor, dictionary, tags, items, position,
+                                position + itemHeader.length_, false, nested, depth + 1))
+          {
+            return false;
+          }
+
+          items.pop_back();
+        }
+
+        tags.pop_back();
+      }
+      else
+      {
+        tags.push_back(tag);
+        visitor.VisitElement(tags, items, vr, position + header.headerSize_, header.length_);
+        tags.pop_back();
+
+        position += header.headerSize_ + header.length_;
+      }
+    }
+  }
+
+
+  bool RawDicomParser::Apply(IVisitor& visitor,
+                             const gdcm::Dict& dictionary) const
+  {
+    if (!supported_)
+    {
+      return false;
+    }
+
+    std::vector<gdcm::Tag> tags;
+    std::vector<unsigned int> items;
+    size_t position = datasetStart_;
+
+    return WalkDataset(visitor, dictionary, tags, items, position, size_, false, encoding_, 0);
+  }
+}
@@ -0,0 +1,177 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <gdcmDict.h>
+#include <gdcmTag.h>
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+
+namespace OrthancPlugins
+{
+  /**
+   * Lazy walker over the raw bytes of a DICOM file, that locates the
+   * value of one element without parsing the whole file: The
+   * elements that are not on the path to the target are skipped
+   * using their length fields. The memory buffer is owned by the
+   * caller, and must remain valid as long as the parser is in use.
+   *
+   * The deflated transfer syntax is not supported. In this case, or
+   * if the file is not well-formed, "Status_Unsupported" is returned
+   * and the caller must fall back to GDCM.
+   **/
+  class RawDicomParser : public boost::noncopyable
+  {
+  public:
+    enum Status
+    {
+      Status_Found,
+      Status_NotFound,
+      Status_Unsupported
+    };
+
+    class IVisitor : public boost::noncopyable
+    {
+    public:
+      virtual ~IVisitor()
+      {
+      }
+
+      // Called for each element that is not a sequence. The "offset"
+      // is the position of the value in the file.
+      virtual void VisitElement(const std::vector<gdcm::Tag>& tags,
+                                const std::vector<unsigned int>& items,
+                                const std::string& vr,
+                                size_t offset,
+                                size_t length) = 0;
+    };
+
+  private:
+    struct Encoding
+    {
+      bool  explicit_;
+      bool  bigEndian_;
+    };
+
+    struct ElementHeader
+    {
+      uint16_t  group_;
+      uint16_t  element_;
+      char      vr_[2];
+      bool      hasVR_;
+      uint32_t  length_;
+      size_t    headerSize_;
+    };
+
+    const uint8_t*  dicom_;
+    size_t          size_;
+    bool            supported_;
+    size_t          datasetStart_;
+    Encoding        encoding_;
+    const char*     transferSyntax_;       // Points inside the meta header
+    size_t          transferSyntaxSize_;
+
+    bool ReadMetaHeader();
+
+    bool IsTransferSyntax(const char* uid) const;
+
+    bool ReadElementHeader(ElementHeader& header,
+                           size_t position,
+                           size_t end,
+                           const Encoding& encoding) const;
+
+    bool SkipElement(size_t& position,
+                     size_t end,
+                     const Encoding& encoding,
+                     unsigned int depth) const;
+
+    bool SkipSequence(size_t& position,
+                      size_t end,
+                      const Encoding& encoding,
+                      unsigned int depth) const;
+
+    bool SkipItem(size_t& position,
+                  size_t end,
+                  const Encoding& encoding,
+                  unsigned int depth) const;
+
+    bool WalkDataset(IVisitor& visitor,
+                     const gdcm::Dict& dictionary,
+                     std::vector<gdcm::Tag>& tags,
+                     std::vector<unsigned int>& items,
+                     size_t& position,
+                     size_t end,
+                     bool delimited,
+                     const Encoding& encoding,
+                     unsigned int depth) const;
+
+  public:
+    RawDicomParser(const void* dicom,
+                   size_t size);
+
+    bool IsSupported() const
+    {
+      return supported_;
+    }
+
+    // Returns the transfer syntax UID, without its padding
+    std::string GetTransferSyntax() const;
+
+    void GetTransferSyntax(const char*& uid /* out */,
+                           size_t& size /* out */) const
+    {
+      uid = transferSyntax_;
+      size = transferSyntaxSize_;
+    }
+
+    // The path is made of the tags of the successive elements, and of
+    // the 1-based indices of the items in the intermediate sequences
+    // (i.e. "items.size() + 1 == tags.size()"), as in the BulkDataURI
+    Status LookupValue(const char*& content /* out */,
+                       size_t& size /* out */,
+                       const std::vector<gdcm::Tag>& tags,
+                       const std::vector<unsigned int>& items) const;
+
+    Status LookupValue(const char*& content /* out */,
+                       size_t& size /* out */,
+                       const gdcm::Tag& tag) const;
+
+    // Looks for several top-level elements in one forward scan, that
+    // stops after "maxTag". If "tags[i]" is absent, "values[i]" is
+    // set to NULL. No memory is allocated.
+    Status LookupValues(const char** values /* out */,
+                        size_t* sizes /* out */,
+                        const gdcm::Tag* tags,
+                        size_t count,
+                        const gdcm::Tag& maxTag) const;
+
+    // Visits all the elements of the file, including those in the
+    // sequences, but excluding the encapsulated pixel data. The
+    // dictionary gives the VR of the elements in implicit VR
+    // syntaxes. Returns "false" if the file is not supported.
+    bool Apply(IVisitor& visitor,
+               const gdcm::Dict& dictionary) const;
+  };
+}
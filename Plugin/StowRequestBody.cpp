@@ -0,0 +1,151 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "StowRequestBody.h"
+
+#include <Core/OrthancException.h>
+#include <boost/lexical_cast.hpp>
+
+namespace OrthancPlugins
+{
+  bool StowRequestBody::ReadNextInstance()
+  {
+    if (source_.ReadNextInstance())
+    {
+      delimiter_ = FormatPartHeader(boundary_, source_.GetInstanceSize());
+      state_ = State_PartHeader;
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  StowRequestBody::StowRequestBody(IInstancesSource& source,
+                                   const std::string& boundary,
+                                   size_t maxInstances,
+                                   size_t maxSize) :
+    source_(source),
+    boundary_(boundary),
+    maxInstances_(maxInstances),
+    maxSize_(maxSize),
+    state_(State_Done),
+    countInstances_(0),
+    batchSize_(0)
+  {
+  }
+
+
+  bool StowRequestBody::StartBatch()
+  {
+    countInstances_ = 0;
+    batchSize_ = 0;
+    state_ = State_Done;
+    return ReadNextInstance();
+  }
+
+
+  const void* StowRequestBody::GetChunkData() const
+  {
+    switch (state_)
+    {
+      case State_PartHeader:
+      case State_Trailer:
+        return delimiter_.c_str();
+
+      case State_Instance:
+        return source_.GetInstanceData();
+
+      default:
+        return NULL;
+    }
+  }
+
+
+  size_t StowRequestBody::GetChunkSize() const
+  {
+    switch (state_)
+    {
+      case State_PartHeader:
+      case State_Trailer:
+        return delimiter_.size();
+
+      case State_Instance:
+        return source_.GetInstanceSize();
+
+      default:
+        return 0;
+    }
+  }
+
+
+  void StowRequestBody::Next()
+  {
+    switch (state_)
+    {
+      case State_PartHeader:
+        state_ = State_Instance;
+        break;
+
+      case State_Instance:
+        countInstances_ ++;
+        batchSize_ += delimiter_.size() + source_.GetInstanceSize();
+        source_.ClearInstance();
+
+        if (IsBatchFull(countInstances_, batchSize_, maxInstances_, maxSize_) ||
+            !ReadNextInstance())
+        {
+          delimiter_ = "\r\n--" + boundary_ + "--\r\n";
+          state_ = State_Trailer;
+        }
+        break;
+
+      case State_Trailer:
+        state_ = State_Done;
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+  }
+
+
+  bool StowRequestBody::IsBatchFull(size_t countInstances,
+                                    size_t batchSize,
+                                    size_t maxInstances,
+                                    size_t maxSize)
+  {
+    return ((maxInstances != 0 && countInstances >= maxInstances) ||
+            (maxSize != 0 && batchSize >= maxSize));
+  }
+
+
+  std::string StowRequestBody::FormatPartHeader(const std::string& boundary,
+                                                size_t size)
+  {
+    return ("\r\n--" + boundary + "\r\n" +
+            "Content-Type: application/dicom\r\n" +
+            "Content-Length: " + boost::lexical_cast<std::string>(size) +
+            "\r\n\r\n");
+  }
+}
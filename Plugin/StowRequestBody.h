@@ -0,0 +1,114 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <string>
+#include <boost/noncopyable.hpp>
+
+namespace OrthancPlugins
+{
+  /**
+   * State machine that generates the multipart body of the STOW-RS
+   * batches, one chunk at a time. The DICOM instances are read one by
+   * one from a source while the previous ones are being uploaded, and
+   * a batch is closed as soon as it reaches "maxInstances" instances
+   * or "maxSize" bytes (0 means no limit).
+   **/
+  class StowRequestBody : public boost::noncopyable
+  {
+  public:
+    class IInstancesSource : public boost::noncopyable
+    {
+    public:
+      virtual ~IInstancesSource()
+      {
+      }
+
+      // Loads the next instance, returns "false" if there is none
+      virtual bool ReadNextInstance() = 0;
+
+      virtual const void* GetInstanceData() const = 0;
+
+      virtual size_t GetInstanceSize() const = 0;
+
+      // Releases the memory of the current instance
+      virtual void ClearInstance() = 0;
+    };
+
+  private:
+    enum State
+    {
+      State_PartHeader,
+      State_Instance,
+      State_Trailer,
+      State_Done
+    };
+
+    IInstancesSource&  source_;
+    std::string        boundary_;
+    size_t             maxInstances_;
+    size_t             maxSize_;
+    std::string        delimiter_;
+    State              state_;
+    size_t             countInstances_;
+    size_t             batchSize_;
+
+    bool ReadNextInstance();
+
+  public:
+    StowRequestBody(IInstancesSource& source,
+                    const std::string& boundary,
+                    size_t maxInstances,
+                    size_t maxSize);
+
+    // Returns "false" iff there is no remaining instance to be sent
+    bool StartBatch();
+
+    size_t GetCountInstances() const
+    {
+      return countInstances_;
+    }
+
+    size_t GetBatchSize() const
+    {
+      return batchSize_;
+    }
+
+    bool IsDone() const
+    {
+      return state_ == State_Done;
+    }
+
+    const void* GetChunkData() const;
+
+    size_t GetChunkSize() const;
+
+    void Next();
+
+    static bool IsBatchFull(size_t countInstances,
+                            size_t batchSize,
+                            size_t maxInstances,
+                            size_t maxSize);
+
+    static std::string FormatPartHeader(const std::string& boundary,
+                                        size_t size);
+  };
+}
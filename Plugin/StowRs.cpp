@@ -24,9 +24,14 @@
 
 #include "Configuration.h"
 #include "Dicom.h"
+#include "MultipartStreamReader.h"
+#include "OrderedTasksPool.h"
+#include "Semaphore.h"
 
 #include <Core/Toolbox.h>
 
+#include <algorithm>
+#include <memory>
 #include <stdexcept>
 
 
@@ -55,6 +60,279 @@ static void SetSequenceTag(gdcm::DataSet& dataset,
 }
 
 
+static unsigned int GetStowThreads()
+{
+  return OrthancPlugins::Configuration::GetUnsignedIntegerValue("StowThreads", 4);
+}
+
+
+static OrthancPlugins::Semaphore& GetStowSemaphore()
+{
+  // "StowThreads" bounds the number of parts that are stored
+  // concurrently, across all the STOW-RS requests
+  static OrthancPlugins::Semaphore semaphore(std::max(1u, GetStowThreads()));
+  return semaphore;
+}
+
+
+namespace
+{
+  // Storage of one part of a STOW-RS request into Orthanc
+  class StoreInstanceTask : public OrthancPlugins::OrderedTasksPool::ITask
+  {
+  public:
+    enum Status
+    {
+      Status_Stored,
+      Status_Discarded,
+      Status_Failed
+    };
+
+  private:
+    OrthancPluginContext*          context_;
+    OrthancPlugins::MultipartItem  item_;
+    const std::string&             expectedStudy_;
+    std::string                    studyInstanceUid_;
+    std::string                    seriesInstanceUid_;
+    std::string                    sopClassUid_;
+    std::string                    sopInstanceUid_;
+    Status                         status_;
+
+    void ReadUids()
+    {
+      // Only read the few elements that precede the Series Instance
+      // UID, without parsing the whole file
+      OrthancPlugins::DicomTagsPeeker peeker(item_.data_, item_.size_);
+      peeker.AddTag(OrthancPlugins::DICOM_TAG_SOP_CLASS_UID);
+      peeker.AddTag(OrthancPlugins::DICOM_TAG_SOP_INSTANCE_UID);
+      peeker.AddTag(OrthancPlugins::DICOM_TAG_STUDY_INSTANCE_UID);
+      peeker.AddTag(OrthancPlugins::DICOM_TAG_SERIES_INSTANCE_UID);
+
+      if (peeker.Apply())
+      {
+        sopClassUid_ = peeker.GetStringValue(OrthancPlugins::DICOM_TAG_SOP_CLASS_UID, "");
+        sopInstanceUid_ = peeker.GetStringValue(OrthancPlugins::DICOM_TAG_SOP_INSTANCE_UID, "");
+        studyInstanceUid_ = peeker.GetStringValue(OrthancPlugins::DICOM_TAG_STUDY_INSTANCE_UID, "");
+        seriesInstanceUid_ = peeker.GetStringValue(OrthancPlugins::DICOM_TAG_SERIES_INSTANCE_UID, "");
+      }
+      else
+      {
+        // Not supported by the raw parser, fall back to GDCM
+        OrthancPlugins::ParsedDicomFile dicom(item_);
+        studyInstanceUid_ = dicom.GetRawTagWithDefault(OrthancPlugins::DICOM_TAG_STUDY_INSTANCE_UID, "", true);
+        seriesInstanceUid_ = dicom.GetRawTagWithDefault(OrthancPlugins::DICOM_TAG_SERIES_INSTANCE_UID, "", true);
+        sopClassUid_ = dicom.GetRawTagWithDefault(OrthancPlugins::DICOM_TAG_SOP_CLASS_UID, "", true);
+        sopInstanceUid_ = dicom.GetRawTagWithDefault(OrthancPlugins::DICOM_TAG_SOP_INSTANCE_UID, "", true);
+      }
+    }
+
+  public:
+    StoreInstanceTask(OrthancPluginContext* context,
+                      const OrthancPlugins::MultipartItem& item,
+                      const std::string& expectedStudy) :
+      context_(context),
+      item_(item),
+      expectedStudy_(expectedStudy),
+      status_(Status_Failed)
+    {
+    }
+
+    virtual void Execute()
+    {
+      OrthancPlugins::Semaphore::Locker locker(GetStowSemaphore());
+
+      ReadUids();
+
+      if (!expectedStudy_.empty() &&
+          studyInstanceUid_ != expectedStudy_)
+      {
+        OrthancPlugins::Configuration::LogInfo("STOW-RS request restricted to study [" + expectedStudy_ + 
+                                               "]: Ignoring instance from study [" + studyInstanceUid_ + "]");
+        status_ = Status_Discarded;
+      }
+      else
+      {
+        OrthancPlugins::MemoryBuffer tmp(context_);
+        status_ = (tmp.RestApiPost("/instances", item_.data_, item_.size_, false) ?
+                   Status_Stored : Status_Failed);
+      }
+    }
+
+    Status GetStatus() const
+    {
+      return status_;
+    }
+
+    const std::string& GetStudyInstanceUid() const
+    {
+      return studyInstanceUid_;
+    }
+
+    const std::string& GetSeriesInstanceUid() const
+    {
+      return seriesInstanceUid_;
+    }
+
+    const std::string& GetSopClassUid() const
+    {
+      return sopClassUid_;
+    }
+
+    const std::string& GetSopInstanceUid() const
+    {
+      return sopInstanceUid_;
+    }
+  };
+
+
+  /**
+   * Pipeline of a STOW-RS request: Each part is handed to the store
+   * workers as soon as it is found by the multipart parser, and the
+   * results are collected in the order of the parts.
+   **/
+  class StowPipeline : public OrthancPlugins::MultipartStreamReader::IHandler
+  {
+  private:
+    OrthancPluginContext*             context_;
+    const std::string&                wadoBase_;
+    const std::string&                expectedStudy_;
+    OrthancPlugins::OrderedTasksPool  pool_;
+    size_t                            maxPending_;
+    bool                              isFirst_;
+    bool                              unsupportedPart_;
+    gdcm::DataSet&                    result_;
+    gdcm::SmartPointer<gdcm::SequenceOfItems>  success_;
+    gdcm::SmartPointer<gdcm::SequenceOfItems>  failed_;
+
+    void CollectResult()
+    {
+      std::auto_ptr<OrthancPlugins::OrderedTasksPool::ITask> task(pool_.Dequeue());
+      const StoreInstanceTask& stored = dynamic_cast<const StoreInstanceTask&>(*task);
+
+      gdcm::Item item;
+      item.SetVLToUndefined();
+      gdcm::DataSet &status = item.GetNestedDataSet();
+
+      SetTag(status, OrthancPlugins::DICOM_TAG_REFERENCED_SOP_CLASS_UID, gdcm::VR::UI, stored.GetSopClassUid());
+      SetTag(status, OrthancPlugins::DICOM_TAG_REFERENCED_SOP_INSTANCE_UID, gdcm::VR::UI, stored.GetSopInstanceUid());
+
+      if (stored.GetStatus() == StoreInstanceTask::Status_Discarded)
+      {
+        SetTag(status, OrthancPlugins::DICOM_TAG_WARNING_REASON, gdcm::VR::US, "B006");  // Elements discarded
+        success_->AddItem(item);      
+        return;
+      }
+
+      if (isFirst_)
+      {
+        std::string url = wadoBase_ + "studies/" + stored.GetStudyInstanceUid();
+        SetTag(result_, OrthancPlugins::DICOM_TAG_RETRIEVE_URL, gdcm::VR::UT, url);
+        isFirst_ = false;
+      }
+
+      if (stored.GetStatus() == StoreInstanceTask::Status_Stored)
+      {
+        std::string url = (wadoBase_ + 
+                           "studies/" + stored.GetStudyInstanceUid() +
+                           "/series/" + stored.GetSeriesInstanceUid() +
+                           "/instances/" + stored.GetSopInstanceUid());
+
+        SetTag(status, OrthancPlugins::DICOM_TAG_RETRIEVE_URL, gdcm::VR::UT, url);
+        success_->AddItem(item);
+      }
+      else
+      {
+        OrthancPlugins::Configuration::LogError("Orthanc was unable to store instance through STOW-RS request");
+        SetTag(status, OrthancPlugins::DICOM_TAG_FAILURE_REASON, gdcm::VR::US, "0110");  // Processing failure
+        failed_->AddItem(item);
+      }
+    }
+
+  public:
+    // If "countThreads" is zero, the parts are stored by the current
+    // thread, between the parsing of two parts
+    StowPipeline(OrthancPluginContext* context,
+                 const std::string& wadoBase,
+                 const std::string& expectedStudy,
+                 gdcm::DataSet& result,
+                 unsigned int countThreads) :
+      context_(context),
+      wadoBase_(wadoBase),
+      expectedStudy_(expectedStudy),
+      pool_(countThreads),
+      maxPending_(countThreads == 0 ? 1 : 2 * countThreads),  // Bounds the parts in flight
+      isFirst_(true),
+      unsupportedPart_(false),
+      result_(result),
+      success_(new gdcm::SequenceOfItems()),
+      failed_(new gdcm::SequenceOfItems())
+    {
+    }
+
+    virtual void HandlePart(const OrthancPlugins::MultipartStreamReader::HttpHeaders& headers,
+                            const void* part,
+                            size_t size)
+    {
+      if (unsupportedPart_)
+      {
+        return;  // Ignore the parts after an unsupported part
+      }
+
+      OrthancPlugins::MultipartItem item;
+      item.data_ = reinterpret_cast<const char*>(part);
+      item.size_ = size;
+
+      OrthancPlugins::MultipartStreamReader::HttpHeaders::const_iterator
+        contentType = headers.find("content-type");
+      if (contentType == headers.end())
+      {
+        item.contentType_ = "application/octet-stream";
+      }
+      else
+      {
+        item.contentType_ = contentType->second;
+      }
+
+      OrthancPlugins::Configuration::LogInfo("Detected multipart item with content type \"" + 
+                                             item.contentType_ + "\" of size " + 
+                                             boost::lexical_cast<std::string>(item.size_));
+
+      if (item.contentType_ != "application/dicom")
+      {
+        OrthancPlugins::Configuration::LogError("The STOW-RS request contains a part that is not "
+                                                "\"application/dicom\" (it is: \"" + item.contentType_ + "\")");
+        unsupportedPart_ = true;
+        return;
+      }
+
+      while (pool_.GetSize() >= maxPending_)
+      {
+        CollectResult();
+      }
+
+      pool_.Push(new StoreInstanceTask(context_, item, expectedStudy_));
+    }
+
+    // Waits for the storage of all the parts, and fills the result
+    void Finalize()
+    {
+      while (pool_.GetSize() > 0)
+      {
+        CollectResult();
+      }
+
+      SetSequenceTag(result_, OrthancPlugins::DICOM_TAG_FAILED_SOP_SEQUENCE, failed_);
+      SetSequenceTag(result_, OrthancPlugins::DICOM_TAG_REFERENCED_SOP_SEQUENCE, success_);
+    }
+
+    bool HasUnsupportedPart() const
+    {
+      return unsupportedPart_;
+    }
+  };
+}
+
+
 
 bool IsXmlExpected(const OrthancPluginHttpRequest* request)
 {
@@ -151,88 +429,19 @@ void StowCallback(OrthancPluginRestOutput* output,
   }
 
 
-  bool isFirst = true;
   gdcm::DataSet result;
-  gdcm::SmartPointer<gdcm::SequenceOfItems> success = new gdcm::SequenceOfItems();
-  gdcm::SmartPointer<gdcm::SequenceOfItems> failed = new gdcm::SequenceOfItems();
-  
-  std::vector<OrthancPlugins::MultipartItem> items;
-  OrthancPlugins::ParseMultipartBody(items, context, request->body, request->bodySize, boundary);
 
-  for (size_t i = 0; i < items.size(); i++)
-  {
-    OrthancPlugins::Configuration::LogInfo("Detected multipart item with content type \"" + 
-                                           items[i].contentType_ + "\" of size " + 
-                                           boost::lexical_cast<std::string>(items[i].size_));
-  }  
+  // The parts are stored concurrently by Orthanc, but the answer
+  // lists them in the order of the request
+  StowPipeline pipeline(context, wadoBase, expectedStudy, result, GetStowThreads());
+  OrthancPlugins::MultipartStreamReader::ParseBody(pipeline, request->body, request->bodySize, boundary);
+  pipeline.Finalize();
 
-  for (size_t i = 0; i < items.size(); i++)
+  if (pipeline.HasUnsupportedPart())
   {
-    if (!items[i].contentType_.empty() &&
-        items[i].contentType_ != "application/dicom")
-    {
-      OrthancPlugins::Configuration::LogError("The STOW-RS request contains a part that is not "
-                                              "\"application/dicom\" (it is: \"" + items[i].contentType_ + "\")");
-      OrthancPluginSendHttpStatusCode(context, output, 415 /* Unsupported media type */);
-      return;
-    }
-
-    OrthancPlugins::ParsedDicomFile dicom(items[i]);
-
-    std::string studyInstanceUid = dicom.GetRawTagWithDefault(OrthancPlugins::DICOM_TAG_STUDY_INSTANCE_UID, "", true);
-    std::string sopClassUid = dicom.GetRawTagWithDefault(OrthancPlugins::DICOM_TAG_SOP_CLASS_UID, "", true);
-    std::string sopInstanceUid = dicom.GetRawTagWithDefault(OrthancPlugins::DICOM_TAG_SOP_INSTANCE_UID, "", true);
-
-    gdcm::Item item;
-    item.SetVLToUndefined();
-    gdcm::DataSet &status = item.GetNestedDataSet();
-
-    SetTag(status, OrthancPlugins::DICOM_TAG_REFERENCED_SOP_CLASS_UID, gdcm::VR::UI, sopClassUid);
-    SetTag(status, OrthancPlugins::DICOM_TAG_REFERENCED_SOP_INSTANCE_UID, gdcm::VR::UI, sopInstanceUid);
-
-    if (!expectedStudy.empty() &&
-        studyInstanceUid != expectedStudy)
-    {
-      OrthancPlugins::Configuration::LogInfo("STOW-RS request restricted to study [" + expectedStudy + 
-                                             "]: Ignoring instance from study [" + studyInstanceUid + "]");
-
-      SetTag(status, OrthancPlugins::DICOM_TAG_WARNING_REASON, gdcm::VR::US, "B006");  // Elements discarded
-      success->AddItem(item);      
-    }
-    else
-    {
-      if (isFirst)
-      {
-        std::string url = wadoBase + "studies/" + studyInstanceUid;
-        SetTag(result, OrthancPlugins::DICOM_TAG_RETRIEVE_URL, gdcm::VR::UT, url);
-        isFirst = false;
-      }
-
-      OrthancPlugins::MemoryBuffer tmp(context);
-      bool ok = tmp.RestApiPost("/instances", items[i].data_, items[i].size_, false);
-      tmp.Clear();
-
-      if (ok)
-      {
-        std::string url = (wadoBase + 
-                           "studies/" + studyInstanceUid +
-                           "/series/" + dicom.GetRawTagWithDefault(OrthancPlugins::DICOM_TAG_SERIES_INSTANCE_UID, "", true) +
-                           "/instances/" + sopInstanceUid);
-
-        SetTag(status, OrthancPlugins::DICOM_TAG_RETRIEVE_URL, gdcm::VR::UT, url);
-        success->AddItem(item);
-      }
-      else
-      {
-        OrthancPlugins::Configuration::LogError("Orthanc was unable to store instance through STOW-RS request");
-        SetTag(status, OrthancPlugins::DICOM_TAG_FAILURE_REASON, gdcm::VR::US, "0110");  // Processing failure
-        failed->AddItem(item);
-      }
-    }
+    OrthancPluginSendHttpStatusCode(context, output, 415 /* Unsupported media type */);
+    return;
   }
 
-  SetSequenceTag(result, OrthancPlugins::DICOM_TAG_FAILED_SOP_SEQUENCE, failed);
-  SetSequenceTag(result, OrthancPlugins::DICOM_TAG_REFERENCED_SOP_SEQUENCE, success);
-
   OrthancPlugins::AnswerDicom(context, output, wadoBase, *dictionary_, result, isXml, false);
 }
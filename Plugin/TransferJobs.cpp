@@ -0,0 +1,572 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "TransferJobs.h"
+
+#include <Core/OrthancException.h>
+
+#include <cassert>
+#include <memory>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace OrthancPlugins
+{
+  struct TransferJobs::Job : public boost::noncopyable
+  {
+    std::string               id_;
+    std::string               type_;
+    std::string               server_;
+    boost::shared_ptr<IJob>   job_;        // Shared with the threads that take its answer
+    Progress                  progress_;
+    State                     state_;
+    std::string               error_;
+    boost::posix_time::ptime  creationTime_;
+    boost::posix_time::ptime  startTime_;
+    boost::posix_time::ptime  endTime_;
+    bool                      hasAnswer_;  // Whether an answer is kept
+    size_t                    answerSize_;
+
+    Job(IJob* job,
+        const std::string& id,
+        const std::string& type,
+        const std::string& server) :
+      id_(id),
+      type_(type),
+      server_(server),
+      job_(job),
+      state_(State_Pending),
+      creationTime_(boost::posix_time::microsec_clock::universal_time()),
+      hasAnswer_(false),
+      answerSize_(0)
+    {
+    }
+
+    double GetElapsedSeconds() const
+    {
+      if (state_ == State_Pending ||
+          startTime_.is_not_a_date_time())
+      {
+        return 0;
+      }
+
+      boost::posix_time::ptime end = (state_ == State_Running ?
+                                      boost::posix_time::microsec_clock::universal_time() :
+                                      endTime_);
+
+      return static_cast<double>((end - startTime_).total_milliseconds()) / 1000.0;
+    }
+  };
+
+
+  TransferJobs::Progress::Progress() :
+    canceled_(false),
+    completedInstances_(0),
+    totalInstances_(0),
+    transferredBytes_(0)
+  {
+  }
+
+
+  void TransferJobs::Progress::SetTotalInstances(unsigned int count)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    totalInstances_ = count;
+  }
+
+
+  void TransferJobs::Progress::AddCompletedInstances(unsigned int count)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    completedInstances_ += count;
+  }
+
+
+  void TransferJobs::Progress::AddTransferredBytes(uint64_t size)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    transferredBytes_ += size;
+  }
+
+
+  void TransferJobs::Progress::Cancel()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    canceled_ = true;
+  }
+
+
+  bool TransferJobs::Progress::IsCanceled()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return canceled_;
+  }
+
+
+  void TransferJobs::Progress::CheckCanceled()
+  {
+    if (IsCanceled())
+    {
+      // "ErrorCode_CanceledJob" is not available in Orthanc 1.3.2,
+      // the worker reports the job as canceled anyway
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+
+
+  void TransferJobs::Progress::Format(Json::Value& target,
+                                      double elapsedSeconds)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target["CompletedInstances"] = completedInstances_;
+    target["TransferredBytes"] = boost::lexical_cast<std::string>(transferredBytes_);
+    target["ElapsedSeconds"] = elapsedSeconds;
+
+    if (totalInstances_ != 0)
+    {
+      target["TotalInstances"] = totalInstances_;
+      target["Progress"] = (static_cast<double>(completedInstances_) /
+                            static_cast<double>(totalInstances_));
+    }
+
+    if (elapsedSeconds > 0)
+    {
+      // Throughput in bytes per second
+      target["Throughput"] = static_cast<double>(transferredBytes_) / elapsedSeconds;
+    }
+  }
+
+
+  void TransferJobs::Worker(TransferJobs* that)
+  {
+    for (;;)
+    {
+      Job* job = NULL;
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        while (!that->done_ &&
+               that->pending_.empty())
+        {
+          that->jobAvailable_.wait(lock);
+        }
+
+        if (that->done_)
+        {
+          return;
+        }
+
+        job = that->pending_.front();
+        that->pending_.pop_front();
+
+        job->state_ = State_Running;
+        job->startTime_ = boost::posix_time::microsec_clock::universal_time();
+      }
+
+      // The job cannot be removed from "jobs_" while it is running
+      State state = State_Success;
+      std::string error;
+
+      try
+      {
+        job->progress_.CheckCanceled();
+        job->job_->Execute(job->progress_);
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        state = State_Failure;
+        error = e.What();
+      }
+      catch (std::bad_alloc&)
+      {
+        state = State_Failure;
+        error = "Not enough memory";
+      }
+      catch (...)
+      {
+        state = State_Failure;
+        error = "Internal error";
+      }
+
+      if (state == State_Failure &&
+          job->progress_.IsCanceled())
+      {
+        state = State_Canceled;
+        error.clear();
+      }
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+        that->Finish(*job, state, error);
+      }
+    }
+  }
+
+
+  void TransferJobs::Finish(Job& job,
+                            State state,
+                            const std::string& error)
+  {
+    // The mutex must be locked by the caller
+    job.state_ = state;
+    job.error_ = error;
+    job.endTime_ = boost::posix_time::microsec_clock::universal_time();
+
+    if (state == State_Success &&
+        job.job_->GetAnswerSize(job.answerSize_))
+    {
+      job.hasAnswer_ = true;
+      answersSize_ += job.answerSize_;
+    }
+
+    finished_.push_back(job.id_);
+
+    // Forget about the oldest finished jobs
+    while (finished_.size() > maxHistory_)
+    {
+      Jobs::iterator found = jobs_.find(finished_.front());
+      finished_.pop_front();
+
+      if (found != jobs_.end())
+      {
+        ReleaseAnswer(*found->second);
+        delete found->second;
+        jobs_.erase(found);
+      }
+    }
+
+    // Free the answers of the oldest finished jobs, until the total
+    // size of the answers fits the limit
+    for (std::list<std::string>::const_iterator it = finished_.begin();
+         it != finished_.end() && answersSize_ > maxAnswersSize_; ++it)
+    {
+      Jobs::iterator found = jobs_.find(*it);
+      if (found != jobs_.end())
+      {
+        ReleaseAnswer(*found->second);
+      }
+    }
+  }
+
+
+  void TransferJobs::ReleaseAnswer(Job& job)
+  {
+    // The mutex must be locked by the caller
+    if (job.hasAnswer_)
+    {
+      assert(answersSize_ >= job.answerSize_);
+      answersSize_ -= job.answerSize_;
+      job.hasAnswer_ = false;
+      job.job_->ReleaseAnswer();
+    }
+  }
+
+
+  TransferJobs::Job* TransferJobs::LookupJob(const std::string& server,
+                                             const std::string& id)
+  {
+    // The mutex must be locked by the caller
+    Jobs::iterator found = jobs_.find(id);
+
+    if (found == jobs_.end() ||
+        found->second->server_ != server)
+    {
+      return NULL;
+    }
+    else
+    {
+      return found->second;
+    }
+  }
+
+
+  TransferJobs::TransferJobs() :
+    done_(false),
+    maxHistory_(100),
+    maxAnswersSize_(0),
+    answersSize_(0)
+  {
+  }
+
+
+  TransferJobs::~TransferJobs()
+  {
+    Stop();
+
+    for (Jobs::iterator it = jobs_.begin(); it != jobs_.end(); ++it)
+    {
+      delete it->second;
+    }
+  }
+
+
+  TransferJobs& TransferJobs::GetInstance()
+  {
+    static TransferJobs singleton;
+    return singleton;
+  }
+
+
+  const char* TransferJobs::EnumerationToString(State state)
+  {
+    switch (state)
+    {
+      case State_Pending:
+        return "Pending";
+
+      case State_Running:
+        return "Running";
+
+      case State_Success:
+        return "Success";
+
+      case State_Failure:
+        return "Failure";
+
+      case State_Canceled:
+        return "Canceled";
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  void TransferJobs::Start(unsigned int countThreads,
+                           size_t maxHistory,
+                           size_t maxAnswersSize)
+  {
+    if (countThreads == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!workers_.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    done_ = false;
+    maxHistory_ = maxHistory;
+    maxAnswersSize_ = maxAnswersSize;
+
+    for (unsigned int i = 0; i < countThreads; i++)
+    {
+      workers_.push_back(new boost::thread(Worker, this));
+    }
+  }
+
+
+  void TransferJobs::Stop()
+  {
+    std::vector<boost::thread*> workers;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      done_ = true;
+      workers.swap(workers_);
+
+      for (Jobs::iterator it = jobs_.begin(); it != jobs_.end(); ++it)
+      {
+        it->second->progress_.Cancel();
+      }
+    }
+
+    jobAvailable_.notify_all();
+
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+      if (workers[i]->joinable())
+      {
+        workers[i]->join();
+      }
+
+      delete workers[i];
+    }
+
+    {
+      // The jobs that were never started are canceled
+      boost::mutex::scoped_lock lock(mutex_);
+
+      while (!pending_.empty())
+      {
+        Finish(*pending_.front(), State_Canceled, "");
+        pending_.pop_front();
+      }
+    }
+  }
+
+
+  void TransferJobs::Submit(IJob* job,
+                            const std::string& id,
+                            const std::string& type,
+                            const std::string& server)
+  {
+    if (job == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    std::auto_ptr<IJob> protection(job);
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (workers_.empty())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      }
+
+      if (jobs_.find(id) != jobs_.end())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+
+      std::auto_ptr<Job> item(new Job(protection.release(), id, type, server));
+      pending_.push_back(item.get());
+      jobs_[id] = item.release();
+    }
+
+    jobAvailable_.notify_one();
+  }
+
+
+  void TransferJobs::ListJobs(std::list<std::string>& target,
+                              const std::string& server)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target.clear();
+    for (Jobs::const_iterator it = jobs_.begin(); it != jobs_.end(); ++it)
+    {
+      if (it->second->server_ == server)
+      {
+        target.push_back(it->first);
+      }
+    }
+  }
+
+
+  bool TransferJobs::GetStatus(Json::Value& target,
+                               const std::string& server,
+                               const std::string& id)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Job* job = LookupJob(server, id);
+    if (job == NULL)
+    {
+      return false;
+    }
+
+    target = Json::objectValue;
+    target["ID"] = job->id_;
+    target["Type"] = job->type_;
+    target["Server"] = job->server_;
+    target["State"] = EnumerationToString(job->state_);
+    target["CreationTime"] = boost::posix_time::to_iso_string(job->creationTime_);
+
+    job->progress_.Format(target, job->GetElapsedSeconds());
+
+    if (job->state_ == State_Failure)
+    {
+      target["Error"] = job->error_;
+    }
+    else if (job->state_ == State_Success)
+    {
+      Json::Value result;
+      job->job_->FormatResult(result);
+      target["Result"] = result;
+    }
+
+    return true;
+  }
+
+
+  bool TransferJobs::Cancel(const std::string& server,
+                            const std::string& id)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Job* job = LookupJob(server, id);
+    if (job == NULL)
+    {
+      return false;
+    }
+
+    if (job->state_ == State_Pending)
+    {
+      for (std::deque<Job*>::iterator it = pending_.begin(); it != pending_.end(); ++it)
+      {
+        if (*it == job)
+        {
+          pending_.erase(it);
+          break;
+        }
+      }
+
+      // Beware that "Finish()" might delete the job
+      Finish(*job, State_Canceled, "");
+    }
+    else if (job->state_ == State_Running)
+    {
+      // The job stops at its next call to "CheckCanceled()"
+      job->progress_.Cancel();
+    }
+
+    return true;
+  }
+
+
+  bool TransferJobs::TakeAnswer(std::string& body,
+                                std::string& contentType,
+                                const std::string& server,
+                                const std::string& id)
+  {
+    boost::shared_ptr<IJob> job;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      Job* item = LookupJob(server, id);
+      if (item == NULL ||
+          !item->hasAnswer_)
+      {
+        return false;
+      }
+
+      // From now on, the answer is only accessed by this thread
+      assert(answersSize_ >= item->answerSize_);
+      answersSize_ -= item->answerSize_;
+      item->hasAnswer_ = false;
+      job = item->job_;
+    }
+
+    // The answer is copied without blocking the other requests, and
+    // the job survives its removal from the history in the meantime
+    return job->TakeAnswer(body, contentType);
+  }
+}
@@ -0,0 +1,180 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2018 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <deque>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <json/value.h>
+
+namespace OrthancPlugins
+{
+  /**
+   * Scheduler of the asynchronous transfers of the DICOMweb client
+   * (STOW-RS, WADO-RS retrieve and GET), that run in a bounded pool
+   * of background threads instead of the HTTP threads of Orthanc.
+   * The jobs are attached to the DICOMweb server they talk to, and
+   * the last finished jobs are kept to report their outcome. The
+   * bodies downloaded by the finished jobs are kept until they are
+   * fetched, within a global limit on their total size.
+   **/
+  class TransferJobs : public boost::noncopyable
+  {
+  public:
+    enum State
+    {
+      State_Pending,
+      State_Running,
+      State_Success,
+      State_Failure,
+      State_Canceled
+    };
+
+    // Progress of one job, that is updated by the threads of the job
+    class Progress : public boost::noncopyable
+    {
+    private:
+      boost::mutex  mutex_;
+      bool          canceled_;
+      unsigned int  completedInstances_;
+      unsigned int  totalInstances_;     // 0 if unknown
+      uint64_t      transferredBytes_;
+
+    public:
+      Progress();
+
+      void SetTotalInstances(unsigned int count);
+
+      void AddCompletedInstances(unsigned int count);
+
+      void AddTransferredBytes(uint64_t size);
+
+      void Cancel();
+
+      bool IsCanceled();
+
+      // Throws an exception if the job has been canceled
+      void CheckCanceled();
+
+      void Format(Json::Value& target /* inout */,
+                  double elapsedSeconds);
+    };
+
+    class IJob : public boost::noncopyable
+    {
+    public:
+      virtual ~IJob()
+      {
+      }
+
+      // Must regularly call "progress.CheckCanceled()"
+      virtual void Execute(Progress& progress) = 0;
+
+      // Only called once the job has succeeded
+      virtual void FormatResult(Json::Value& result) const = 0;
+
+      // Returns "false" if the job has not downloaded any body
+      virtual bool GetAnswerSize(size_t& size /* out */) const = 0;
+
+      // Moves the body downloaded by the job into "body", and frees
+      // it in the job. Can be called concurrently with "FormatResult()".
+      virtual bool TakeAnswer(std::string& body /* out */,
+                              std::string& contentType /* out */) = 0;
+
+      // Frees the body downloaded by the job, if any
+      virtual void ReleaseAnswer() = 0;
+    };
+
+  private:
+    struct Job;
+
+    typedef std::map<std::string, Job*>  Jobs;
+
+    boost::mutex                 mutex_;
+    boost::condition_variable    jobAvailable_;
+    bool                         done_;
+    size_t                       maxHistory_;
+    size_t                       maxAnswersSize_;
+    size_t                       answersSize_;  // Total size of the answers that are kept
+    Jobs                         jobs_;
+    std::deque<Job*>             pending_;
+    std::list<std::string>       finished_;   // Oldest first
+    std::vector<boost::thread*>  workers_;
+
+    static void Worker(TransferJobs* that);
+
+    void Finish(Job& job,
+                State state,
+                const std::string& error);
+
+    void ReleaseAnswer(Job& job);
+
+    Job* LookupJob(const std::string& server,
+                   const std::string& id);
+
+    TransferJobs();  // Singleton pattern
+
+  public:
+    ~TransferJobs();
+
+    static TransferJobs& GetInstance();
+
+    static const char* EnumerationToString(State state);
+
+    // If "maxAnswersSize" is exceeded, the answers of the oldest
+    // finished jobs are released
+    void Start(unsigned int countThreads,
+               size_t maxHistory,
+               size_t maxAnswersSize);
+
+    // Cancels the running jobs, and waits for their completion
+    void Stop();
+
+    // Takes the ownership of the job. The identifier must be unique
+    // and should not be guessable, e.g. a UUID.
+    void Submit(IJob* job,
+                const std::string& id,
+                const std::string& type,
+                const std::string& server);
+
+    void ListJobs(std::list<std::string>& target,
+                  const std::string& server);
+
+    bool GetStatus(Json::Value& target,
+                   const std::string& server,
+                   const std::string& id);
+
+    bool Cancel(const std::string& server,
+                const std::string& id);
+
+    // The answer of a job can only be fetched once, which frees it
+    bool TakeAnswer(std::string& body /* out */,
+                    std::string& contentType /* out */,
+                    const std::string& server,
+                    const std::string& id);
+  };
+}
@@ -24,10 +24,14 @@
 #include "Configuration.h"
 #include "Dicom.h"
 #include "DicomResults.h"
+#include "HierarchyCache.h"
+#include "OrderedTasksPool.h"
+#include "RawDicomParser.h"
 
 #include <Core/Toolbox.h>
 
 #include <memory>
+#include <boost/lexical_cast.hpp>
 
 static bool AcceptMultipartDicom(const OrthancPluginHttpRequest* request)
 {
@@ -74,9 +78,9 @@ static bool AcceptMultipartDicom(const OrthancPluginHttpRequest* request)
 
 
 static bool AcceptMetadata(const OrthancPluginHttpRequest* request,
-                           bool& isXml)
+                           OrthancPlugins::DicomResults::Format& format)
 {
-  isXml = false;    // By default, return application/dicom+json
+  format = OrthancPlugins::DicomResults::Format_Json;    // By default, return application/dicom+json
 
   std::string accept;
   if (!OrthancPlugins::LookupHttpHeader(accept, request, "accept"))
@@ -107,12 +111,17 @@ static bool AcceptMetadata(const OrthancPluginHttpRequest* request,
     Orthanc::Toolbox::ToLowerCase(s);
     if (s == "application/dicom+xml")
     {
-      isXml = true;
+      format = OrthancPlugins::DicomResults::Format_Xml;
+    }
+    else if (s == "application/dicom+json")
+    {
+      // Stream the metadata of each instance as a separate item
+      format = OrthancPlugins::DicomResults::Format_JsonMultipart;
     }
     else
     {
-      OrthancPlugins::Configuration::LogError("This WADO-RS plugin only supports application/dicom+xml "
-                                              "type for multipart/related accept (" + accept + ")");
+      OrthancPlugins::Configuration::LogError("This WADO-RS plugin only supports application/dicom+xml and "
+                                              "application/dicom+json types for multipart/related accept (" + accept + ")");
       return false;
     }
   }
@@ -134,8 +143,11 @@ static bool AcceptMetadata(const OrthancPluginHttpRequest* request,
 
 
 
-static bool AcceptBulkData(const OrthancPluginHttpRequest* request)
+static bool AcceptBulkData(std::string& range,
+                           const OrthancPluginHttpRequest* request)
 {
+  range.clear();
+
   std::string accept;
 
   if (!OrthancPlugins::LookupHttpHeader(accept, request, "accept"))
@@ -166,17 +178,61 @@ static bool AcceptBulkData(const OrthancPluginHttpRequest* request)
     }
   }
 
-  if (attributes.find("ra,ge") != attributes.end())
+  if (attributes.find("range") != attributes.end())
   {
-    OrthancPlugins::Configuration::LogError("This WADO-RS plugin does not support Range retrieval, "
-                                            "it can only return entire bulk data object");
-    return false;
+    range = attributes["range"];
   }
 
   return true;
 }
 
 
+namespace
+{
+  // Download of one DICOM file by the prefetch threads of
+  // "AnswerListOfDicomInstances()"
+  class InstanceFileTask : public OrthancPlugins::OrderedTasksPool::ITask
+  {
+  private:
+    std::string                   uri_;
+    size_t                        expectedSize_;
+    OrthancPlugins::MemoryBuffer  file_;
+    bool                          found_;
+
+  public:
+    InstanceFileTask(OrthancPluginContext* context,
+                     const std::string& uri,
+                     size_t expectedSize) :
+      uri_(uri),
+      expectedSize_(expectedSize),
+      file_(context),
+      found_(false)
+    {
+    }
+
+    virtual void Execute()
+    {
+      found_ = file_.RestApiGet(uri_, false);
+    }
+
+    size_t GetExpectedSize() const
+    {
+      return expectedSize_;
+    }
+
+    bool IsFound() const
+    {
+      return found_;
+    }
+
+    const OrthancPlugins::MemoryBuffer& GetFile() const
+    {
+      return file_;
+    }
+  };
+}
+
+
 static void AnswerListOfDicomInstances(OrthancPluginRestOutput* output,
                                        const std::string& resource)
 {
@@ -194,14 +250,62 @@ static void AnswerListOfDicomInstances(OrthancPluginRestOutput* output,
   {
     throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
   }
-  
-  for (Json::Value::ArrayIndex i = 0; i < instances.size(); i++)
+
+  // The next instances are read by a pool of threads while the
+  // current one is sent to the network. The number of prefetched
+  // instances and their total size are bounded.
+  unsigned int prefetch = OrthancPlugins::Configuration::GetUnsignedIntegerValue("WadoRsPrefetchInstances", 4);
+  const size_t maxSize = (static_cast<size_t>(OrthancPlugins::Configuration::GetUnsignedIntegerValue("WadoRsPrefetchMaxSize", 64)) 
+                          * 1024 * 1024);  // In MB
+
+  if (prefetch > instances.size())
   {
-    std::string uri = "/instances/" + instances[i]["ID"].asString() + "/file";
+    prefetch = instances.size();
+  }
+
+  OrthancPlugins::OrderedTasksPool pool(prefetch);  // Without thread, the files are read sequentially
+
+  Json::Value::ArrayIndex next = 0;
+  size_t sizeInFlight = 0;
+
+  for (;;)
+  {
+    while (next < instances.size())
+    {
+      size_t size = 0;
+      if (instances[next].isMember("FileSize") &&
+          instances[next]["FileSize"].isIntegral())
+      {
+        size = instances[next]["FileSize"].asUInt();
+      }
+
+      if (pool.GetSize() != 0 &&
+          (pool.GetSize() >= prefetch ||
+           sizeInFlight + size > maxSize))
+      {
+        break;  // Wait for the current instance to be sent
+      }
+
+      std::string uri = "/instances/" + instances[next]["ID"].asString() + "/file";
+      pool.Push(new InstanceFileTask(context, uri, size));
 
-    OrthancPlugins::MemoryBuffer dicom(context);
-    if (dicom.RestApiGet(uri, false) &&
-        OrthancPluginSendMultipartItem(context, output, dicom.GetData(), dicom.GetSize()) != 0)
+      sizeInFlight += size;
+      next++;
+    }
+
+    if (pool.GetSize() == 0)
+    {
+      break;  // Done
+    }
+
+    std::auto_ptr<OrthancPlugins::OrderedTasksPool::ITask> task(pool.Dequeue());
+
+    const InstanceFileTask& file = dynamic_cast<const InstanceFileTask&>(*task);
+    assert(sizeInFlight >= file.GetExpectedSize());
+    sizeInFlight -= file.GetExpectedSize();
+
+    if (file.IsFound() &&
+        OrthancPluginSendMultipartItem(context, output, file.GetFile().GetData(), file.GetFile().GetSize()) != 0)
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
     }
@@ -214,7 +318,7 @@ static void AnswerMetadata(OrthancPluginRestOutput* output,
                            const OrthancPluginHttpRequest* request,
                            const std::string& resource,
                            bool isInstance,
-                           bool isXml)
+                           OrthancPlugins::DicomResults::Format format)
 {
   OrthancPluginContext* context = OrthancPlugins::Configuration::GetContext();
 
@@ -240,7 +344,7 @@ static void AnswerMetadata(OrthancPluginRestOutput* output,
   }
 
   const std::string wadoBase = OrthancPlugins::Configuration::GetBaseUrl(request);
-  OrthancPlugins::DicomResults results(context, output, wadoBase, *dictionary_, isXml, true);
+  OrthancPlugins::DicomResults results(context, output, wadoBase, *dictionary_, format, true);
   
   for (std::list<std::string>::const_iterator
          it = files.begin(); it != files.end(); ++it)
@@ -248,7 +352,8 @@ static void AnswerMetadata(OrthancPluginRestOutput* output,
     OrthancPlugins::MemoryBuffer content(context);
     if (content.RestApiGet(*it, false))
     {
-      OrthancPlugins::ParsedDicomFile dicom(content);
+      // The metadata does not need the value of the pixel data
+      OrthancPlugins::ParsedDicomFile dicom(content, true /* header only */);
       results.Add(dicom.GetFile());
     }
   }
@@ -303,29 +408,39 @@ static bool LocateSeries(OrthancPluginRestOutput* output,
     return false;
   }
 
-  std::string id;
+  OrthancPlugins::HierarchyCache& cache = OrthancPlugins::HierarchyCache::GetInstance();
 
+  std::string id, studyInstanceUid;
+
+  if (!cache.LookupSeries(id, studyInstanceUid, request->groups[1]))
   {
-    char* tmp = OrthancPluginLookupSeries(context, request->groups[1]);
-    if (tmp == NULL)
+    const unsigned int revision = cache.GetRevision();
+
+    {
+      char* tmp = OrthancPluginLookupSeries(context, request->groups[1]);
+      if (tmp == NULL)
+      {
+        OrthancPlugins::Configuration::LogError("Accessing an inexistent series with WADO-RS: " + std::string(request->groups[1]));
+        OrthancPluginSendHttpStatusCode(context, output, 404);
+        return false;
+      }
+
+      id.assign(tmp);
+      OrthancPluginFreeString(context, tmp);
+    }
+  
+    Json::Value study;
+    if (!OrthancPlugins::RestApiGet(study, context, "/series/" + id + "/study", false))
     {
-      OrthancPlugins::Configuration::LogError("Accessing an inexistent series with WADO-RS: " + std::string(request->groups[1]));
       OrthancPluginSendHttpStatusCode(context, output, 404);
       return false;
     }
 
-    id.assign(tmp);
-    OrthancPluginFreeString(context, tmp);
-  }
-  
-  Json::Value study;
-  if (!OrthancPlugins::RestApiGet(study, context, "/series/" + id + "/study", false))
-  {
-    OrthancPluginSendHttpStatusCode(context, output, 404);
-    return false;
+    studyInstanceUid = study["MainDicomTags"]["StudyInstanceUID"].asString();
+    cache.StoreSeries(revision, request->groups[1], id, studyInstanceUid);
   }
 
-  if (study["MainDicomTags"]["StudyInstanceUID"].asString() != std::string(request->groups[0]))
+  if (studyInstanceUid != std::string(request->groups[0]))
   {
     OrthancPlugins::Configuration::LogError("No series " + std::string(request->groups[1]) + 
                                             " in study " + std::string(request->groups[0]));
@@ -350,32 +465,43 @@ bool LocateInstance(OrthancPluginRestOutput* output,
     return false;
   }
 
-  std::string id;
+  OrthancPlugins::HierarchyCache& cache = OrthancPlugins::HierarchyCache::GetInstance();
+
+  std::string id, seriesInstanceUid, studyInstanceUid;
 
+  if (!cache.LookupInstance(id, seriesInstanceUid, studyInstanceUid, request->groups[2]))
   {
-    char* tmp = OrthancPluginLookupInstance(context, request->groups[2]);
-    if (tmp == NULL)
+    const unsigned int revision = cache.GetRevision();
+
+    {
+      char* tmp = OrthancPluginLookupInstance(context, request->groups[2]);
+      if (tmp == NULL)
+      {
+        OrthancPlugins::Configuration::LogError("Accessing an inexistent instance with WADO-RS: " + 
+                                                std::string(request->groups[2]));
+        OrthancPluginSendHttpStatusCode(context, output, 404);
+        return false;
+      }
+
+      id.assign(tmp);
+      OrthancPluginFreeString(context, tmp);
+    }
+  
+    Json::Value study, series;
+    if (!OrthancPlugins::RestApiGet(series, context, "/instances/" + id + "/series", false) ||
+        !OrthancPlugins::RestApiGet(study, context, "/instances/" + id + "/study", false))
     {
-      OrthancPlugins::Configuration::LogError("Accessing an inexistent instance with WADO-RS: " + 
-                                              std::string(request->groups[2]));
       OrthancPluginSendHttpStatusCode(context, output, 404);
       return false;
     }
 
-    id.assign(tmp);
-    OrthancPluginFreeString(context, tmp);
-  }
-  
-  Json::Value study, series;
-  if (!OrthancPlugins::RestApiGet(series, context, "/instances/" + id + "/series", false) ||
-      !OrthancPlugins::RestApiGet(study, context, "/instances/" + id + "/study", false))
-  {
-    OrthancPluginSendHttpStatusCode(context, output, 404);
-    return false;
+    seriesInstanceUid = series["MainDicomTags"]["SeriesInstanceUID"].asString();
+    studyInstanceUid = study["MainDicomTags"]["StudyInstanceUID"].asString();
+    cache.StoreInstance(revision, request->groups[2], id, seriesInstanceUid, studyInstanceUid);
   }
 
-  if (study["MainDicomTags"]["StudyInstanceUID"].asString() != std::string(request->groups[0]) ||
-      series["MainDicomTags"]["SeriesInstanceUID"].asString() != std::string(request->groups[1]))
+  if (studyInstanceUid != std::string(request->groups[0]) ||
+      seriesInstanceUid != std::string(request->groups[1]))
   {
     OrthancPlugins::Configuration::LogError("No instance " + std::string(request->groups[2]) + 
                                             " in study " + std::string(request->groups[0]) + " or " +
@@ -464,8 +590,8 @@ void RetrieveStudyMetadata(OrthancPluginRestOutput* output,
                            const char* url,
                            const OrthancPluginHttpRequest* request)
 {
-  bool isXml;
-  if (!AcceptMetadata(request, isXml))
+  OrthancPlugins::DicomResults::Format format;
+  if (!AcceptMetadata(request, format))
   {
     OrthancPluginSendHttpStatusCode(OrthancPlugins::Configuration::GetContext(), output, 400 /* Bad request */);
   }
@@ -474,7 +600,7 @@ void RetrieveStudyMetadata(OrthancPluginRestOutput* output,
     std::string uri;
     if (LocateStudy(output, uri, request))
     {
-      AnswerMetadata(output, request, uri, false, isXml);
+      AnswerMetadata(output, request, uri, false, format);
     }
   }
 }
@@ -484,8 +610,8 @@ void RetrieveSeriesMetadata(OrthancPluginRestOutput* output,
                             const char* url,
                             const OrthancPluginHttpRequest* request)
 {
-  bool isXml;
-  if (!AcceptMetadata(request, isXml))
+  OrthancPlugins::DicomResults::Format format;
+  if (!AcceptMetadata(request, format))
   {
     OrthancPluginSendHttpStatusCode(OrthancPlugins::Configuration::GetContext(), output, 400 /* Bad request */);
   }
@@ -494,7 +620,7 @@ void RetrieveSeriesMetadata(OrthancPluginRestOutput* output,
     std::string uri;
     if (LocateSeries(output, uri, request))
     {
-      AnswerMetadata(output, request, uri, false, isXml);
+      AnswerMetadata(output, request, uri, false, format);
     }
   }
 }
@@ -504,8 +630,8 @@ void RetrieveInstanceMetadata(OrthancPluginRestOutput* output,
                               const char* url,
                               const OrthancPluginHttpRequest* request)
 {
-  bool isXml;
-  if (!AcceptMetadata(request, isXml))
+  OrthancPlugins::DicomResults::Format format;
+  if (!AcceptMetadata(request, format))
   {
     OrthancPluginSendHttpStatusCode(OrthancPlugins::Configuration::GetContext(), output, 400 /* Bad request */);
   }
@@ -514,7 +640,7 @@ void RetrieveInstanceMetadata(OrthancPluginRestOutput* output,
     std::string uri;
     if (LocateInstance(output, uri, request))
     {
-      AnswerMetadata(output, request, uri, true, isXml);
+      AnswerMetadata(output, request, uri, true, format);
     }
   }
 }
@@ -559,36 +685,176 @@ static bool ParseBulkTag(gdcm::Tag& tag,
 }
 
 
-static bool ExploreBulkData(std::string& content,
-                            const std::vector<std::string>& path,
-                            size_t position,
+static bool ParseBulkPath(std::vector<gdcm::Tag>& tags,
+                          std::vector<unsigned int>& items,
+                          const std::string& uri)
+{
+  // The path alternates the tags and the 1-based indices of the items
+  // in the sequences, e.g. "00540016/1/00181074"
+  std::vector<std::string> path;
+  Orthanc::Toolbox::TokenizeString(path, uri, '/');
+
+  if (path.size() % 2 != 1)
+  {
+    return false;
+  }
+
+  tags.resize((path.size() + 1) / 2);
+  items.resize(path.size() / 2);
+
+  for (size_t i = 0; i < path.size(); i++)
+  {
+    if (i % 2 == 0)
+    {
+      if (!ParseBulkTag(tags[i / 2], path[i]))
+      {
+        return false;
+      }
+    }
+    else
+    {
+      try
+      {
+        items[i / 2] = boost::lexical_cast<unsigned int>(path[i]);
+      }
+      catch (boost::bad_lexical_cast&)
+      {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+
+static bool ExploreBulkData(const char*& content /* out */,
+                            size_t& size /* out */,
+                            const std::vector<gdcm::Tag>& tags,
+                            const std::vector<unsigned int>& items,
+                            size_t level,
                             const gdcm::DataSet& dataset)
 {
-  gdcm::Tag tag;
-  if (!ParseBulkTag(tag, path[position]) ||
-      !dataset.FindDataElement(tag))
+  if (!dataset.FindDataElement(tags[level]))
   {
     return false;
   }
 
-  const gdcm::DataElement& element = dataset.GetDataElement(tag);
+  const gdcm::DataElement& element = dataset.GetDataElement(tags[level]);
 
-  if (position + 1 == path.size())
+  if (level + 1 == tags.size())
   {
+    // Point to the value of the element, that remains owned by the dataset
     const gdcm::ByteValue* data = element.GetByteValue();
     if (!data)
     {
-      content.clear();
+      content = NULL;
+      size = 0;
     }
     else
     {
-      content.assign(data->GetPointer(), data->GetLength());
+      content = data->GetPointer();
+      size = data->GetLength();
     }
 
     return true;
   }
 
-  return false;
+  gdcm::SmartPointer<gdcm::SequenceOfItems> sequence = element.GetValueAsSQ();
+  if (sequence.GetPointer() == NULL ||
+      items[level] == 0 ||
+      items[level] > sequence->GetNumberOfItems())
+  {
+    return false;
+  }
+
+  return ExploreBulkData(content, size, tags, items, level + 1,
+                         sequence->GetItem(items[level]).GetNestedDataSet());
+}
+
+
+static void AnswerBulkData(OrthancPluginRestOutput* output,
+                           const char* content,
+                           size_t size,
+                           std::string range)
+{
+  OrthancPluginContext* context = OrthancPlugins::Configuration::GetContext();
+
+  uint64_t start = 0;
+  uint64_t end = size;
+
+  if (!range.empty())
+  {
+    switch (OrthancPlugins::ParseByteRange(start, end, range, size))
+    {
+      case OrthancPlugins::ByteRangeStatus_Satisfiable:
+        break;
+
+      case OrthancPlugins::ByteRangeStatus_Invalid:
+        // RFC 7233, section 3.1: Ignore the range, and send the whole
+        // bulk data (this includes the lists of ranges)
+        OrthancPlugins::Configuration::LogInfo("Ignoring the unsupported range \"" + range + "\" of a bulk data");
+        range.clear();
+        start = 0;
+        end = size;
+        break;
+
+      case OrthancPlugins::ByteRangeStatus_Unsatisfiable:
+      {
+        OrthancPlugins::Configuration::LogError("Cannot satisfy the range \"" + range + "\" of a bulk data of " +
+                                                boost::lexical_cast<std::string>(size) + " bytes");
+
+        // RFC 7233, section 4.4: Report the size of the bulk data
+        std::string contentRange = "bytes */" + boost::lexical_cast<std::string>(size);
+        OrthancPluginSetHttpHeader(context, output, "Content-Range", contentRange.c_str());
+        OrthancPluginSendHttpStatusCode(context, output, 416 /* Range Not Satisfiable */);
+        return;
+      }
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+
+  // The bulk data is always sent as a "multipart/related" answer with
+  // a "200 OK" status, even for a range request: The plugin SDK can
+  // neither send a "206 Partial Content" status, nor a multipart
+  // answer with another status. The range is thus reported by the
+  // "Content-Range" header of the part, if the SDK supports it.
+
+  if (OrthancPluginStartMultipartAnswer(context, output, "related", "application/octet-stream") != 0)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_Plugin);
+  }
+
+  // Only the requested slice is sent, directly from the parsed file
+  const char* slice = (content == NULL ? NULL : content + start);
+  const size_t sliceSize = static_cast<size_t>(end - start);
+
+  OrthancPluginErrorCode error;
+
+#if HAS_SEND_MULTIPART_ITEM_2 == 1
+  if (!range.empty())
+  {
+    std::string contentRange = ("bytes " + boost::lexical_cast<std::string>(start) + "-" +
+                                boost::lexical_cast<std::string>(end - 1) + "/" +
+                                boost::lexical_cast<std::string>(size));
+    const char *keys[] = { "Content-Range" };
+    const char *values[] = { contentRange.c_str() };
+    error = OrthancPluginSendMultipartItem2(context, output, slice, sliceSize, 1, keys, values);
+  }
+  else
+  {
+    error = OrthancPluginSendMultipartItem(context, output, slice, sliceSize);
+  }
+#else
+  error = OrthancPluginSendMultipartItem(context, output, slice, sliceSize);
+#endif
+
+  if (error != OrthancPluginErrorCode_Success)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_Plugin);
+  }
 }
 
 
@@ -598,35 +864,71 @@ void RetrieveBulkData(OrthancPluginRestOutput* output,
 {
   OrthancPluginContext* context = OrthancPlugins::Configuration::GetContext();
 
-  if (!AcceptBulkData(request))
+  std::string range;
+  if (!AcceptBulkData(range, request))
   {
     OrthancPluginSendHttpStatusCode(context, output, 400 /* Bad request */);
     return;
   }
 
+  // The HTTP "Range" header has precedence over the "range" media
+  // type parameter
+  std::string header;
+  if (OrthancPlugins::LookupHttpHeader(header, request, "range"))
+  {
+    range = header;
+  }
+
   std::string uri;
   OrthancPlugins::MemoryBuffer content(context);
   if (LocateInstance(output, uri, request) &&
       content.RestApiGet(uri + "/file", false))
   {
-    OrthancPlugins::ParsedDicomFile dicom(content);
+    std::vector<gdcm::Tag> tags;
+    std::vector<unsigned int> items;
+    if (!ParseBulkPath(tags, items, request->groups[3]))
+    {
+      OrthancPluginSendHttpStatusCode(context, output, 400 /* Bad request */);
+      return;
+    }
+
+    const char* bulk = NULL;
+    size_t size = 0;
+
+    // Only walk through the elements on the path to the bulk data,
+    // skipping the other ones using their length
+    OrthancPlugins::RawDicomParser parser(content.GetData(), content.GetSize());
 
-    std::vector<std::string> path;
-    Orthanc::Toolbox::TokenizeString(path, request->groups[3], '/');
-      
-    std::string result;
-    if (path.size() % 2 == 1 &&
-        ExploreBulkData(result, path, 0, dicom.GetDataSet()))
+    switch (parser.LookupValue(bulk, size, tags, items))
     {
-      if (OrthancPluginStartMultipartAnswer(context, output, "related", "application/octet-stream") != 0 ||
-          OrthancPluginSendMultipartItem(context, output, result.c_str(), result.size()) != 0)
+      case OrthancPlugins::RawDicomParser::Status_Found:
+        AnswerBulkData(output, bulk, size, range);
+        break;
+
+      case OrthancPlugins::RawDicomParser::Status_NotFound:
+        OrthancPluginSendHttpStatusCode(context, output, 400 /* Bad request */);
+        break;
+
+      case OrthancPlugins::RawDicomParser::Status_Unsupported:
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_Plugin);
+        // Deflated transfer syntax, encapsulated pixel data, or file
+        // that is not well-formed: Fall back to a full parsing by GDCM
+        OrthancPlugins::ParsedDicomFile dicom(content);
+
+        if (ExploreBulkData(bulk, size, tags, items, 0, dicom.GetDataSet()))
+        {
+          AnswerBulkData(output, bulk, size, range);
+        }
+        else
+        {
+          OrthancPluginSendHttpStatusCode(context, output, 400 /* Bad request */);
+        }
+
+        break;
       }
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
     }
-    else
-    {
-      OrthancPluginSendHttpStatusCode(context, output, 400 /* Bad request */);
-    }      
   }
 }
@@ -59,3 +59,8 @@ void RetrieveBulkData(OrthancPluginRestOutput* output,
 void RetrieveFrames(OrthancPluginRestOutput* output,
                     const char* url,
                     const OrthancPluginHttpRequest* request);
+
+// The threads transcoding the frames are shared by all the requests
+void InitializeTranscodingThreads(unsigned int countThreads);
+
+void FinalizeTranscodingThreads();
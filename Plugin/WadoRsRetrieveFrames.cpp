@@ -22,16 +22,23 @@
 #include "WadoRs.h"
 
 #include "Dicom.h"
+#include "FrameCache.h"
+#include "FrameIndex.h"
+#include "MemoryStream.h"
+#include "OrderedTasksPool.h"
 #include "Plugin.h"
 
 #include <Core/Toolbox.h>
 
 #include <memory>
 #include <list>
+#include <gdcmFragment.h>
+#include <gdcmImage.h>
 #include <gdcmImageReader.h>
-#include <gdcmImageWriter.h>
+#include <gdcmSequenceOfFragments.h>
 #include <gdcmImageChangeTransferSyntax.h>
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/lexical_cast.hpp>
 
 
@@ -318,7 +325,6 @@ static const char* GetMimeType(const gdcm::TransferSyntax& syntax)
 
 static void AnswerSingleFrame(OrthancPluginRestOutput* output,
                               const OrthancPluginHttpRequest* request,
-                              const OrthancPlugins::ParsedDicomFile& dicom,
                               const char* frame,
                               size_t size,
                               unsigned int frameIndex)
@@ -326,7 +332,12 @@ static void AnswerSingleFrame(OrthancPluginRestOutput* output,
   OrthancPluginErrorCode error;
 
 #if HAS_SEND_MULTIPART_ITEM_2 == 1
-  std::string location = dicom.GetWadoUrl(request) + "frames/" + boost::lexical_cast<std::string>(frameIndex + 1);
+  // The UIDs in the URI were checked against the instance by "LocateInstance()"
+  std::string location = (OrthancPlugins::Configuration::GetWadoUrl(OrthancPlugins::Configuration::GetBaseUrl(request),
+                                                                    request->groups[0],
+                                                                    request->groups[1],
+                                                                    request->groups[2]) +
+                          "frames/" + boost::lexical_cast<std::string>(frameIndex + 1));
   const char *keys[] = { "Content-Location" };
   const char *values[] = { location.c_str() };
   error = OrthancPluginSendMultipartItem2(OrthancPlugins::Configuration::GetContext(), output, frame, size, 1, keys, values);
@@ -342,6 +353,49 @@ static void AnswerSingleFrame(OrthancPluginRestOutput* output,
 
 
 
+static bool AnswerFramesFromCache(OrthancPluginRestOutput* output,
+                                  const OrthancPluginHttpRequest* request,
+                                  const std::string& instanceId,
+                                  const gdcm::TransferSyntax& syntax,
+                                  const std::list<unsigned int>& frames)
+{
+  if (frames.empty())
+  {
+    return false;  // The number of frames is unknown without parsing the instance
+  }
+
+  OrthancPlugins::FrameCache& cache = OrthancPlugins::FrameCache::GetInstance();
+
+  std::vector<std::string> content(frames.size());
+
+  size_t i = 0;
+  for (std::list<unsigned int>::const_iterator 
+         frame = frames.begin(); frame != frames.end(); ++frame, i++)
+  {
+    if (!cache.Lookup(content[i], instanceId, syntax.GetString(), *frame))
+    {
+      return false;
+    }
+  }
+
+  if (OrthancPluginStartMultipartAnswer(OrthancPlugins::Configuration::GetContext(), 
+                                        output, "related", GetMimeType(syntax)) != OrthancPluginErrorCode_Success)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+  }
+
+  i = 0;
+  for (std::list<unsigned int>::const_iterator 
+         frame = frames.begin(); frame != frames.end(); ++frame, i++)
+  {
+    AnswerSingleFrame(output, request, content[i].c_str(), content[i].size(), *frame);
+  }
+
+  return true;
+}
+
+
+
 static bool AnswerFrames(OrthancPluginRestOutput* output,
                          const OrthancPluginHttpRequest* request,
                          const OrthancPlugins::ParsedDicomFile& dicom,
@@ -415,41 +469,46 @@ static bool AnswerFrames(OrthancPluginRestOutput* output,
       else
       {
         const char* p = buffer + (*frame) * frameSize;
-        AnswerSingleFrame(output, request, dicom, p, frameSize, *frame);
+        AnswerSingleFrame(output, request, p, frameSize, *frame);
       }
     }
   }
   else
   {
-    // Multi-fragment image, we assume that each fragment corresponds to one frame
+    // Multi-fragment image, the fragments of each frame are located
+    // using the offset tables or the markers of the codec
+    OrthancPlugins::FrameIndex index(*fragments, dicom.GetDataSet(), 
+                                     OrthancPlugins::FrameIndex::GetFramesCount(dicom.GetDataSet()));
 
     if (frames.empty())
     {
       // If no frame is provided, return all the frames (this is an extension)
-      for (size_t i = 0; i < fragments->GetNumberOfFragments(); i++)
+      for (unsigned int i = 0; i < index.GetFramesCount(); i++)
       {
         frames.push_back(i);
       }
     }
 
+    std::string buffer;
+
     for (std::list<unsigned int>::const_iterator 
            frame = frames.begin(); frame != frames.end(); ++frame)
     {
-      if (*frame >= fragments->GetNumberOfFragments())
+      if (*frame >= index.GetFramesCount())
       {
-        // TODO A frame is not a fragment, looks like a bug
         OrthancPlugins::Configuration::LogError("Trying to access frame number " + 
                                                 boost::lexical_cast<std::string>(*frame + 1) + 
                                                 " of an image with " + 
-                                                boost::lexical_cast<std::string>(fragments->GetNumberOfFragments()) + 
+                                                boost::lexical_cast<std::string>(index.GetFramesCount()) + 
                                                 " frames");
         throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
       }
       else
       {
-        AnswerSingleFrame(output, request, dicom,
-                          fragments->GetFragment(*frame).GetByteValue()->GetPointer(),
-                          fragments->GetFragment(*frame).GetByteValue()->GetLength(), *frame);
+        const char* content = NULL;
+        size_t size = 0;
+        index.GetFrame(content, size, buffer, *frame);
+        AnswerSingleFrame(output, request, content, size, *frame);
       }
     }
   }
@@ -459,6 +518,308 @@ static bool AnswerFrames(OrthancPluginRestOutput* output,
 
 
 
+static void AppendFragments(std::string& target,
+                            const gdcm::SequenceOfFragments& fragments,
+                            size_t start,
+                            size_t end)
+{
+  for (size_t i = start; i < end; i++)
+  {
+    const gdcm::ByteValue* value = fragments.GetFragment(i).GetByteValue();
+    if (value != NULL)
+    {
+      target.append(value->GetPointer(), value->GetLength());
+    }
+  }
+}
+
+
+
+// The lookup table of a palette image is shared between the source
+// image and the frames, and the reference counters of GDCM are not
+// thread-safe: The palette images are transcoded one frame at a time
+static boost::mutex  paletteMutex_;
+
+
+static void TranscodeSingleFrame(std::string& target,
+                                 const gdcm::Image& source,
+                                 const OrthancPlugins::FrameIndex* index,
+                                 unsigned int frame,
+                                 const gdcm::TransferSyntax& targetSyntax)
+{
+  const gdcm::DataElement& pixelData = source.GetDataElement();
+  const gdcm::SequenceOfFragments* fragments = pixelData.GetSequenceOfFragments();
+
+  // Only keep the pixel data of the requested frame
+  gdcm::DataElement element(OrthancPlugins::DICOM_TAG_PIXEL_DATA);
+  std::string compressed;
+
+  if (fragments == NULL)
+  {
+    const gdcm::ByteValue* value = pixelData.GetByteValue();
+    if (value == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+    }
+
+    const unsigned int framesCount = (source.GetNumberOfDimensions() == 3 ? source.GetDimension(2) : 1);
+
+    const char* content = NULL;
+    size_t size = 0;
+    OrthancPlugins::FrameIndex::GetNativeFrame(content, size, *value, framesCount, frame);
+
+    element.SetByteValue(content, size);
+  }
+  else
+  {
+    if (index == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+
+    index->GetFrame(compressed, frame);
+
+    gdcm::Fragment fragment;
+    fragment.SetByteValue(compressed.c_str(), compressed.size());
+
+    gdcm::SmartPointer<gdcm::SequenceOfFragments> sequence = new gdcm::SequenceOfFragments;
+    sequence->AddFragment(fragment);
+
+    element.SetValue(*sequence);
+  }
+
+  // Declared before "image", so as to be released after its destruction
+  std::auto_ptr<boost::mutex::scoped_lock> paletteLock;
+
+  const bool isPalette = (source.GetPhotometricInterpretation() == 
+                          gdcm::PhotometricInterpretation::PALETTE_COLOR);
+  if (isPalette)
+  {
+    paletteLock.reset(new boost::mutex::scoped_lock(paletteMutex_));
+  }
+
+  gdcm::Image image;
+  image.SetNumberOfDimensions(2);
+  image.SetDimension(0, source.GetDimension(0));
+  image.SetDimension(1, source.GetDimension(1));
+  image.SetPixelFormat(source.GetPixelFormat());
+  image.SetPhotometricInterpretation(source.GetPhotometricInterpretation());
+  image.SetPlanarConfiguration(source.GetPlanarConfiguration());
+  image.SetTransferSyntax(source.GetTransferSyntax());
+  image.SetNeedByteSwap(source.GetNeedByteSwap());
+  image.SetDataElement(element);
+
+  if (isPalette)
+  {
+    image.SetLUT(source.GetLUT());
+  }
+
+  gdcm::ImageChangeTransferSyntax change;
+  change.SetTransferSyntax(targetSyntax);
+  change.SetInput(image);
+
+  if (!change.Change())
+  {
+    OrthancPlugins::Configuration::LogError("Cannot change the transfer syntax of the image");
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+
+  const gdcm::DataElement& result = change.GetOutput().GetDataElement();
+  const gdcm::SequenceOfFragments* resultFragments = result.GetSequenceOfFragments();
+
+  target.clear();
+
+  if (resultFragments != NULL)
+  {
+    AppendFragments(target, *resultFragments, 0, resultFragments->GetNumberOfFragments());
+  }
+  else if (result.GetByteValue() != NULL)
+  {
+    target.assign(result.GetByteValue()->GetPointer(), result.GetByteValue()->GetLength());
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+}
+
+
+
+// Worker threads that transcode the frames, shared by all the
+// RetrieveFrames requests. If NULL, the frames are transcoded by the
+// HTTP threads of Orthanc.
+static std::auto_ptr<OrthancPlugins::OrderedTasksPool::SharedWorkers>  transcodingWorkers_;
+
+
+void InitializeTranscodingThreads(unsigned int countThreads)
+{
+  if (countThreads <= 1)
+  {
+    transcodingWorkers_.reset(NULL);
+  }
+  else
+  {
+    transcodingWorkers_.reset(new OrthancPlugins::OrderedTasksPool::SharedWorkers(countThreads));
+  }
+}
+
+
+void FinalizeTranscodingThreads()
+{
+  transcodingWorkers_.reset(NULL);
+}
+
+
+namespace
+{
+  class TranscodeFrameTask : public OrthancPlugins::OrderedTasksPool::ITask
+  {
+  private:
+    const gdcm::Image&                 source_;
+    const OrthancPlugins::FrameIndex*  index_;
+    unsigned int                       frame_;
+    const gdcm::TransferSyntax&        targetSyntax_;
+    std::string                        transcoded_;
+
+  public:
+    TranscodeFrameTask(const gdcm::Image& source,
+                       const OrthancPlugins::FrameIndex* index,
+                       unsigned int frame,
+                       const gdcm::TransferSyntax& targetSyntax) :
+      source_(source),
+      index_(index),
+      frame_(frame),
+      targetSyntax_(targetSyntax)
+    {
+    }
+
+    virtual void Execute()
+    {
+      TranscodeSingleFrame(transcoded_, source_, index_, frame_, targetSyntax_);
+    }
+
+    unsigned int GetFrame() const
+    {
+      return frame_;
+    }
+
+    const std::string& GetTranscoded() const
+    {
+      return transcoded_;
+    }
+  };
+}
+
+
+
+static void TranscodeFrames(OrthancPluginRestOutput* output,
+                            const OrthancPluginHttpRequest* request,
+                            const OrthancPlugins::MemoryBuffer& content,
+                            const gdcm::TransferSyntax& targetSyntax,
+                            std::list<unsigned int>& frames,
+                            const std::string& instanceId,
+                            unsigned int cacheRevision)
+{
+  // The image is read (but not decoded) once, then only the requested
+  // frames are decoded and re-encoded, one by one
+  OrthancPlugins::MemoryInputStream stream(content.GetData(), content.GetSize());
+
+  gdcm::ImageReader reader;
+  reader.SetStream(stream);
+  if (!reader.Read())
+  {
+    OrthancPlugins::Configuration::LogError("Cannot decode the image");
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+  }
+
+  const gdcm::Image& source = reader.GetImage();
+  const unsigned int framesCount = (source.GetNumberOfDimensions() == 3 ? source.GetDimension(2) : 1);
+
+  // Locate the fragments of each frame once for all the frames
+  std::auto_ptr<OrthancPlugins::FrameIndex> index;
+
+  const gdcm::SequenceOfFragments* fragments = source.GetDataElement().GetSequenceOfFragments();
+  if (fragments != NULL)
+  {
+    index.reset(new OrthancPlugins::FrameIndex(*fragments, reader.GetFile().GetDataSet(), framesCount));
+  }
+
+  if (frames.empty())
+  {
+    // If no frame is provided, return all the frames (this is an extension)
+    for (unsigned int i = 0; i < framesCount; i++)
+    {
+      frames.push_back(i);
+    }
+  }
+
+  for (std::list<unsigned int>::const_iterator 
+         frame = frames.begin(); frame != frames.end(); ++frame)
+  {
+    if (*frame >= framesCount)
+    {
+      OrthancPlugins::Configuration::LogError("Trying to access frame number " + boost::lexical_cast<std::string>(*frame + 1) + 
+                                              " of an image with " + boost::lexical_cast<std::string>(framesCount) + " frames");
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+  if (OrthancPluginStartMultipartAnswer(OrthancPlugins::Configuration::GetContext(), 
+                                        output, "related", GetMimeType(targetSyntax)) != OrthancPluginErrorCode_Success)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+  }
+
+  // The frames are independent, so they are transcoded by the
+  // threads that are shared by all the requests. The pool gives the
+  // frames back in the order of the request, and the number of frames
+  // in flight is bounded.
+  std::auto_ptr<OrthancPlugins::OrderedTasksPool> pool;
+  size_t maxInFlight;
+
+  if (transcodingWorkers_.get() == NULL ||
+      frames.size() <= 1)
+  {
+    pool.reset(new OrthancPlugins::OrderedTasksPool(0));  // Use the current thread
+    maxInFlight = 1;
+  }
+  else
+  {
+    pool.reset(new OrthancPlugins::OrderedTasksPool(*transcodingWorkers_));
+    maxInFlight = 2 * transcodingWorkers_->GetThreadsCount();
+  }
+
+  OrthancPlugins::FrameCache& cache = OrthancPlugins::FrameCache::GetInstance();
+
+  std::list<unsigned int>::const_iterator next = frames.begin();
+
+  for (;;)
+  {
+    while (next != frames.end() &&
+           pool->GetSize() < maxInFlight)
+    {
+      pool->Push(new TranscodeFrameTask(source, index.get(), *next, targetSyntax));
+      ++next;
+    }
+
+    if (pool->GetSize() == 0)
+    {
+      break;  // Done
+    }
+
+    std::auto_ptr<OrthancPlugins::OrderedTasksPool::ITask> task(pool->Dequeue());
+
+    const TranscodeFrameTask& frame = dynamic_cast<const TranscodeFrameTask&>(*task);
+    const std::string& transcoded = frame.GetTranscoded();
+
+    cache.Store(cacheRevision, instanceId, targetSyntax.GetString(), frame.GetFrame(),
+                transcoded.c_str(), transcoded.size());
+    AnswerSingleFrame(output, request, transcoded.c_str(), transcoded.size(), frame.GetFrame());
+  }
+}
+
+
+
 void RetrieveFrames(OrthancPluginRestOutput* output,
                     const char* url,
                     const OrthancPluginHttpRequest* request)
@@ -470,12 +831,27 @@ void RetrieveFrames(OrthancPluginRestOutput* output,
   std::list<unsigned int> frames;
   ParseFrameList(frames, request);
 
-  Json::Value header;
   std::string uri;
+  if (!LocateInstance(output, uri, request))
+  {
+    return;
+  }
+
+  // Extract the Orthanc identifier from "/instances/{id}"
+  const std::string instanceId = uri.substr(uri.rfind('/') + 1);
+
+  if (AnswerFramesFromCache(output, request, instanceId, targetSyntax, frames))
+  {
+    // All the frames were already transcoded, no need to read the file
+    return;
+  }
+
+  // Read before the file is downloaded, so that the transcoded frames
+  // are not cached if the instance is deleted in the meantime
+  const unsigned int cacheRevision = OrthancPlugins::FrameCache::GetInstance().GetRevision();
+
   OrthancPlugins::MemoryBuffer content(context);
-  if (LocateInstance(output, uri, request) &&
-      content.RestApiGet(uri + "/file", false) &&
-      OrthancPlugins::RestApiGet(header, context, uri + "/header?simplify", false))
+  if (content.RestApiGet(uri + "/file", false))
   {
     {
       std::string s = "DICOMweb RetrieveFrames on " + uri + ", frames: ";
@@ -492,10 +868,14 @@ void RetrieveFrames(OrthancPluginRestOutput* output,
 
     gdcm::TransferSyntax sourceSyntax;
 
-    if (header.type() == Json::objectValue &&
-        header.isMember("TransferSyntaxUID"))
+    // The transfer syntax is directly read from the meta header of
+    // the file, which avoids one REST call to Orthanc
+    const std::string syntax = OrthancPlugins::RawDicomParser(
+      content.GetData(), content.GetSize()).GetTransferSyntax();
+
+    if (!syntax.empty())
     {
-      sourceSyntax = gdcm::TransferSyntax::GetTSType(header["TransferSyntaxUID"].asCString());
+      sourceSyntax = gdcm::TransferSyntax::GetTSType(syntax.c_str());
     }
     else
     {
@@ -526,41 +906,7 @@ void RetrieveFrames(OrthancPluginRestOutput* output,
                                                " to " + std::string(targetSyntax.GetString()));
       }
 
-      gdcm::ImageChangeTransferSyntax change;
-      change.SetTransferSyntax(targetSyntax);
-
-      // TODO Avoid this unnecessary memcpy by defining a stream over the MemoryBuffer
-      std::string dicom(content.GetData(), content.GetData() + content.GetSize());
-      std::stringstream stream(dicom);
-
-      gdcm::ImageReader reader;
-      reader.SetStream(stream);
-      if (!reader.Read())
-      {
-        OrthancPlugins::Configuration::LogError("Cannot decode the image");
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
-      }
-
-      change.SetInput(reader.GetImage());
-      if (!change.Change())
-      {
-        OrthancPlugins::Configuration::LogError("Cannot change the transfer syntax of the image");
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
-      }
-
-      gdcm::ImageWriter writer;
-      writer.SetImage(change.GetOutput());
-      writer.SetFile(reader.GetFile());
-      
-      std::stringstream ss;
-      writer.SetStream(ss);
-      if (!writer.Write())
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
-      }
-
-      OrthancPlugins::ParsedDicomFile transcoded(ss.str());
-      AnswerFrames(output, request, transcoded, targetSyntax, frames);
+      TranscodeFrames(output, request, content, targetSyntax, frames, instanceId, cacheRevision);
     }
   }    
 }
@@ -20,10 +20,26 @@
 
 
 #include <gtest/gtest.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/regex.hpp>
+#include <gdcmGlobal.h>
 
+#include "../Plugin/BulkDataIndex.h"
 #include "../Plugin/Configuration.h"
+#include "../Plugin/DerivedTagsCache.h"
+#include "../Plugin/Dicom.h"
+#include "../Plugin/FrameCache.h"
+#include "../Plugin/FrameIndex.h"
+#include "../Plugin/HierarchyCache.h"
+#include "../Plugin/MemoryStream.h"
+#include "../Plugin/MultipartStreamReader.h"
+#include "../Plugin/OrderedTasksPool.h"
 #include "../Plugin/Plugin.h"
+#include "../Plugin/RawDicomParser.h"
+#include "../Plugin/Semaphore.h"
+#include "../Plugin/StowRequestBody.h"
+#include "../Plugin/TransferJobs.h"
 
 using namespace OrthancPlugins;
 
@@ -60,6 +76,1471 @@ TEST(ContentType, Parse)
 }
 
 
+namespace
+{
+  class SquareTask : public OrderedTasksPool::ITask
+  {
+  private:
+    unsigned int  value_;
+    unsigned int  result_;
+
+  public:
+    explicit SquareTask(unsigned int value) :
+      value_(value),
+      result_(0)
+    {
+    }
+
+    virtual void Execute()
+    {
+      if (value_ == 13)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+      }
+
+      // Give a chance to the next tasks to complete first
+      boost::this_thread::sleep(boost::posix_time::milliseconds(value_ % 3));
+      result_ = value_ * value_;
+    }
+
+    unsigned int GetResult() const
+    {
+      return result_;
+    }
+  };
+}
+
+
+TEST(ByteRange, Parse)
+{
+  uint64_t start, end;
+
+  ASSERT_EQ(ByteRangeStatus_Satisfiable, ParseByteRange(start, end, "bytes=0-99", 1000));
+  ASSERT_EQ(0u, start);
+  ASSERT_EQ(100u, end);
+
+  ASSERT_EQ(ByteRangeStatus_Satisfiable, ParseByteRange(start, end, "10-19", 1000));
+  ASSERT_EQ(10u, start);
+  ASSERT_EQ(20u, end);
+
+  ASSERT_EQ(ByteRangeStatus_Satisfiable, ParseByteRange(start, end, "bytes=500-", 1000));
+  ASSERT_EQ(500u, start);
+  ASSERT_EQ(1000u, end);
+
+  ASSERT_EQ(ByteRangeStatus_Satisfiable, ParseByteRange(start, end, "bytes=-100", 1000));
+  ASSERT_EQ(900u, start);
+  ASSERT_EQ(1000u, end);
+
+  ASSERT_EQ(ByteRangeStatus_Satisfiable, ParseByteRange(start, end, "bytes=-2000", 1000));
+  ASSERT_EQ(0u, start);
+  ASSERT_EQ(1000u, end);
+
+  ASSERT_EQ(ByteRangeStatus_Satisfiable, ParseByteRange(start, end, "bytes=990-2000", 1000));
+  ASSERT_EQ(990u, start);
+  ASSERT_EQ(1000u, end);
+
+  ASSERT_EQ(ByteRangeStatus_Unsatisfiable, ParseByteRange(start, end, "bytes=1000-", 1000));
+  ASSERT_EQ(ByteRangeStatus_Unsatisfiable, ParseByteRange(start, end, "bytes=-0", 1000));
+  ASSERT_EQ(ByteRangeStatus_Unsatisfiable, ParseByteRange(start, end, "bytes=0-", 0));
+
+  ASSERT_EQ(ByteRangeStatus_Invalid, ParseByteRange(start, end, "bytes=20-10", 1000));
+  ASSERT_EQ(ByteRangeStatus_Invalid, ParseByteRange(start, end, "bytes=-", 1000));
+  ASSERT_EQ(ByteRangeStatus_Invalid, ParseByteRange(start, end, "bytes=0-9,20-29", 1000));
+  ASSERT_EQ(ByteRangeStatus_Invalid, ParseByteRange(start, end, "lines=0-9", 1000));
+}
+
+
+TEST(OrderedTasksPool, Order)
+{
+  for (unsigned int threads = 0; threads <= 4; threads++)
+  {
+    OrderedTasksPool pool(threads);
+    ASSERT_EQ(threads, pool.GetThreadsCount());
+    ASSERT_THROW(pool.Dequeue(), Orthanc::OrthancException);
+
+    for (unsigned int i = 0; i < 20; i++)
+    {
+      pool.Push(new SquareTask(i));
+    }
+
+    ASSERT_EQ(20u, pool.GetSize());
+
+    for (unsigned int i = 0; i < 20; i++)
+    {
+      if (i == 13)
+      {
+        ASSERT_THROW(pool.Dequeue(), Orthanc::OrthancException);
+      }
+      else
+      {
+        std::auto_ptr<OrderedTasksPool::ITask> task(pool.Dequeue());
+        ASSERT_EQ(i * i, dynamic_cast<SquareTask&>(*task).GetResult());
+      }
+    }
+
+    ASSERT_EQ(0u, pool.GetSize());
+
+    // Pending tasks must be released by the destructor
+    pool.Push(new SquareTask(2));
+    pool.Push(new SquareTask(3));
+  }
+}
+
+
+namespace
+{
+  void PushSquareTasks(OrderedTasksPool::SharedWorkers* workers,
+                       unsigned int* failures)
+  {
+    OrderedTasksPool pool(*workers);
+
+    for (unsigned int i = 0; i < 50; i++)
+    {
+      pool.Push(new SquareTask(i));
+    }
+
+    for (unsigned int i = 0; i < 50; i++)
+    {
+      try
+      {
+        std::auto_ptr<OrderedTasksPool::ITask> task(pool.Dequeue());
+        if (dynamic_cast<SquareTask&>(*task).GetResult() != i * i)
+        {
+          (*failures)++;
+        }
+      }
+      catch (Orthanc::OrthancException&)
+      {
+        if (i != 13)
+        {
+          (*failures)++;
+        }
+      }
+    }
+
+    // The tasks that are not dequeued are withdrawn from the workers
+    for (unsigned int i = 0; i < 20; i++)
+    {
+      pool.Push(new SquareTask(i));
+    }
+  }
+}
+
+
+TEST(OrderedTasksPool, SharedWorkers)
+{
+  ASSERT_THROW(OrderedTasksPool::SharedWorkers(0), Orthanc::OrthancException);
+
+  OrderedTasksPool::SharedWorkers workers(3);
+  ASSERT_EQ(3u, workers.GetThreadsCount());
+
+  {
+    OrderedTasksPool pool(workers);
+    ASSERT_EQ(3u, pool.GetThreadsCount());
+    ASSERT_THROW(pool.Dequeue(), Orthanc::OrthancException);
+  }
+
+  // Several pools use the same workers concurrently
+  unsigned int failures[4] = { 0, 0, 0, 0 };
+  std::vector<boost::thread*> threads;
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    threads.push_back(new boost::thread(PushSquareTasks, &workers, &failures[i]));
+  }
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    threads[i]->join();
+    delete threads[i];
+    ASSERT_EQ(0u, failures[i]);
+  }
+}
+
+
+namespace
+{
+  class SemaphoreTask : public OrderedTasksPool::ITask
+  {
+  private:
+    Semaphore&     semaphore_;
+    boost::mutex&  mutex_;
+    unsigned int&  current_;
+    unsigned int&  maximum_;
+
+  public:
+    SemaphoreTask(Semaphore& semaphore,
+                  boost::mutex& mutex,
+                  unsigned int& current,
+                  unsigned int& maximum) :
+      semaphore_(semaphore),
+      mutex_(mutex),
+      current_(current),
+      maximum_(maximum)
+    {
+    }
+
+    virtual void Execute()
+    {
+      Semaphore::Locker locker(semaphore_);
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        current_++;
+
+        if (current_ > maximum_)
+        {
+          maximum_ = current_;
+        }
+      }
+
+      boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        current_--;
+      }
+    }
+  };
+}
+
+
+TEST(Semaphore, Basic)
+{
+  ASSERT_THROW(Semaphore(0), Orthanc::OrthancException);
+
+  Semaphore semaphore(2);
+  boost::mutex mutex;
+  unsigned int current = 0;
+  unsigned int maximum = 0;
+
+  {
+    OrderedTasksPool pool(5);
+
+    for (unsigned int i = 0; i < 20; i++)
+    {
+      pool.Push(new SemaphoreTask(semaphore, mutex, current, maximum));
+    }
+
+    while (pool.GetSize() > 0)
+    {
+      delete pool.Dequeue();
+    }
+  }
+
+  ASSERT_EQ(0u, current);
+  ASSERT_LE(1u, maximum);
+  ASSERT_GE(2u, maximum);
+}
+
+
+namespace
+{
+  class DummyTransferJob : public TransferJobs::IJob
+  {
+  private:
+    bool         fail_;
+    bool         waitCancel_;
+    std::string  answer_;
+
+  public:
+    DummyTransferJob(bool fail,
+                     bool waitCancel,
+                     const std::string& answer = "hello") :
+      fail_(fail),
+      waitCancel_(waitCancel),
+      answer_(answer)
+    {
+    }
+
+    virtual void Execute(TransferJobs::Progress& progress)
+    {
+      progress.SetTotalInstances(4);
+      progress.AddCompletedInstances(2);
+      progress.AddTransferredBytes(42);
+
+      if (fail_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+      }
+
+      while (waitCancel_)
+      {
+        progress.CheckCanceled();
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+      }
+
+      progress.AddCompletedInstances(2);
+    }
+
+    virtual void FormatResult(Json::Value& result) const
+    {
+      result = "done";
+    }
+
+    virtual bool GetAnswerSize(size_t& size) const
+    {
+      size = answer_.size();
+      return true;
+    }
+
+    virtual bool TakeAnswer(std::string& body,
+                            std::string& contentType)
+    {
+      body.swap(answer_);
+      answer_.clear();
+      contentType = "text/plain";
+      return true;
+    }
+
+    virtual void ReleaseAnswer()
+    {
+      answer_.clear();
+    }
+  };
+
+
+  std::string WaitTransferJob(const std::string& server,
+                              const std::string& id)
+  {
+    for (;;)
+    {
+      Json::Value status;
+      if (!TransferJobs::GetInstance().GetStatus(status, server, id))
+      {
+        return "";
+      }
+      else if (status["State"].asString() != "Pending" &&
+               status["State"].asString() != "Running")
+      {
+        return status["State"].asString();
+      }
+
+      boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+  }
+}
+
+
+TEST(TransferJobs, Basic)
+{
+  TransferJobs& jobs = TransferJobs::GetInstance();
+
+  ASSERT_THROW(jobs.Start(0, 10, 100), Orthanc::OrthancException);
+  ASSERT_THROW(jobs.Submit(new DummyTransferJob(false, false), "0", "Dummy", "a"), Orthanc::OrthancException);
+
+  jobs.Start(1, 3, 100);
+  ASSERT_THROW(jobs.Start(1, 3, 100), Orthanc::OrthancException);
+
+  const std::string success = "1";
+  jobs.Submit(new DummyTransferJob(false, false), success, "Dummy", "a");
+  ASSERT_THROW(jobs.Submit(new DummyTransferJob(false, false), success, "Dummy", "a"), Orthanc::OrthancException);
+  ASSERT_EQ("Success", WaitTransferJob("a", success));
+
+  Json::Value status;
+  ASSERT_FALSE(jobs.GetStatus(status, "b", success));
+  ASSERT_TRUE(jobs.GetStatus(status, "a", success));
+  ASSERT_EQ(success, status["ID"].asString());
+  ASSERT_EQ("Dummy", status["Type"].asString());
+  ASSERT_EQ("a", status["Server"].asString());
+  ASSERT_EQ(4u, status["CompletedInstances"].asUInt());
+  ASSERT_EQ(4u, status["TotalInstances"].asUInt());
+  ASSERT_DOUBLE_EQ(1.0, status["Progress"].asDouble());
+  ASSERT_EQ("42", status["TransferredBytes"].asString());
+  ASSERT_EQ("done", status["Result"].asString());
+
+  std::string body, contentType;
+  ASSERT_FALSE(jobs.TakeAnswer(body, contentType, "b", success));
+  ASSERT_TRUE(jobs.TakeAnswer(body, contentType, "a", success));
+  ASSERT_EQ("hello", body);
+  ASSERT_EQ("text/plain", contentType);
+  ASSERT_FALSE(jobs.TakeAnswer(body, contentType, "a", success));  // The answer is freed once fetched
+
+  const std::string failure = "2";
+  jobs.Submit(new DummyTransferJob(true, false), failure, "Dummy", "a");
+  ASSERT_EQ("Failure", WaitTransferJob("a", failure));
+  ASSERT_TRUE(jobs.GetStatus(status, "a", failure));
+  ASSERT_TRUE(status.isMember("Error"));
+  ASSERT_FALSE(status.isMember("Result"));
+  ASSERT_FALSE(jobs.TakeAnswer(body, contentType, "a", failure));
+
+  // The single worker is kept busy, so that the next job is pending
+  const std::string running = "3";
+  const std::string pending = "4";
+  jobs.Submit(new DummyTransferJob(false, true), running, "Dummy", "a");
+  jobs.Submit(new DummyTransferJob(false, false), pending, "Dummy", "a");
+
+  ASSERT_TRUE(jobs.Cancel("a", pending));
+  ASSERT_EQ("Canceled", WaitTransferJob("a", pending));
+  ASSERT_FALSE(jobs.Cancel("b", running));
+  ASSERT_TRUE(jobs.Cancel("a", running));
+  ASSERT_EQ("Canceled", WaitTransferJob("a", running));
+
+  // Only the 3 most recent finished jobs are remembered
+  std::list<std::string> ids;
+  jobs.ListJobs(ids, "a");
+  ASSERT_EQ(3u, ids.size());
+  ASSERT_FALSE(jobs.GetStatus(status, "a", success));
+  ASSERT_TRUE(jobs.GetStatus(status, "a", failure));
+
+  jobs.ListJobs(ids, "b");
+  ASSERT_TRUE(ids.empty());
+
+  // Only the most recent answers that fit within 100 bytes are kept
+  jobs.Submit(new DummyTransferJob(false, false, std::string(60, 'a')), "5", "Dummy", "a");
+  ASSERT_EQ("Success", WaitTransferJob("a", "5"));
+  jobs.Submit(new DummyTransferJob(false, false, std::string(30, 'b')), "6", "Dummy", "a");
+  ASSERT_EQ("Success", WaitTransferJob("a", "6"));
+  jobs.Submit(new DummyTransferJob(false, false, std::string(20, 'c')), "7", "Dummy", "a");
+  ASSERT_EQ("Success", WaitTransferJob("a", "7"));
+  ASSERT_TRUE(jobs.GetStatus(status, "a", "5"));
+  ASSERT_EQ("Success", status["State"].asString());
+  ASSERT_FALSE(jobs.TakeAnswer(body, contentType, "a", "5"));
+  ASSERT_TRUE(jobs.TakeAnswer(body, contentType, "a", "6"));
+  ASSERT_EQ(std::string(30, 'b'), body);
+  ASSERT_TRUE(jobs.TakeAnswer(body, contentType, "a", "7"));
+  ASSERT_EQ(std::string(20, 'c'), body);
+
+  // Stopping the scheduler cancels the remaining jobs
+  jobs.Submit(new DummyTransferJob(false, true), "8", "Dummy", "a");
+  jobs.Stop();
+  ASSERT_EQ("Canceled", WaitTransferJob("a", "8"));
+  ASSERT_THROW(jobs.Submit(new DummyTransferJob(false, false), "9", "Dummy", "a"), Orthanc::OrthancException);
+}
+
+
+TEST(DerivedTagsCache, Basic)
+{
+  DerivedTagsCache& cache = DerivedTagsCache::GetInstance();
+  cache.Clear();
+
+  DerivedTagsCache::Tags tags;
+  tags[gdcm::Tag(0x0020, 0x1209)] = "42";
+
+  std::string instance;
+  DerivedTagsCache::Tags tmp;
+  ASSERT_FALSE(cache.Lookup(instance, tmp, "series"));
+
+  unsigned int revision = cache.GetRevision();
+  cache.Store(revision, "series", "instance", tags);
+  cache.Store(revision, "study", "instance", tags);
+  ASSERT_EQ(2u, cache.GetSize());
+  ASSERT_TRUE(cache.Lookup(instance, tmp, "series"));
+  ASSERT_EQ("instance", instance);
+  ASSERT_EQ(1u, tmp.size());
+  ASSERT_EQ("42", tmp[gdcm::Tag(0x0020, 0x1209)]);
+
+  cache.SignalChange(OrthancPluginChangeType_NewChildInstance, OrthancPluginResourceType_Series, "series");
+  ASSERT_FALSE(cache.Lookup(instance, tmp, "series"));
+  ASSERT_TRUE(cache.Lookup(instance, tmp, "study"));
+
+  // Values computed before a change must not be stored
+  cache.Store(revision, "series", "instance", tags);
+  ASSERT_FALSE(cache.Lookup(instance, tmp, "series"));
+
+  // The changes to other resources do not matter
+  cache.Store(revision, "other", "instance", tags);
+  ASSERT_TRUE(cache.Lookup(instance, tmp, "other"));
+
+  cache.SignalChange(OrthancPluginChangeType_Deleted, OrthancPluginResourceType_Instance, "instance");
+  ASSERT_EQ(0u, cache.GetSize());
+
+  cache.Store(revision, "other", "instance", tags);
+  ASSERT_EQ(0u, cache.GetSize());
+
+  // The least recently used resource is dropped first
+  cache.SetMaxSize(2);
+  cache.Store(cache.GetRevision(), "a", "instance", tags);
+  cache.Store(cache.GetRevision(), "b", "instance", tags);
+  ASSERT_TRUE(cache.Lookup(instance, tmp, "a"));
+  cache.Store(cache.GetRevision(), "c", "instance", tags);
+  ASSERT_EQ(2u, cache.GetSize());
+  ASSERT_TRUE(cache.Lookup(instance, tmp, "a"));
+  ASSERT_FALSE(cache.Lookup(instance, tmp, "b"));
+  ASSERT_TRUE(cache.Lookup(instance, tmp, "c"));
+
+  cache.SetMaxSize(1);
+  ASSERT_EQ(1u, cache.GetSize());
+  ASSERT_TRUE(cache.Lookup(instance, tmp, "c"));
+
+  cache.SetMaxSize(10000);
+  cache.Clear();
+}
+
+
+TEST(MemoryStream, Basic)
+{
+  const std::string s = "Hello world";
+  MemoryInputStream stream(s.c_str(), s.size());
+
+  std::string word;
+  stream >> word;
+  ASSERT_EQ("Hello", word);
+  ASSERT_EQ(5, stream.tellg());
+
+  stream.seekg(-5, std::ios::end);
+  stream >> word;
+  ASSERT_EQ("world", word);
+  ASSERT_TRUE(stream.eof());
+
+  stream.clear();
+  stream.seekg(6, std::ios::beg);
+  ASSERT_EQ(6, stream.tellg());
+
+  char buffer[5];
+  ASSERT_TRUE(stream.read(buffer, 5));
+  ASSERT_EQ("world", std::string(buffer, 5));
+  ASSERT_FALSE(stream.read(buffer, 1));
+
+  stream.clear();
+  stream.seekg(1, std::ios::end);
+  ASSERT_TRUE(stream.fail());
+
+  MemoryInputStream empty(NULL, 0);
+  ASSERT_EQ(std::char_traits<char>::eof(), empty.get());
+}
+
+
+TEST(HierarchyCache, Basic)
+{
+  HierarchyCache& cache = HierarchyCache::GetInstance();
+  cache.Clear();
+  cache.SetMaxSize(2);
+
+  std::string id, series, study;
+  ASSERT_FALSE(cache.LookupInstance(id, series, study, "1.2.3"));
+
+  cache.StoreInstance(cache.GetRevision(), "1.2.3", "i1", "1.2", "1");
+  cache.StoreSeries(cache.GetRevision(), "1.2", "s1", "1");
+  ASSERT_EQ(2u, cache.GetSize());
+
+  ASSERT_TRUE(cache.LookupInstance(id, series, study, "1.2.3"));
+  ASSERT_EQ("i1", id);
+  ASSERT_EQ("1.2", series);
+  ASSERT_EQ("1", study);
+
+  // The series is now the least recently used entry
+  cache.StoreInstance(cache.GetRevision(), "1.2.4", "i2", "1.2", "1");
+  ASSERT_EQ(2u, cache.GetSize());
+  ASSERT_FALSE(cache.LookupSeries(id, study, "1.2"));
+  ASSERT_TRUE(cache.LookupInstance(id, series, study, "1.2.3"));
+  ASSERT_TRUE(cache.LookupInstance(id, series, study, "1.2.4"));
+  ASSERT_EQ("i2", id);
+
+  // Deleting an instance only removes its entry
+  unsigned int revision = cache.GetRevision();
+  cache.SignalChange(OrthancPluginChangeType_Deleted, OrthancPluginResourceType_Instance, "i1");
+  ASSERT_EQ(1u, cache.GetSize());
+  ASSERT_FALSE(cache.LookupInstance(id, series, study, "1.2.3"));
+
+  // Lookups started before a deletion are not stored
+  cache.StoreInstance(revision, "1.2.3", "i1", "1.2", "1");
+  ASSERT_FALSE(cache.LookupInstance(id, series, study, "1.2.3"));
+
+  cache.SignalChange(OrthancPluginChangeType_Deleted, OrthancPluginResourceType_Study, "whatever");
+  ASSERT_EQ(0u, cache.GetSize());
+
+  cache.SetMaxSize(100000);
+}
+
+
+TEST(FrameCache, Basic)
+{
+  FrameCache& cache = FrameCache::GetInstance();
+  cache.Clear();
+  cache.SetMaxSize(10);
+
+  std::string frame;
+  ASSERT_FALSE(cache.Lookup(frame, "a", "1.2.840.10008.1.2", 0));
+
+  cache.Store(cache.GetRevision(), "a", "1.2.840.10008.1.2", 0, "hello", 5);
+  cache.Store(cache.GetRevision(), "a", "1.2.840.10008.1.2", 1, "world", 5);
+  ASSERT_EQ(10u, cache.GetSize());
+
+  ASSERT_TRUE(cache.Lookup(frame, "a", "1.2.840.10008.1.2", 0));
+  ASSERT_EQ("hello", frame);
+  ASSERT_FALSE(cache.Lookup(frame, "a", "1.2.840.10008.1.2.4.90", 0));
+
+  // Frame 1 is the least recently used one
+  cache.Store(cache.GetRevision(), "b", "1.2.840.10008.1.2", 0, "abc", 3);
+  ASSERT_EQ(8u, cache.GetSize());
+  ASSERT_FALSE(cache.Lookup(frame, "a", "1.2.840.10008.1.2", 1));
+  ASSERT_TRUE(cache.Lookup(frame, "a", "1.2.840.10008.1.2", 0));
+
+  // Too large frames are not cached
+  cache.Store(cache.GetRevision(), "c", "1.2.840.10008.1.2", 0, "hello world", 11);
+  ASSERT_FALSE(cache.Lookup(frame, "c", "1.2.840.10008.1.2", 0));
+
+  cache.SignalChange(OrthancPluginChangeType_Deleted, OrthancPluginResourceType_Instance, "a");
+  ASSERT_EQ(3u, cache.GetSize());
+  ASSERT_FALSE(cache.Lookup(frame, "a", "1.2.840.10008.1.2", 0));
+  ASSERT_TRUE(cache.Lookup(frame, "b", "1.2.840.10008.1.2", 0));
+  ASSERT_EQ("abc", frame);
+
+  {
+    // The instance is deleted while its frames are being transcoded
+    const unsigned int revision = cache.GetRevision();
+    cache.SignalChange(OrthancPluginChangeType_Deleted, OrthancPluginResourceType_Instance, "d");
+    cache.Store(revision, "d", "1.2.840.10008.1.2", 0, "old", 3);
+    ASSERT_FALSE(cache.Lookup(frame, "d", "1.2.840.10008.1.2", 0));
+    ASSERT_EQ(3u, cache.GetSize());
+
+    cache.Store(cache.GetRevision(), "d", "1.2.840.10008.1.2", 0, "new", 3);
+    ASSERT_TRUE(cache.Lookup(frame, "d", "1.2.840.10008.1.2", 0));
+    ASSERT_EQ("new", frame);
+  }
+
+  cache.SetMaxSize(0);
+  ASSERT_EQ(0u, cache.GetSize());
+
+  cache.SetMaxSize(128 * 1024 * 1024);
+}
+
+
+TEST(FrameIndex, Basic)
+{
+  ASSERT_TRUE(FrameIndex::IsStartOfFrame("\xff\xd8\xff\xe0", 4));             // JPEG
+  ASSERT_TRUE(FrameIndex::IsStartOfFrame("\xff\x4f\xff\x51", 4));             // JPEG 2000
+  ASSERT_TRUE(FrameIndex::IsStartOfFrame("\x00\x00\x00\x0cjP  ", 8));         // JP2
+  ASSERT_FALSE(FrameIndex::IsStartOfFrame("\xff\xd8", 2));
+  ASSERT_FALSE(FrameIndex::IsStartOfFrame("abcd", 4));
+
+  gdcm::DataSet dataset;
+  ASSERT_EQ(1u, FrameIndex::GetFramesCount(dataset));
+
+  gdcm::DataElement numberOfFrames(gdcm::Tag(0x0028, 0x0008));
+  numberOfFrames.SetByteValue("2 ", 2);
+  dataset.Insert(numberOfFrames);
+  ASSERT_EQ(2u, FrameIndex::GetFramesCount(dataset));
+
+  // Two frames, each made of two fragments
+  const char* content[] = { "\xff\xd8\xff\x00", "abcd", "\xff\xd8\xff\x01", "ef" };
+  const size_t sizes[] = { 4, 4, 4, 2 };
+
+  gdcm::SequenceOfFragments fragments;
+  for (size_t i = 0; i < 4; i++)
+  {
+    gdcm::Fragment fragment;
+    fragment.SetByteValue(content[i], sizes[i]);
+    fragments.AddFragment(fragment);
+  }
+
+  std::string frame;
+
+  {
+    // No offset table: Use of the JPEG markers
+    FrameIndex index(fragments, dataset, 2);
+    ASSERT_EQ(2u, index.GetFramesCount());
+    ASSERT_EQ(2u, index.GetFragmentsCount(0));
+    ASSERT_EQ(2u, index.GetFragmentsCount(1));
+    index.GetFrame(frame, 1);
+    ASSERT_EQ(std::string("\xff\xd8\xff\x01" "ef"), frame);
+    ASSERT_THROW(index.GetFrame(frame, 2), Orthanc::OrthancException);
+  }
+
+  {
+    // Basic Offset Table, each fragment having an 8-byte header:
+    // Frame 1 starts at the third fragment
+    fragments.GetTable().SetByteValue("\x00\x00\x00\x00\x18\x00\x00\x00", 8);
+
+    FrameIndex index(fragments, dataset, 2);
+    ASSERT_EQ(2u, index.GetFramesCount());
+    index.GetFrame(frame, 0);
+    ASSERT_EQ(std::string("\xff\xd8\xff\x00" "abcd", 8), frame);
+  }
+
+  {
+    FrameIndex index(fragments, dataset, 1);
+    ASSERT_EQ(1u, index.GetFramesCount());
+    ASSERT_EQ(4u, index.GetFragmentsCount(0));
+
+    const char* p = NULL;
+    size_t size = 0;
+    std::string buffer;
+    index.GetFrame(p, size, buffer, 0);
+    ASSERT_EQ(14u, size);
+  }
+
+  ASSERT_THROW(FrameIndex(fragments, dataset, 3), Orthanc::OrthancException);
+}
+
+
+TEST(FrameIndex, Native)
+{
+  // Three frames of 1-bit images of 5x3 pixels: The 15 bits of a frame
+  // fit into 2 bytes, and the pixel data is padded to an even length
+  gdcm::ByteValue pixelData("\x01\x02" "\x03\x04" "\x05\x06" "\x00", 7);
+
+  const char* content = NULL;
+  size_t size = 0;
+
+  FrameIndex::GetNativeFrame(content, size, pixelData, 3, 0);
+  ASSERT_EQ(2u, size);
+  ASSERT_EQ(std::string("\x01\x02"), std::string(content, size));
+
+  FrameIndex::GetNativeFrame(content, size, pixelData, 3, 2);
+  ASSERT_EQ(2u, size);
+  ASSERT_EQ(std::string("\x05\x06"), std::string(content, size));
+
+  FrameIndex::GetNativeFrame(content, size, pixelData, 1, 0);
+  ASSERT_EQ(7u, size);
+  ASSERT_EQ(pixelData.GetPointer(), content);
+
+  ASSERT_THROW(FrameIndex::GetNativeFrame(content, size, pixelData, 3, 3), Orthanc::OrthancException);
+  ASSERT_THROW(FrameIndex::GetNativeFrame(content, size, pixelData, 0, 0), Orthanc::OrthancException);
+  ASSERT_THROW(FrameIndex::GetNativeFrame(content, size, pixelData, 8, 0), Orthanc::OrthancException);
+}
+
+
+static void AppendUint16(std::string& target,
+                         uint16_t value)
+{
+  target.push_back(static_cast<char>(value & 0xff));
+  target.push_back(static_cast<char>(value >> 8));
+}
+
+
+static void AppendUint32(std::string& target,
+                         uint32_t value)
+{
+  AppendUint16(target, value & 0xffff);
+  AppendUint16(target, value >> 16);
+}
+
+
+static void AppendElement(std::string& target,
+                          uint16_t group,
+                          uint16_t element,
+                          const std::string& vr,   // Empty for implicit VR
+                          const std::string& value,
+                          bool undefinedLength = false)
+{
+  AppendUint16(target, group);
+  AppendUint16(target, element);
+
+  const uint32_t length = (undefinedLength ? 0xffffffffu : value.size());
+
+  if (vr.empty())
+  {
+    AppendUint32(target, length);
+  }
+  else if (vr == "OB" || vr == "SQ" || vr == "UN")
+  {
+    target += vr;
+    AppendUint16(target, 0);
+    AppendUint32(target, length);
+  }
+  else
+  {
+    target += vr;
+    AppendUint16(target, length);
+  }
+
+  target += value;
+}
+
+
+static std::string CreateRawDicom(const std::string& transferSyntax,
+                                  bool isExplicit)
+{
+  std::string dicom(128, '\0');
+  dicom += "DICM";
+  AppendElement(dicom, 0x0002, 0x0010, "UI", transferSyntax);
+
+  // Sequence of undefined length, whose first item has an undefined
+  // length, and whose second item has a defined length
+  std::string item1, item2;
+  AppendElement(item1, 0x0018, 0x1074, isExplicit ? "DS" : "", "12.5");
+  AppendElement(item1, 0xfffe, 0xe00d, "", "");
+  AppendElement(item2, 0x0018, 0x1074, isExplicit ? "DS" : "", "42");
+
+  std::string sequence;
+  AppendElement(sequence, 0xfffe, 0xe000, "", item1, true);
+  AppendElement(sequence, 0xfffe, 0xe000, "", item2);
+  AppendElement(sequence, 0xfffe, 0xe0dd, "", "");
+
+  AppendElement(dicom, 0x0008, 0x0016, isExplicit ? "UI" : "", std::string("1.2\0", 4));
+  AppendElement(dicom, 0x0054, 0x0016, isExplicit ? "SQ" : "", "", true);
+  dicom += sequence;
+  AppendElement(dicom, 0x7fe0, 0x0010, isExplicit ? "OB" : "", "abcd");
+
+  return dicom;
+}
+
+
+static void CheckRawDicom(const std::string& dicom)
+{
+  RawDicomParser parser(dicom.c_str(), dicom.size());
+  ASSERT_TRUE(parser.IsSupported());
+
+  const char* content = NULL;
+  size_t size = 0;
+
+  ASSERT_EQ(RawDicomParser::Status_Found, parser.LookupValue(content, size, gdcm::Tag(0x0008, 0x0016)));
+  ASSERT_EQ(std::string("1.2\0", 4), std::string(content, size));
+
+  ASSERT_EQ(RawDicomParser::Status_Found, parser.LookupValue(content, size, gdcm::Tag(0x7fe0, 0x0010)));
+  ASSERT_EQ("abcd", std::string(content, size));
+
+  ASSERT_EQ(RawDicomParser::Status_NotFound, parser.LookupValue(content, size, gdcm::Tag(0x0010, 0x0010)));
+  ASSERT_EQ(RawDicomParser::Status_NotFound, parser.LookupValue(content, size, gdcm::Tag(0x7fe1, 0x0010)));
+
+  std::vector<gdcm::Tag> tags;
+  tags.push_back(gdcm::Tag(0x0054, 0x0016));
+  tags.push_back(gdcm::Tag(0x0018, 0x1074));
+
+  std::vector<unsigned int> items(1, 1);
+  ASSERT_EQ(RawDicomParser::Status_Found, parser.LookupValue(content, size, tags, items));
+  ASSERT_EQ("12.5", std::string(content, size));
+
+  items[0] = 2;
+  ASSERT_EQ(RawDicomParser::Status_Found, parser.LookupValue(content, size, tags, items));
+  ASSERT_EQ("42", std::string(content, size));
+
+  items[0] = 3;
+  ASSERT_EQ(RawDicomParser::Status_NotFound, parser.LookupValue(content, size, tags, items));
+
+  items[0] = 0;
+  ASSERT_EQ(RawDicomParser::Status_NotFound, parser.LookupValue(content, size, tags, items));
+
+  items[0] = 1;
+  tags[1] = gdcm::Tag(0x0018, 0x1075);
+  ASSERT_EQ(RawDicomParser::Status_NotFound, parser.LookupValue(content, size, tags, items));
+}
+
+
+TEST(RawDicomParser, Basic)
+{
+  CheckRawDicom(CreateRawDicom(std::string("1.2.840.10008.1.2.1\0", 20), true));
+  CheckRawDicom(CreateRawDicom("1.2.840.10008.1.2", false));
+
+  {
+    std::string dicom = CreateRawDicom(std::string("1.2.840.10008.1.2.1.99", 22), true);
+    RawDicomParser parser(dicom.c_str(), dicom.size());
+    ASSERT_FALSE(parser.IsSupported());
+    ASSERT_EQ("1.2.840.10008.1.2.1.99", parser.GetTransferSyntax());
+  }
+
+  {
+    RawDicomParser parser("nope", 4);
+    ASSERT_FALSE(parser.IsSupported());
+
+    const char* content = NULL;
+    size_t size = 0;
+    ASSERT_EQ(RawDicomParser::Status_Unsupported, parser.LookupValue(content, size, gdcm::Tag(0x0008, 0x0016)));
+  }
+
+  {
+    // Truncated file
+    std::string dicom = CreateRawDicom(std::string("1.2.840.10008.1.2.1\0", 20), true);
+    dicom.resize(dicom.size() - 10);
+
+    RawDicomParser parser(dicom.c_str(), dicom.size());
+    const char* content = NULL;
+    size_t size = 0;
+    ASSERT_EQ(RawDicomParser::Status_Unsupported, parser.LookupValue(content, size, gdcm::Tag(0x7fe0, 0x0010)));
+  }
+}
+
+
+TEST(DicomTagsPeeker, Basic)
+{
+  const std::string dicom = CreateRawDicom("1.2.840.10008.1.2", false);
+
+  {
+    DicomTagsPeeker peeker(dicom.c_str(), dicom.size());
+    peeker.AddTag(DICOM_TAG_SOP_CLASS_UID);
+    peeker.AddTag(DICOM_TAG_STUDY_INSTANCE_UID);
+    ASSERT_THROW(peeker.GetStringValue(DICOM_TAG_SOP_CLASS_UID, ""), Orthanc::OrthancException);
+
+    ASSERT_TRUE(peeker.Apply());
+    ASSERT_THROW(peeker.Apply(), Orthanc::OrthancException);
+    ASSERT_EQ("1.2.840.10008.1.2", peeker.GetTransferSyntax());
+    ASSERT_EQ("1.2", peeker.GetStringValue(DICOM_TAG_SOP_CLASS_UID, "nope"));
+    ASSERT_EQ("nope", peeker.GetStringValue(DICOM_TAG_STUDY_INSTANCE_UID, "nope"));
+    ASSERT_THROW(peeker.GetStringValue(DICOM_TAG_PIXEL_DATA, ""), Orthanc::OrthancException);
+  }
+
+  {
+    // The scan goes over the sequence of undefined length
+    DicomTagsPeeker peeker(dicom.c_str(), dicom.size());
+    peeker.AddTag(DICOM_TAG_PIXEL_DATA);
+    ASSERT_TRUE(peeker.Apply());
+
+    const char* value = NULL;
+    size_t size = 0;
+    ASSERT_TRUE(peeker.LookupValue(value, size, DICOM_TAG_PIXEL_DATA));
+    ASSERT_EQ("abcd", std::string(value, size));
+  }
+
+  {
+    // Truncated in the middle of the sequence: The scan must stop before
+    RawDicomParser parser(dicom.c_str(), dicom.size() - 20);
+
+    const gdcm::Tag tags[] = { DICOM_TAG_SOP_CLASS_UID, DICOM_TAG_SOP_INSTANCE_UID };
+    const char* values[2];
+    size_t sizes[2];
+    ASSERT_EQ(RawDicomParser::Status_Found, parser.LookupValues(values, sizes, tags, 2, DICOM_TAG_SOP_INSTANCE_UID));
+    ASSERT_EQ(std::string("1.2\0", 4), std::string(values[0], sizes[0]));
+    ASSERT_TRUE(values[1] == NULL);
+
+    ASSERT_EQ(RawDicomParser::Status_Unsupported, parser.LookupValues(values, sizes, tags, 2, DICOM_TAG_PIXEL_DATA));
+  }
+
+  {
+    DicomTagsPeeker peeker("nope", 4);
+    peeker.AddTag(DICOM_TAG_SOP_CLASS_UID);
+    ASSERT_FALSE(peeker.Apply());
+    ASSERT_EQ("", peeker.GetTransferSyntax());
+  }
+}
+
+
+TEST(BulkDataIndex, Basic)
+{
+  std::vector<gdcm::Tag> tags;
+  tags.push_back(gdcm::Tag(0x0054, 0x0016));
+  tags.push_back(gdcm::Tag(0x0018, 0x1074));
+
+  std::vector<unsigned int> items(1, 2);
+  ASSERT_EQ("00540016/2/00181074", BulkDataIndex::FormatPath(tags, items));
+  ASSERT_THROW(BulkDataIndex::FormatPath(tags, std::vector<unsigned int>()), Orthanc::OrthancException);
+
+  const std::string dicom = CreateRawDicom(std::string("1.2.840.10008.1.2.1\0", 20), true);
+
+  const gdcm::Dict& dictionary = gdcm::Global::GetInstance().GetDicts().GetPublicDict();
+
+  BulkDataIndex index;
+  ASSERT_THROW(index.Build(dicom.c_str(), dicom.size(), "", dictionary), Orthanc::OrthancException);
+  ASSERT_TRUE(index.Build(dicom.c_str(), dicom.size(), "0123456789abcdef0123456789abcdef", dictionary));
+  ASSERT_EQ(dicom.size(), index.GetFileSize());
+  ASSERT_TRUE(index.IsValid("0123456789abcdef0123456789abcdef"));
+  ASSERT_FALSE(index.IsValid("fedcba9876543210fedcba9876543210"));   // Re-uploaded file, possibly of the same size
+  ASSERT_FALSE(index.IsValid(""));
+  ASSERT_EQ(1u, index.GetSize());   // Only the pixel data is bulk data
+
+  uint64_t offset, length;
+  ASSERT_FALSE(index.Lookup(offset, length, tags, items));
+
+  std::string serialized;
+  index.Serialize(serialized);
+
+  BulkDataIndex index2;
+  ASSERT_TRUE(index2.Unserialize(serialized));
+  ASSERT_EQ(dicom.size(), index2.GetFileSize());
+  ASSERT_EQ("0123456789abcdef0123456789abcdef", index2.GetAttachmentMD5());
+  ASSERT_TRUE(index2.Lookup(offset, length, std::vector<gdcm::Tag>(1, gdcm::Tag(0x7fe0, 0x0010)), std::vector<unsigned int>()));
+  ASSERT_EQ("abcd", dicom.substr(offset, length));
+
+  ASSERT_FALSE(index2.Unserialize("nope"));
+  ASSERT_FALSE(index2.Unserialize("{\"FileSize\":\"10\",\"Elements\":{}}"));   // No MD5
+  ASSERT_FALSE(index2.Unserialize("{\"AttachmentMD5\":\"0123\",\"FileSize\":\"10\",\"Elements\":{\"7fe00010\":[\"8\",\"4\"]}}"));
+  ASSERT_EQ(0u, index2.GetSize());
+}
+
+
+namespace
+{
+  class MultipartTester : public MultipartStreamReader::IHandler
+  {
+  public:
+    std::vector<std::string>  parts_;
+    std::vector<std::string>  types_;
+
+    virtual void HandlePart(const MultipartStreamReader::HttpHeaders& headers,
+                            const void* part,
+                            size_t size)
+    {
+      parts_.push_back(std::string(reinterpret_cast<const char*>(part), size));
+
+      MultipartStreamReader::HttpHeaders::const_iterator type = headers.find("content-type");
+      types_.push_back(type == headers.end() ? "" : type->second);
+    }
+  };
+}
+
+
+TEST(MultipartStreamReader, Basic)
+{
+  const std::string body = ("preamble\r\n"
+                            "--123\r\n"
+                            "Content-Type: application/dicom\r\n"
+                            "\r\n"
+                            "hello\r\n--1234\r\n"   // The boundary is a prefix of the content
+                            "--123  \r\n"           // Transport padding
+                            "content-length: 5\r\n"
+                            "\r\n"
+                            "world"
+                            "\r\n--123\r\n"
+                            "\r\n"                  // No header
+                            "\r\n"
+                            "\r\n--123--\r\n"
+                            "epilogue");
+
+  {
+    std::vector<MultipartItem> items;
+    ParseMultipartBody(items, NULL, body.c_str(), body.size(), "123");
+    ASSERT_EQ(3u, items.size());
+    ASSERT_EQ("hello\r\n--1234", std::string(items[0].data_, items[0].size_));
+    ASSERT_EQ("application/dicom", items[0].contentType_);
+    ASSERT_EQ("world", std::string(items[1].data_, items[1].size_));
+    ASSERT_EQ("application/octet-stream", items[1].contentType_);
+    ASSERT_EQ("\r\n", std::string(items[2].data_, items[2].size_));
+
+    // The parts point inside the body
+    ASSERT_TRUE(items[0].data_ > body.c_str() &&
+                items[0].data_ < body.c_str() + body.size());
+  }
+
+  // Feed the stream with chunks of all the possible sizes
+  for (size_t chunk = 1; chunk <= body.size(); chunk++)
+  {
+    MultipartTester tester;
+    MultipartStreamReader reader(tester, "123");
+
+    for (size_t pos = 0; pos < body.size(); pos += chunk)
+    {
+      reader.AddChunk(body.c_str() + pos, std::min(chunk, body.size() - pos));
+    }
+
+    reader.CloseStream();
+    ASSERT_TRUE(reader.IsDone());
+    ASSERT_EQ(3u, tester.parts_.size());
+    ASSERT_EQ("hello\r\n--1234", tester.parts_[0]);
+    ASSERT_EQ("application/dicom", tester.types_[0]);
+    ASSERT_EQ("world", tester.parts_[1]);
+    ASSERT_EQ("\r\n", tester.parts_[2]);
+  }
+
+  {
+    // Body starting with the boundary, without trailing "--"
+    std::vector<MultipartItem> items;
+    ParseMultipartBody(items, NULL, "--a\r\n\r\nxyz\r\n--a", 15, "a");
+    ASSERT_EQ(1u, items.size());
+    ASSERT_EQ("xyz", std::string(items[0].data_, items[0].size_));
+
+    ParseMultipartBody(items, NULL, "nothing", 7, "a");
+    ASSERT_TRUE(items.empty());
+
+    // Missing closing boundary
+    ASSERT_THROW(ParseMultipartBody(items, NULL, "--a\r\n\r\nxyz", 10, "a"), Orthanc::OrthancException);
+
+    // Wrong Content-Length
+    ASSERT_THROW(ParseMultipartBody(items, NULL, "--a\r\nContent-Length: 2\r\n\r\nxyz\r\n--a--", 36, "a"),
+                 Orthanc::OrthancException);
+  }
+}
+
+
+namespace
+{
+  class MultipartCounter : public MultipartStreamReader::IHandler
+  {
+  public:
+    std::vector<size_t>  sizes_;
+    std::vector<char>    first_;
+
+    virtual void HandlePart(const MultipartStreamReader::HttpHeaders& headers,
+                            const void* part,
+                            size_t size)
+    {
+      sizes_.push_back(size);
+      first_.push_back(size == 0 ? '\0' : *reinterpret_cast<const char*>(part));
+    }
+  };
+
+
+  /**
+   * Builds a body of "countParts" parts with pseudo-random content,
+   * filled with prefixes of the delimiter so that the scanner cannot
+   * skip ahead. The first byte of each part is its index.
+   **/
+  void CreateLargeMultipartBody(std::string& body,
+                                std::vector<size_t>& sizes,
+                                const std::string& boundary,
+                                size_t countParts,
+                                size_t partSize,
+                                bool contentLength)
+  {
+    const std::string delimiter = "\r\n--" + boundary;
+
+    body.clear();
+    body.reserve(countParts * (partSize + 128));
+    sizes.clear();
+
+    unsigned int seed = 42;
+
+    for (size_t i = 0; i < countParts; i++)
+    {
+      body += "--" + boundary + "\r\nContent-Type: application/dicom\r\n";
+
+      if (contentLength)
+      {
+        body += "Content-Length: " + boost::lexical_cast<std::string>(partSize) + "\r\n";
+      }
+
+      body += "\r\n";
+
+      const size_t start = body.size();
+      body.push_back(static_cast<char>(i % 128));
+
+      while (body.size() - start < partSize)
+      {
+        seed = seed * 1103515245u + 12345u;
+        if ((seed >> 16) % 64 == 0)
+        {
+          // Partial delimiter, followed by a character that is not
+          // part of the boundary
+          body.append(delimiter, 0, std::min((seed >> 8) % delimiter.size(),
+                                             partSize - (body.size() - start)));
+
+          if (body.size() - start < partSize)
+          {
+            body.push_back('#');
+          }
+        }
+        else
+        {
+          body.push_back(static_cast<char>(seed >> 24));
+        }
+      }
+
+      sizes.push_back(partSize);
+      body += "\r\n";
+    }
+
+    body += "--" + boundary + "--\r\n";
+  }
+
+
+  void CheckLargeMultipartBody(const MultipartCounter& counter,
+                               const std::vector<size_t>& sizes)
+  {
+    ASSERT_EQ(sizes.size(), counter.sizes_.size());
+    for (size_t i = 0; i < sizes.size(); i++)
+    {
+      ASSERT_EQ(sizes[i], counter.sizes_[i]);
+      ASSERT_EQ(static_cast<char>(i % 128), counter.first_[i]);
+    }
+  }
+
+
+  void ParseLargeMultipartStream(MultipartCounter& counter,
+                                 const std::string& body,
+                                 const std::string& boundary,
+                                 size_t chunkSize)
+  {
+    MultipartStreamReader reader(counter, boundary);
+
+    for (size_t pos = 0; pos < body.size(); pos += chunkSize)
+    {
+      reader.AddChunk(body.c_str() + pos, std::min(chunkSize, body.size() - pos));
+    }
+
+    reader.CloseStream();
+  }
+
+
+  // Number of parts found by the Boost.Regex scan that was used
+  // before MultipartStreamReader, as a reference for the benchmark
+  size_t ScanMultipartBodyWithRegex(const std::string& body,
+                                    const std::string& boundary)
+  {
+    const boost::regex nextSeparator(".*?(\r\n--" + boundary + ").*");
+    const char* current = body.c_str();
+    const char* end = body.c_str() + body.size();
+
+    size_t count = 0;
+
+    boost::cmatch what;
+    while (boost::regex_match(current, end, what, nextSeparator,
+                              boost::match_perl | boost::match_single_line))
+    {
+      count++;
+      current = what[1].second;
+    }
+
+    return count;
+  }
+
+
+  double GetElapsedMilliseconds(const boost::posix_time::ptime& start)
+  {
+    return static_cast<double>((boost::posix_time::microsec_clock::universal_time() - start).
+                               total_microseconds()) / 1000.0;
+  }
+}
+
+
+TEST(MultipartStreamReader, LargeBody)
+{
+  static const std::string boundary = "e0a2f1b4-1c9d-4a0e";
+
+  std::string body;
+  std::vector<size_t> sizes;
+  CreateLargeMultipartBody(body, sizes, boundary, 64, 256 * 1024, false);
+  ASSERT_GT(body.size(), 16u * 1024u * 1024u);
+
+  {
+    MultipartCounter counter;
+    MultipartStreamReader::ParseBody(counter, body.c_str(), body.size(), boundary);
+    CheckLargeMultipartBody(counter, sizes);
+  }
+
+  {
+    std::vector<MultipartItem> items;
+    ParseMultipartBody(items, NULL, body.c_str(), body.size(), boundary);
+    ASSERT_EQ(sizes.size(), items.size());
+    ASSERT_EQ(sizes.back(), items.back().size_);
+  }
+
+  // Chunks that are smaller than, equal to and larger than the delimiter
+  static const size_t chunks[] = { 7, 22, 1000, 65536, 1000003 };
+  for (size_t i = 0; i < sizeof(chunks) / sizeof(size_t); i++)
+  {
+    MultipartCounter counter;
+    ParseLargeMultipartStream(counter, body, boundary, chunks[i]);
+    CheckLargeMultipartBody(counter, sizes);
+  }
+
+  {
+    // A single part that spans the whole body
+    CreateLargeMultipartBody(body, sizes, boundary, 1, 16 * 1024 * 1024, false);
+
+    MultipartCounter counter;
+    ParseLargeMultipartStream(counter, body, boundary, 65536);
+    CheckLargeMultipartBody(counter, sizes);
+  }
+
+  {
+    CreateLargeMultipartBody(body, sizes, boundary, 64, 256 * 1024, true);
+
+    MultipartCounter counter;
+    ParseLargeMultipartStream(counter, body, boundary, 65536);
+    CheckLargeMultipartBody(counter, sizes);
+  }
+}
+
+
+/**
+ * Comparison with the Boost.Regex scan that was previously used by
+ * ParseMultipartBody(). Disabled by default, as it allocates 100MB
+ * bodies. Run it on an optimized build with:
+ * ./UnitTests --gtest_also_run_disabled_tests --gtest_filter=MultipartStreamReader.DISABLED_Benchmark
+ **/
+TEST(MultipartStreamReader, DISABLED_Benchmark)
+{
+  static const std::string boundary = "e0a2f1b4-1c9d-4a0e";
+
+  struct BenchmarkBody
+  {
+    size_t  countParts_;
+    size_t  partSize_;
+    bool    contentLength_;
+  };
+
+  static const BenchmarkBody bodies[] = {
+    { 100,  1024 * 1024,       false },
+    { 1000, 100 * 1024,        false },
+    { 1,    100 * 1024 * 1024, false },
+    { 100,  1024 * 1024,       true  }
+  };
+
+  for (size_t i = 0; i < sizeof(bodies) / sizeof(BenchmarkBody); i++)
+  {
+    const BenchmarkBody& setup = bodies[i];
+
+    std::string body;
+    std::vector<size_t> sizes;
+    CreateLargeMultipartBody(body, sizes, boundary, setup.countParts_,
+                             setup.partSize_, setup.contentLength_);
+
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    {
+      MultipartCounter counter;
+      MultipartStreamReader::ParseBody(counter, body.c_str(), body.size(), boundary);
+      CheckLargeMultipartBody(counter, sizes);
+    }
+
+    const double parseBody = GetElapsedMilliseconds(start);
+    start = boost::posix_time::microsec_clock::universal_time();
+
+    {
+      MultipartCounter counter;
+      ParseLargeMultipartStream(counter, body, boundary, 65536);
+      CheckLargeMultipartBody(counter, sizes);
+    }
+
+    const double stream = GetElapsedMilliseconds(start);
+    start = boost::posix_time::microsec_clock::universal_time();
+
+    ASSERT_EQ(setup.countParts_, ScanMultipartBodyWithRegex(body, boundary));
+
+    const double regex = GetElapsedMilliseconds(start);
+
+    printf("%4lu MB, %4lu parts%s: ParseBody() %8.1f ms, 64KB chunks %8.1f ms, regex %8.1f ms\n",
+           static_cast<unsigned long>(body.size() / (1024 * 1024)),
+           static_cast<unsigned long>(setup.countParts_),
+           setup.contentLength_ ? ", Content-Length" : "                ",
+           parseBody, stream, regex);
+  }
+}
+
+
+namespace
+{
+  class StowInstancesSource : public StowRequestBody::IInstancesSource
+  {
+  private:
+    const std::vector<std::string>&  instances_;
+    size_t                           next_;
+    std::string                      current_;
+
+  public:
+    unsigned int  countCleared_;
+
+    explicit StowInstancesSource(const std::vector<std::string>& instances) :
+      instances_(instances),
+      next_(0),
+      countCleared_(0)
+    {
+    }
+
+    virtual bool ReadNextInstance()
+    {
+      if (next_ < instances_.size())
+      {
+        current_ = instances_[next_++];
+        return true;
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    virtual const void* GetInstanceData() const
+    {
+      return current_.c_str();
+    }
+
+    virtual size_t GetInstanceSize() const
+    {
+      return current_.size();
+    }
+
+    virtual void ClearInstance()
+    {
+      current_.clear();
+      countCleared_++;
+    }
+  };
+
+
+  // Concatenates the chunks of the current batch, as the chunked HTTP client does
+  std::string ReadStowBatch(StowRequestBody& body)
+  {
+    std::string batch;
+
+    while (!body.IsDone())
+    {
+      batch.append(reinterpret_cast<const char*>(body.GetChunkData()), body.GetChunkSize());
+      body.Next();
+    }
+
+    return batch;
+  }
+}
+
+
+TEST(StowRequestBody, Basic)
+{
+  ASSERT_EQ("\r\n--abc\r\nContent-Type: application/dicom\r\nContent-Length: 5\r\n\r\n",
+            StowRequestBody::FormatPartHeader("abc", 5));
+
+  ASSERT_FALSE(StowRequestBody::IsBatchFull(100, 100, 0, 0));
+  ASSERT_FALSE(StowRequestBody::IsBatchFull(1, 100, 2, 0));
+  ASSERT_TRUE(StowRequestBody::IsBatchFull(2, 100, 2, 0));
+  ASSERT_FALSE(StowRequestBody::IsBatchFull(1, 99, 0, 100));
+  ASSERT_TRUE(StowRequestBody::IsBatchFull(1, 100, 0, 100));
+
+  std::vector<std::string> instances;
+  instances.push_back("hello");
+  instances.push_back("");
+  instances.push_back("world");
+  instances.push_back("\r\n--abc\r\n");
+  instances.push_back("!");
+
+  {
+    // No instance
+    std::vector<std::string> empty;
+    StowInstancesSource source(empty);
+    StowRequestBody body(source, "abc", 2, 0);
+    ASSERT_TRUE(body.IsDone());
+    ASSERT_FALSE(body.StartBatch());
+    ASSERT_TRUE(body.IsDone());
+    ASSERT_EQ(0u, body.GetChunkSize());
+    ASSERT_THROW(body.Next(), Orthanc::OrthancException);
+  }
+
+  {
+    // Batches of at most 2 instances
+    StowInstancesSource source(instances);
+    StowRequestBody body(source, "abc", 2, 0);
+
+    std::vector<std::string> parts;
+    std::vector<size_t> counts;
+    while (body.StartBatch())
+    {
+      std::string batch = ReadStowBatch(body);
+      ASSERT_EQ(batch.size(), body.GetBatchSize() + std::string("\r\n--abc--\r\n").size());
+      counts.push_back(body.GetCountInstances());
+
+      MultipartTester tester;
+      MultipartStreamReader::ParseBody(tester, batch.c_str(), batch.size(), "abc");
+      ASSERT_EQ(body.GetCountInstances(), tester.parts_.size());
+
+      for (size_t i = 0; i < tester.parts_.size(); i++)
+      {
+        ASSERT_EQ("application/dicom", tester.types_[i]);
+        parts.push_back(tester.parts_[i]);
+      }
+    }
+
+    ASSERT_EQ(3u, counts.size());
+    ASSERT_EQ(2u, counts[0]);
+    ASSERT_EQ(2u, counts[1]);
+    ASSERT_EQ(1u, counts[2]);
+    ASSERT_TRUE(parts == instances);
+    ASSERT_EQ(5u, source.countCleared_);
+    ASSERT_THROW(body.Next(), Orthanc::OrthancException);
+  }
+
+  {
+    // The batch is closed after the instance that reaches "maxSize"
+    StowInstancesSource source(instances);
+    StowRequestBody body(source, "abc", 0, StowRequestBody::FormatPartHeader("abc", 5).size() + 6);
+
+    ASSERT_TRUE(body.StartBatch());
+    ASSERT_EQ(StowRequestBody::FormatPartHeader("abc", 5) + "hello" +
+              StowRequestBody::FormatPartHeader("abc", 0) + "\r\n--abc--\r\n", ReadStowBatch(body));
+    ASSERT_EQ(2u, body.GetCountInstances());
+
+    ASSERT_TRUE(body.StartBatch());
+    ASSERT_EQ(0u, body.GetCountInstances());
+    ReadStowBatch(body);
+    ASSERT_EQ(2u, body.GetCountInstances());
+
+    ASSERT_TRUE(body.StartBatch());
+    ASSERT_EQ(StowRequestBody::FormatPartHeader("abc", 1) + "!\r\n--abc--\r\n", ReadStowBatch(body));
+    ASSERT_EQ(1u, body.GetCountInstances());
+
+    ASSERT_FALSE(body.StartBatch());
+  }
+}
+
+
 int main(int argc, char **argv)
 {
   ::testing::InitGoogleTest(&argc, argv);